@@ -0,0 +1,65 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+// Offline propagation benchmark: N loopback nodes in one process.
+//
+//   cluster_sim_adv [--nodes N] [--topology line|ring|star|mesh|random] [--degree D]
+//                   [--blocks B] [--interval-ms MS] [--txs-per-block T] [--seed S]
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "cluster.hpp"
+
+using namespace sbc;
+
+static void print_latency(const char* name, const LatencyStats& s) {
+  std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(2)
+            << "p50 " << std::setw(8) << s.p50_ms << " ms  p90 " << std::setw(8) << s.p90_ms << " ms  max "
+            << std::setw(8) << s.max_ms << " ms  (" << s.samples << " samples)\n";
+}
+
+int main(int argc, char** argv) {
+  ClusterOptions opts;
+  ClusterLoad load;
+  std::string topology = "ring";
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--nodes" && i + 1 < argc) opts.nodes = std::stoul(argv[++i]);
+    else if (arg == "--topology" && i + 1 < argc) topology = argv[++i];
+    else if (arg == "--degree" && i + 1 < argc) opts.random_degree = std::stoul(argv[++i]);
+    else if (arg == "--blocks" && i + 1 < argc) load.blocks = std::stoul(argv[++i]);
+    else if (arg == "--interval-ms" && i + 1 < argc) load.block_interval = std::chrono::milliseconds(std::stol(argv[++i]));
+    else if (arg == "--txs-per-block" && i + 1 < argc) load.txs_per_block = std::stoul(argv[++i]);
+    else if (arg == "--seed" && i + 1 < argc) opts.seed = load.seed = (std::uint32_t)std::stoul(argv[++i]);
+    else {
+      std::cerr << "unknown argument: " << arg << "\n";
+      return 1;
+    }
+  }
+  if (!parse_topology(topology, &opts.topology)) {
+    std::cerr << "unknown topology: " << topology << "\n";
+    return 1;
+  }
+  // enough funds for every transfer even if one node submits them all
+  opts.funded_txs_per_node = std::max<std::size_t>(opts.funded_txs_per_node, load.blocks * load.txs_per_block);
+
+  Cluster cluster(opts);
+  std::cout << cluster.size() << " nodes, " << topology << " topology, " << cluster.links().size() << " links; "
+            << load.blocks << " blocks every " << load.block_interval.count() << " ms, " << load.txs_per_block
+            << " txs per block\n";
+  ClusterMetrics m = run_load(cluster, load);
+
+  std::cout << "blocks mined " << m.blocks_mined << ", orphaned " << m.blocks_orphaned << " (" << std::fixed
+            << std::setprecision(1) << m.orphan_rate * 100 << "%), converged " << (m.converged ? "yes" : "no")
+            << "\n";
+  print_latency("block to each node", m.block_propagation);
+  print_latency("block to all nodes", m.block_full);
+  std::cout << "txs submitted " << m.txs_submitted << ", included " << m.txs_included << "\n";
+  print_latency("tx to inclusion", m.tx_inclusion);
+  std::cout << "network: " << m.messages_sent << " messages, " << m.bytes_sent / 1024 << " KiB\n";
+  return m.converged ? 0 : 2;
+}
@@ -8,6 +8,7 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 #include "merkle.hpp"
 #include "util.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <sstream>
 
@@ -25,6 +26,7 @@ nlohmann::json Block::to_json() const {
   j["mine_ms"] = mine_ms;
   j["transactions"] = nlohmann::json::array();
   for (const auto& t : transactions) j["transactions"].push_back(t.to_json());
+  if (pruned) j["pruned"] = true;
   return j;
 }
 
@@ -39,9 +41,24 @@ Block Block::from_json(const nlohmann::json& j) {
   b.difficulty = j.at("difficulty").get<int>();
   b.mine_ms = j.value("mine_ms", 0ull);
   for (const auto& jt : j.at("transactions")) b.transactions.push_back(Tx::from_json(jt));
+  b.pruned = j.value("pruned", false);
   return b;
 }
 
+Block Block::header_only() const {
+  Block h;
+  h.index = index;
+  h.timestamp = timestamp;
+  h.prev_hash = prev_hash;
+  h.merkle_root = merkle_root;
+  h.hash = hash;
+  h.nonce = nonce;
+  h.difficulty = difficulty;
+  h.mine_ms = mine_ms;
+  h.pruned = true;
+  return h;
+}
+
 static bool meets_difficulty(std::string_view hex, int diff) {
   for (int i = 0; i < diff; ++i) if (i >= (int)hex.size() || hex[i] != '0') return false;
   return true;
@@ -55,6 +72,19 @@ std::string calculate_block_hash(const Block& b) {
   return crypto::sha256(oss.str());
 }
 
+bool header_is_valid(const Block& b) {
+  return meets_difficulty(b.hash, b.difficulty) && calculate_block_hash(b) == b.hash;
+}
+
+std::uint64_t block_work(int difficulty) {
+  return std::uint64_t{1} << (4 * std::clamp(difficulty, 0, 15));
+}
+
+bool chain_outweighs(std::uint64_t work, const std::string& tip, std::uint64_t other_work,
+                     const std::string& other_tip) {
+  return work != other_work ? work > other_work : tip < other_tip;
+}
+
 void mine_block(Block& b) {
   using namespace std::chrono;
   auto start = steady_clock::now();
@@ -23,12 +23,28 @@ struct Block {
   std::uint64_t mine_ms{};  // mining time in ms (informational)
 
   std::vector<Tx> transactions;  // includes non-coinbase; coinbase implied separately? keep simple
+  // header fields only, transactions empty: the body was dropped by pruning,
+  // or left in the block log (see load_full_block)
+  bool pruned{};
+
+  // Copy of the header with the body pruned away (merkle_root still commits
+  // to the dropped transactions, so the hash stays verifiable).
+  Block header_only() const;
 
   nlohmann::json to_json() const;
   static Block from_json(const nlohmann::json& j);
 };
 
 std::string calculate_block_hash(const Block& b);
+// Stored hash matches the header fields and meets the block's difficulty.
+bool header_is_valid(const Block& b);
+// Expected hash attempts behind a block of this difficulty (16^difficulty);
+// a chain's work is the sum over its blocks.
+std::uint64_t block_work(int difficulty);
+// The chain nodes settle on: more work, or the same work and the lower tip
+// hash, so two equal branches do not keep a network split.
+bool chain_outweighs(std::uint64_t work, const std::string& tip, std::uint64_t other_work,
+                     const std::string& other_tip);
 void mine_block(Block& b);
 
 }  // namespace sbc
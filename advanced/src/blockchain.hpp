@@ -5,52 +5,225 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 
 #pragma once
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "block.hpp"
+#include "codec.hpp"
+#include "snapshot.hpp"
 #include "state.hpp"
+#include "storage.hpp"
 #include "tx.hpp"
+#include "txindex.hpp"
 
 namespace sbc {
 
+// Block contents chosen ahead of mining: the selected txs, their Merkle root
+// and the state after applying them. Building one touches no chain fields, so
+// it can run on another thread while the previous block is being mined.
+struct BlockTemplate {
+  std::vector<Tx> txs;        // applied cleanly on top of the base state, in order
+  std::vector<Tx> rejected;   // can never apply (bad signature, stale nonce); evicted on commit
+  std::vector<Tx> deferred;   // not yet applicable (nonce gap, unfunded); stay pending
+  std::string merkle_root;
+  StateMachine post_state;    // base + coinbase + txs
+  std::string base_tip;       // hash the template builds on (empty = not yet known)
+};
+
+struct ReindexProgress {
+  std::uint64_t height{};  // last block applied
+  std::uint64_t tip{};
+  std::uint64_t txs{};     // txs replayed so far
+  std::uint64_t sigs_skipped{};  // signatures trusted via assume-valid
+  double seconds{};
+  double txs_per_sec{};
+};
+using ReindexCallback = std::function<void(const ReindexProgress&)>;
+
+struct ParsedChainJson;
+
+// A validated-height watermark and the hash of the block at that height.
+struct ValidatedCheckpoint {
+  std::uint64_t height{};
+  std::string hash;
+};
+
+struct LoadOptions {
+  ReindexCallback progress;
+  std::string assume_valid;  // overrides Params::assume_valid for the replay
+  // Replay starts after this block instead of at genesis (required once
+  // bodies are pruned). Its block hash must be on the loaded chain.
+  std::shared_ptr<const StateSnapshot> state_snapshot;
+  // Watermark persisted next to a block log (chain JSON carries its own).
+  std::optional<ValidatedCheckpoint> validated;
+};
+
 class Blockchain {
  public:
   struct Params {
     int initial_difficulty = 3;
     std::uint64_t target_block_time_sec = 10;  // educational
     std::size_t retarget_interval = 10;        // adjust every N blocks
+    bool tx_index = false;                     // maintain tx-id / address history indexes
+    // Assume-valid checkpoint: replay skips ECDSA checks for blocks at or below
+    // this hash (nonce/balance rules, tx hashes and Merkle roots still apply).
+    // Ignored if the hash is not on the chain. Node config, not persisted.
+    std::string assume_valid;
+    // Pruned mode: keep transactions only for the last N blocks (0 = keep
+    // all). Older blocks stay as headers, so replay must start from a
+    // StateSnapshot at or above the pruned range. Not compatible with tx_index.
+    std::size_t prune_keep = 0;
+    // A reorg up to this many blocks deep rolls the account table back to
+    // the fork from versions kept per recent block (CowMap copies, so each
+    // costs about what the block changed); a deeper one replays the chain.
+    std::size_t reorg_depth = 1024;
   };
 
-  explicit Blockchain(Params p = {});
+  Blockchain();
+  explicit Blockchain(Params p);
 
   void addTransaction(Tx tx);
+  const std::vector<Tx>& pending() const noexcept { return mempool_; }
   const Block& minePending(const std::string& miner_addr);
 
-  bool isValid() const;
+  // Pipelined mining: build a template from candidates on top of `base`,
+  // stamp it into a header for the current tip, then commit the mined block.
+  // Signatures go through sigs when given (each tx verified once), and each
+  // sender's txs are tried in nonce order.
+  static BlockTemplate buildTemplate(const StateMachine& base, const std::vector<Tx>& candidates,
+                                     const std::string& miner_addr, std::uint64_t height,
+                                     SigCache* sigs = nullptr);
+  // A sender's not-yet-applicable txs kept pending, lowest nonces first; the
+  // rest are rejected (and evicted on commit).
+  static constexpr std::size_t kMaxDeferredPerSender = 64;
+  // Shared by copies of this chain; Node hands it to off-lock templates.
+  const std::shared_ptr<SigCache>& sigCache() const noexcept { return sig_cache_; }
+  BlockTemplate buildTemplate(const std::string& miner_addr) const;
+  bool templateIsCurrent(const BlockTemplate& t) const { return t.base_tip == chain_.back().hash; }
+  Block makeBlock(const BlockTemplate& t) const;
+  bool commitTemplate(const Block& mined, BlockTemplate t, std::string* err = nullptr);
 
-  const std::vector<Block>& chain() const noexcept { return chain_; }
+  // Append a block received from a peer. It must extend the tip, carry the
+  // difficulty the chain requires next with a hash meeting it, and its transactions must apply cleanly to the current state.
+  bool acceptBlock(const Block& b, std::string* err = nullptr);
+
+  // Drop the blocks above `height` (a reorg's fork point) and return their
+  // transactions to the pending set. Within Params::reorg_depth the state is
+  // rolled back, so only the dropped bodies are needed; deeper forks replay
+  // the chain up to `height`. Fails, leaving the chain as it was, if a body
+  // either way needs has been pruned.
+  bool rewind(std::uint64_t height, std::string* err = nullptr);
+  // Reorg in place: rewind(fork), then accept branch on top. on_step runs
+  // after the rewind and after each branch block. If a branch block fails,
+  // the dropped blocks, state and pending set are put back as they were.
+  bool switchBranch(std::uint64_t fork, const std::vector<Block>& branch, std::string* err = nullptr,
+                    const std::function<void()>& on_step = {});
+
+  // Full check of every header. Per-block hash/PoW checks run in parallel;
+  // prev-hash linkage is a cheap sequential pass afterwards. On failure the
+  // lowest bad height is stored in *first_bad.
+  bool isValid(std::size_t* first_bad = nullptr) const;
+
+  // Like isValid, but Incremental mode only checks blocks above the
+  // validated-height watermark and then advances it. Deep re-checks from
+  // block 1 regardless. Blocks we mine or accept from peers are verified on
+  // the way in, so they extend the watermark immediately.
+  enum class ValidateMode { Incremental, Deep };
+  bool validate(ValidateMode mode = ValidateMode::Incremental, std::size_t* first_bad = nullptr);
+  std::uint64_t validatedHeight() const noexcept { return validated_height_; }
+  ValidatedCheckpoint validatedCheckpoint() const { return {validated_height_, chain_[validated_height_].hash}; }
+
+  // Blocks read from a block log are held header-only (pruned set) and their
+  // bodies stay on disk; body(h) returns block h with its transactions.
+  const BlockList& chain() const noexcept { return chain_; }
+  std::shared_ptr<const Block> body(std::uint64_t h) const { return load_full_block(chain_, load_body_, h); }
+
+  // O(1) lookup by block hash (nullptr / nullopt if unknown).
+  const Block* findBlock(const std::string& hash) const;
+  std::optional<std::uint64_t> heightOf(const std::string& hash) const;
+
+  // Secondary indexes, or nullptr unless Params::tx_index is set.
+  const TxIndex* txIndex() const noexcept { return params_.tx_index ? &tx_index_ : nullptr; }
   const StateMachine& state() const noexcept { return state_; }
+  // Blocks below this height are header-only (see Params::prune_keep).
+  std::uint64_t prunedBelow() const noexcept { return pruned_below_; }
   int difficulty() const noexcept { return current_diff_; }
+  std::uint64_t work() const noexcept { return work_; }  // sum of block_work over the chain
+  const Params& params() const noexcept { return params_; }
+
+  // Difficulty required of the block after height `parent`, given the one
+  // required of the parent. Every retarget_interval blocks it moves one step
+  // toward the target time, from the mine times of the blocks up to the
+  // parent (mine_ms_at(height)). Peers check headers against it.
+  static int nextDifficulty(const Params& p, int parent_required, std::uint64_t parent,
+                            const std::function<std::uint64_t(std::uint64_t)>& mine_ms_at);
+
+  // Immutable view of the current chain and state; cheap to take (block segments
+  // and the account table share structure with the chain, so neither is copied).
+  std::shared_ptr<const ChainSnapshot> snapshot() const;
+
+  // Rebuild state_ from genesis by replaying every block (coinbase, then txs).
+  // Merkle roots and signatures are checked in parallel per batch of blocks
+  // (signatures only above the assume-valid block); state is applied
+  // sequentially. progress is called after each batch. With a base
+  // snapshot, replay starts from its state right after its block.
+  bool reindex(std::string* err = nullptr, const ReindexCallback& progress = {},
+               const StateSnapshot* base = nullptr);
 
-  // Persistence helpers
+  // Persistence helpers. Both directions stream: writeJson emits one block at
+  // a time and fromJson parses with SAX, so memory beyond the chain itself
+  // stays bounded. fromJson replays the chain to rebuild state and throws
+  // std::runtime_error on malformed input or if the replay fails.
+  void writeJson(std::ostream& out) const;
   std::string toJson() const;
-  static Blockchain fromJson(const std::string& s);
+  static Blockchain fromJson(std::string_view s, const LoadOptions& opts = {});
+  static Blockchain fromJson(std::istream& in, const LoadOptions& opts = {});
+  // Rebuild from a block log (height i = record i), recomputing difficulty
+  // retargets and replaying state. Only headers are decoded up front; bodies
+  // are read back from the log's files when needed, so those files must
+  // stay in place. Throws std::runtime_error on bad data.
+  static Blockchain fromBlockLog(const storage::BlockLog& log, Params p,
+                                 const LoadOptions& opts = {});
 
  private:
   static Block genesis();
+  static Blockchain fromParsedJson(ParsedChainJson&& pc, const LoadOptions& opts);
+  void appendBlock(Block b);
+  void recordState();  // after state_ reaches a new tip
+  void unindexFrom(std::uint64_t height);
+  void restoreWatermark(const std::optional<ValidatedCheckpoint>& cp);
+  void rebuildIndex();
   void retargetIfNeeded();
-  std::string compute_merkle() const;
-  bool validate_block_link(std::size_t i) const;
+  void pruneIfNeeded(bool force);
+  bool validate_block_header(std::size_t i) const;  // hash + PoW + Merkle, no neighbours
+  bool validate_block_link(std::size_t i) const;    // prev_hash of i matches i-1
+  std::size_t first_invalid_from(std::size_t from) const;  // chain_.size() if none
 
  private:
   Params params_;
   int current_diff_;
-  std::vector<Block> chain_;
+  BlockList chain_;
+  // hash -> height, keyed by the low 64 bits of the hash (the high bits are
+  // mostly PoW zeros); findBlock compares the full hash to resolve collisions
+  std::unordered_multimap<std::uint64_t, std::uint64_t> height_by_hash_;
+  TxIndex tx_index_;
+  std::uint64_t work_ = 0;
+  std::uint64_t validated_height_ = 0;  // every block <= this has passed validation
+  std::uint64_t pruned_below_ = 1;      // bodies of blocks below this are dropped
   std::vector<Tx> mempool_;
+  std::shared_ptr<SigCache> sig_cache_ = std::make_shared<SigCache>();
   StateMachine state_;
+  // account table after each of the last reorg_depth + 1 blocks; back() is the tip's
+  std::deque<AccountState> recent_states_;
+  BodyLoader load_body_;  // set when loaded from a block log
 };
 
 }  // namespace sbc
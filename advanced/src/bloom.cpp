@@ -0,0 +1,76 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "bloom.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sbc {
+
+RollingBloom::RollingBloom(std::size_t per_generation, double fp_rate)
+    : per_generation_(std::max<std::size_t>(per_generation, 1)) {
+  // optimal size and hash count for n keys at rate p (each generation holds n)
+  const double ln2 = std::log(2.0);
+  double p = std::min(std::max(fp_rate, 1e-12), 0.5);
+  double m = -static_cast<double>(per_generation_) * std::log(p) / (ln2 * ln2);
+  bits_ = std::max<std::size_t>(64, (static_cast<std::size_t>(m) + 63) / 64 * 64);
+  k_ = static_cast<unsigned>(std::clamp(std::lround(m / per_generation_ * ln2), 1L, 50L));
+  for (auto& g : gen_) g.assign(bits_ / 64, 0);
+}
+
+RollingBloom::Hashes RollingBloom::hash(std::string_view key) {
+  // FNV-1a with two offsets; h2 forced odd so the k probes never cycle early
+  std::uint64_t a = 14695981039346656037ull, b = 0x9e3779b97f4a7c15ull;
+  for (unsigned char c : key) {
+    a = (a ^ c) * 1099511628211ull;
+    b = (b ^ c) * 0x100000001b3ull + 0x7f4a7c15ull;
+  }
+  b ^= b >> 31;
+  return {a ^ (a >> 29), b | 1};
+}
+
+bool RollingBloom::test(const std::vector<std::uint64_t>& gen, Hashes h) const {
+  for (unsigned i = 0; i < k_; ++i) {
+    std::uint64_t bit = (h.h1 + i * h.h2) % bits_;
+    if (!(gen[bit / 64] >> (bit % 64) & 1)) return false;
+  }
+  return true;
+}
+
+void RollingBloom::set(std::vector<std::uint64_t>& gen, Hashes h) {
+  for (unsigned i = 0; i < k_; ++i) {
+    std::uint64_t bit = (h.h1 + i * h.h2) % bits_;
+    gen[bit / 64] |= std::uint64_t{1} << (bit % 64);
+  }
+}
+
+void RollingBloom::insert(std::string_view key) {
+  if (count_ == per_generation_) {
+    cur_ ^= 1;
+    std::fill(gen_[cur_].begin(), gen_[cur_].end(), 0);
+    count_ = 0;
+  }
+  set(gen_[cur_], hash(key));
+  ++count_;
+}
+
+bool RollingBloom::contains(std::string_view key) const {
+  Hashes h = hash(key);
+  return test(gen_[cur_], h) || test(gen_[cur_ ^ 1], h);
+}
+
+bool RollingBloom::testAndInsert(std::string_view key) {
+  bool seen = contains(key);
+  if (!seen) insert(key);
+  return seen;
+}
+
+void RollingBloom::clear() {
+  for (auto& g : gen_) std::fill(g.begin(), g.end(), 0);
+  count_ = 0;
+}
+
+}  // namespace sbc
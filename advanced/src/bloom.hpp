@@ -0,0 +1,48 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace sbc {
+
+// Bounded "seen recently" set: two Bloom filter generations of `per_generation`
+// keys each. Inserts go to the current generation; once it is full the older
+// one is cleared and becomes current. A key is therefore remembered for at
+// least `per_generation` further inserts (false negatives only after that),
+// and memory never grows. False positives occur at about `fp_rate`.
+// Not thread-safe.
+class RollingBloom {
+ public:
+  explicit RollingBloom(std::size_t per_generation = 50000, double fp_rate = 0.000001);
+
+  void insert(std::string_view key);
+  bool contains(std::string_view key) const;
+  // insert(key); returns whether it was (probably) present before.
+  bool testAndInsert(std::string_view key);
+  void clear();
+
+  std::size_t bits() const noexcept { return bits_; }
+
+ private:
+  struct Hashes {
+    std::uint64_t h1, h2;
+  };
+  static Hashes hash(std::string_view key);
+  bool test(const std::vector<std::uint64_t>& gen, Hashes h) const;
+  void set(std::vector<std::uint64_t>& gen, Hashes h);
+
+  std::size_t per_generation_;
+  std::size_t bits_;
+  unsigned k_;
+  std::vector<std::uint64_t> gen_[2];
+  int cur_ = 0;
+  std::size_t count_ = 0;  // keys in gen_[cur_]
+};
+
+}  // namespace sbc
@@ -0,0 +1,347 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "cluster.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "crypto.hpp"
+#include "dispatch.hpp"
+#include "gossip.hpp"
+#include "p2p.hpp"
+#include "relay.hpp"
+#include "sync.hpp"
+
+namespace sbc {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ms_between(Clock::time_point a, Clock::time_point b) {
+  return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+LatencyStats summarize(std::vector<double> v) {
+  LatencyStats s;
+  s.samples = v.size();
+  if (v.empty()) return s;
+  std::sort(v.begin(), v.end());
+  s.p50_ms = v[v.size() / 2];
+  s.p90_ms = v[std::min(v.size() - 1, v.size() * 9 / 10)];
+  s.max_ms = v.back();
+  return s;
+}
+
+}  // namespace
+
+bool parse_topology(std::string_view name, Topology* out) {
+  if (name == "line") *out = Topology::Line;
+  else if (name == "ring") *out = Topology::Ring;
+  else if (name == "star") *out = Topology::Star;
+  else if (name == "mesh") *out = Topology::Mesh;
+  else if (name == "random") *out = Topology::Random;
+  else return false;
+  return true;
+}
+
+std::vector<std::pair<std::size_t, std::size_t>> make_topology(Topology t, std::size_t n, std::size_t degree,
+                                                                std::uint32_t seed) {
+  std::set<std::pair<std::size_t, std::size_t>> links;
+  auto link = [&](std::size_t a, std::size_t b) {
+    if (a != b) links.emplace(std::min(a, b), std::max(a, b));
+  };
+  switch (t) {
+    case Topology::Line:
+      for (std::size_t i = 1; i < n; ++i) link(i - 1, i);
+      break;
+    case Topology::Ring:
+      for (std::size_t i = 1; i < n; ++i) link(i - 1, i);
+      if (n > 2) link(n - 1, 0);
+      break;
+    case Topology::Star:
+      for (std::size_t i = 1; i < n; ++i) link(0, i);
+      break;
+    case Topology::Mesh:
+      for (std::size_t a = 0; a < n; ++a)
+        for (std::size_t b = a + 1; b < n; ++b) link(a, b);
+      break;
+    case Topology::Random: {
+      for (std::size_t i = 1; i < n; ++i) link(i - 1, i);  // ring keeps it connected
+      if (n > 2) link(n - 1, 0);
+      std::mt19937 rng(seed);
+      std::size_t target = std::min(n * std::max<std::size_t>(degree, 2) / 2, n * (n - 1) / 2);
+      for (std::size_t tries = 0; links.size() < target && tries < 100 * target; ++tries) {
+        link(rng() % n, rng() % n);
+      }
+      break;
+    }
+  }
+  return {links.begin(), links.end()};
+}
+
+// Timestamps shared by every node's commit hook.
+struct Cluster::Recorder {
+  struct BlockSeen {
+    Clock::time_point first;  // commit on the node that mined it
+    std::size_t origin{};
+    std::vector<double> delays;  // other nodes, ms after first
+  };
+  mutable std::mutex mu;
+  std::unordered_map<std::string, BlockSeen> blocks;
+  std::vector<std::string> mined;  // hashes mined through Cluster::mine
+  std::unordered_map<std::string, Clock::time_point> submitted;
+  std::vector<double> inclusion;
+  std::uint64_t txs_submitted = 0;
+  std::atomic<std::uint64_t> bytes{0};
+  std::atomic<std::uint64_t> messages{0};
+};
+
+// One loopback node; members are declared in dependency order, so
+// destruction tears down the listener first.
+struct Cluster::Member {
+  Node node;
+  std::unique_ptr<p2p::PeerPool> pool;  // created once every port is known
+  std::vector<std::string> neighbours;
+  Recorder* rec;
+  BlockRelay relay;
+  ChainSync sync;
+  TxGossip gossip;
+  MessageDispatcher dispatcher;
+  p2p::Listener listener;
+  std::string addr;
+  std::pair<std::string, std::string> key;  // funded (private, public) PEMs
+  std::uint64_t nonce = 0;
+  std::mutex tx_mu;
+
+  Member(Blockchain bc, Recorder* r, std::pair<std::string, std::string> kp)
+      : node(std::move(bc)),
+        rec(r),
+        relay(node, [this](const std::string& p, const std::string& m) { send(p, m); },
+              [this](const Block& b) { announce(relay.announce(b)); }),  // forward accepted blocks
+        sync(node, [this](const std::string& p, const std::string& m) { send(p, m); }, syncOptions()),
+        gossip(node, [this](const std::string& p, const std::string& m) { send(p, m); }),
+        dispatcher([this](WireReader& m) {
+          if (!relay.handle(m) && !sync.handle(m)) gossip.handle(m);
+        }),
+        listener("127.0.0.1", 0, [this](std::string m) { dispatcher.post(std::move(m)); }),
+        key(std::move(kp)) {}
+
+  static SyncOptions syncOptions() {
+    SyncOptions o;
+    o.tip_poll = std::chrono::milliseconds(500);  // catch up quickly after a missed announcement
+    o.request_timeout = std::chrono::milliseconds(2000);
+    return o;
+  }
+
+  void send(const std::string& peer, const std::string& msg) {
+    rec->bytes += msg.size() + 4;
+    ++rec->messages;
+    pool->sendTo(peer, msg);
+  }
+
+  void announce(const std::string& msg) {
+    rec->bytes += (msg.size() + 4) * neighbours.size();
+    rec->messages += neighbours.size();
+    pool->broadcast(msg);
+  }
+
+  void stop() {
+    listener.stop();
+    dispatcher.stop();
+    sync.stop();
+    gossip.stop();
+    if (pool) pool->stop();
+  }
+};
+
+Cluster::Cluster(ClusterOptions opts) : opts_(opts), rec_(std::make_unique<Recorder>()) {
+  const std::size_t n = std::max<std::size_t>(opts_.nodes, 1);
+  links_ = make_topology(opts_.topology, n, opts_.random_degree, opts_.seed);
+
+  // shared genesis chain that funds one key per node
+  Blockchain::Params p;
+  p.initial_difficulty = opts_.difficulty;
+  p.retarget_interval = 1u << 30;  // keep difficulty fixed
+  Blockchain genesis(p);
+  std::vector<std::pair<std::string, std::string>> keys;
+  const std::size_t funding_blocks = (opts_.funded_txs_per_node + 49) / 50;  // 50 per coinbase
+  for (std::size_t i = 0; i < n; ++i) {
+    keys.push_back(crypto::generate_ec_keypair());
+    for (std::size_t k = 0; k < funding_blocks; ++k) genesis.minePending(Tx::addr_from_pubkey(keys[i].second));
+  }
+  std::string genesis_json = genesis.toJson();
+
+  for (std::size_t i = 0; i < n; ++i) {
+    members_.push_back(std::make_unique<Member>(Blockchain::fromJson(genesis_json), rec_.get(), keys[i]));
+    Member& m = *members_.back();
+    std::string err;
+    if (!m.listener.start(&err)) throw std::runtime_error("cluster: " + err);
+    m.addr = "127.0.0.1:" + std::to_string(m.listener.port());
+    m.relay.setSelfAddress(m.addr);
+    m.sync.setSelfAddress(m.addr);
+    m.gossip.setSelfAddress(m.addr);
+    m.relay.setGapHandler([&m](const std::string& peer) { m.sync.peerAhead(peer); });
+    m.node.setCommitHook([this, i](const Block& b) { onCommit(i, b); });
+  }
+  for (const auto& [a, b] : links_) {
+    members_[a]->neighbours.push_back(members_[b]->addr);
+    members_[b]->neighbours.push_back(members_[a]->addr);
+  }
+  // every pool exists before any node can send
+  for (auto& m : members_) {
+    m->pool = std::make_unique<p2p::PeerPool>(m->neighbours);
+    for (const auto& peer : m->neighbours) m->gossip.addPeer(peer);
+  }
+  for (auto& m : members_) m->sync.start(m->neighbours);
+}
+
+Cluster::~Cluster() {
+  for (auto& m : members_) m->listener.stop();
+  for (auto& m : members_) m->stop();
+  for (auto& m : members_) m->node.setCommitHook({});
+}
+
+std::size_t Cluster::size() const { return members_.size(); }
+
+Node& Cluster::node(std::size_t i) { return members_.at(i)->node; }
+
+void Cluster::onCommit(std::size_t i, const Block& b) {
+  auto now = Clock::now();
+  std::lock_guard<std::mutex> lk(rec_->mu);
+  auto [it, first] = rec_->blocks.try_emplace(b.hash);
+  if (first) {
+    it->second.first = now;
+    it->second.origin = i;
+    for (const auto& tx : b.transactions) {
+      auto s = rec_->submitted.find(tx.hash());
+      if (s == rec_->submitted.end()) continue;
+      rec_->inclusion.push_back(ms_between(s->second, now));
+      rec_->submitted.erase(s);
+    }
+  } else if (i != it->second.origin) {
+    it->second.delays.push_back(ms_between(it->second.first, now));
+  }
+}
+
+std::string Cluster::submitTx(std::size_t i) {
+  Member& m = *members_.at(i);
+  Tx tx;
+  {
+    std::lock_guard<std::mutex> lk(m.tx_mu);
+    tx.from_pubkey_pem = m.key.second;
+    tx.to_addr = Tx::addr_from_pubkey(members_[(i + 1) % members_.size()]->key.second);
+    tx.amount = 1;
+    tx.nonce = ++m.nonce;
+    tx.signature_hex = crypto::ecdsa_sign_p256(m.key.first, tx.message());
+  }
+  std::string id = tx.hash();
+  {
+    std::lock_guard<std::mutex> lk(rec_->mu);
+    rec_->submitted[id] = Clock::now();
+    ++rec_->txs_submitted;
+  }
+  m.gossip.submit(std::move(tx));
+  return id;
+}
+
+Block Cluster::mine(std::size_t i) {
+  Member& m = *members_.at(i);
+  Block b = m.node.mine("miner-" + std::to_string(i));
+  {
+    std::lock_guard<std::mutex> lk(rec_->mu);
+    rec_->mined.push_back(b.hash);
+  }
+  m.announce(m.relay.announce(b));
+  return b;
+}
+
+bool Cluster::waitConverged(std::chrono::milliseconds timeout) const {
+  auto deadline = Clock::now() + timeout;
+  for (;;) {
+    std::string tip = members_[0]->node.snapshot()->tip().hash;
+    bool same = std::all_of(members_.begin(), members_.end(),
+                            [&](const auto& m) { return m->node.snapshot()->tip().hash == tip; });
+    if (same) return true;
+    if (Clock::now() >= deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+ClusterMetrics Cluster::metrics() const {
+  ClusterMetrics out;
+  // the chain most nodes ended on decides which blocks were orphaned
+  std::map<std::string, std::size_t> tips;
+  for (const auto& m : members_) ++tips[m->node.snapshot()->tip().hash];
+  out.converged = tips.size() == 1;
+  auto best = std::max_element(tips.begin(), tips.end(),
+                               [](const auto& a, const auto& b) { return a.second < b.second; });
+  const Member* ref = nullptr;
+  for (const auto& m : members_) {
+    if (m->node.snapshot()->tip().hash == best->first) {
+      ref = m.get();
+      break;
+    }
+  }
+
+  std::vector<std::string> mined;
+  {
+    std::lock_guard<std::mutex> lk(rec_->mu);
+    mined = rec_->mined;
+  }
+  // commit hooks take rec_->mu under the node's writer lock, so probe unlocked
+  out.blocks_mined = mined.size();
+  for (const auto& h : mined) out.blocks_orphaned += !ref->node.findBlock(h);
+
+  std::lock_guard<std::mutex> lk(rec_->mu);
+  out.orphan_rate = out.blocks_mined ? double(out.blocks_orphaned) / out.blocks_mined : 0.0;
+  std::vector<double> per_node, full;
+  for (const auto& h : mined) {
+    auto it = rec_->blocks.find(h);
+    if (it == rec_->blocks.end() || it->second.delays.empty()) continue;
+    per_node.insert(per_node.end(), it->second.delays.begin(), it->second.delays.end());
+    if (it->second.delays.size() + 1 == members_.size()) {
+      full.push_back(*std::max_element(it->second.delays.begin(), it->second.delays.end()));
+    }
+  }
+  out.block_propagation = summarize(std::move(per_node));
+  out.block_full = summarize(std::move(full));
+  out.txs_submitted = rec_->txs_submitted;
+  out.txs_included = rec_->inclusion.size();
+  out.tx_inclusion = summarize(rec_->inclusion);
+  out.bytes_sent = rec_->bytes.load();
+  out.messages_sent = rec_->messages.load();
+  return out;
+}
+
+ClusterMetrics run_load(Cluster& cluster, const ClusterLoad& load) {
+  std::mt19937 rng(load.seed);
+  const std::size_t n = cluster.size();
+  auto next = Clock::now();
+  for (std::size_t b = 0; b < load.blocks; ++b) {
+    // transactions spread over the interval, then a block from a random node
+    auto step = load.block_interval / (load.txs_per_block + 1);
+    for (std::size_t t = 0; t < load.txs_per_block; ++t) {
+      next += step;
+      std::this_thread::sleep_until(next);
+      cluster.submitTx(rng() % n);
+    }
+    next += load.block_interval - step * load.txs_per_block;
+    std::this_thread::sleep_until(next);
+    cluster.mine(rng() % n);
+  }
+  cluster.waitConverged(load.settle);
+  return cluster.metrics();
+}
+
+}  // namespace sbc
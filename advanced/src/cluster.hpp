@@ -0,0 +1,111 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "block.hpp"
+#include "node.hpp"
+
+namespace sbc {
+
+enum class Topology { Line, Ring, Star, Mesh, Random };
+
+bool parse_topology(std::string_view name, Topology* out);  // "line", "ring", "star", "mesh", "random"
+
+// Undirected links (a < b) between nodes 0..n-1. Random is a ring plus
+// random chords until every node has about `degree` links, seeded.
+std::vector<std::pair<std::size_t, std::size_t>> make_topology(Topology t, std::size_t n, std::size_t degree = 3,
+                                                                std::uint32_t seed = 1);
+
+struct ClusterOptions {
+  std::size_t nodes = 4;
+  Topology topology = Topology::Ring;
+  std::size_t random_degree = 3;
+  std::uint32_t seed = 1;
+  int difficulty = 1;
+  std::size_t funded_txs_per_node = 500;  // pre-mined coinbase for synthetic transfers
+};
+
+struct LatencyStats {
+  std::size_t samples{};
+  double p50_ms{};
+  double p90_ms{};
+  double max_ms{};
+};
+
+struct ClusterMetrics {
+  std::uint64_t blocks_mined{};
+  std::uint64_t blocks_orphaned{};  // mined but not on the chain most nodes ended on
+  double orphan_rate{};
+  LatencyStats block_propagation;   // mined -> committed, per (block, other node)
+  LatencyStats block_full;          // mined -> committed on the last node that got it
+  std::uint64_t txs_submitted{};
+  std::uint64_t txs_included{};
+  LatencyStats tx_inclusion;        // submitted -> first mined into a block
+  std::uint64_t bytes_sent{};       // all peer traffic, framing included
+  std::uint64_t messages_sent{};
+  bool converged{};                 // every node on the same tip
+};
+
+// N full nodes on loopback, each with its own listener, peer pool, block
+// relay (accepted blocks are forwarded), chain sync, tx gossip and message
+// dispatcher, linked in the given topology. All nodes start from one genesis
+// chain that funds a key per node for synthetic transfers. Commit times are
+// recorded per node for the metrics. Throws std::runtime_error if a listener
+// cannot bind.
+class Cluster {
+ public:
+  explicit Cluster(ClusterOptions opts = {});
+  ~Cluster();
+  Cluster(const Cluster&) = delete;
+  Cluster& operator=(const Cluster&) = delete;
+
+  std::size_t size() const;
+  const std::vector<std::pair<std::size_t, std::size_t>>& links() const { return links_; }
+  Node& node(std::size_t i);
+
+  // Sign a 1-unit transfer from node i's funded key, submit it there and
+  // gossip it. Returns the tx id.
+  std::string submitTx(std::size_t i);
+  // Mine a block on node i and announce it to its neighbours.
+  Block mine(std::size_t i);
+
+  // Wait until every node has the same tip (true), or timeout.
+  bool waitConverged(std::chrono::milliseconds timeout) const;
+  ClusterMetrics metrics() const;
+
+ private:
+  struct Member;
+  struct Recorder;
+  void onCommit(std::size_t i, const Block& b);
+
+  ClusterOptions opts_;
+  std::vector<std::pair<std::size_t, std::size_t>> links_;
+  std::unique_ptr<Recorder> rec_;
+  std::vector<std::unique_ptr<Member>> members_;
+};
+
+struct ClusterLoad {
+  std::size_t blocks = 20;
+  std::chrono::milliseconds block_interval{200};
+  std::size_t txs_per_block = 10;  // spread evenly over the interval, random nodes
+  std::uint32_t seed = 1;
+  std::chrono::milliseconds settle{5000};  // wait for convergence at the end
+};
+
+// Drive synthetic load: every block interval a random node mines, and
+// txs_per_block transactions are submitted at random nodes in between.
+// Returns the cluster's metrics once it converges (or settle runs out).
+ClusterMetrics run_load(Cluster& cluster, const ClusterLoad& load);
+
+}  // namespace sbc
@@ -0,0 +1,335 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "codec.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+#if defined(SBC_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace sbc {
+
+namespace {
+
+constexpr std::uint8_t kFlagZlib = 1;
+constexpr std::uint8_t kFlagPruned = 2;
+constexpr std::uint8_t kHexRaw = 0;   // lowercase hex stored as bytes
+constexpr std::uint8_t kVerbatim = 1;
+
+std::uint64_t zigzag(std::int64_t v) { return ((std::uint64_t)v << 1) ^ (std::uint64_t)(v >> 63); }
+std::int64_t unzigzag(std::uint64_t v) { return (std::int64_t)((v >> 1) ^ (0 - (v & 1))); }
+
+int hex_val(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+}  // namespace
+
+namespace codec {
+
+void put_varint(std::string& out, std::uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((char)((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out.push_back((char)v);
+}
+
+void put_str(std::string& out, std::string_view s) {
+  put_varint(out, s.size());
+  out.append(s.data(), s.size());
+}
+
+void put_hex(std::string& out, std::string_view s) {
+  bool hex = !s.empty() && s.size() % 2 == 0;
+  for (std::size_t i = 0; hex && i < s.size(); ++i) hex = hex_val(s[i]) >= 0;
+  if (!hex) {
+    out.push_back((char)kVerbatim);
+    put_str(out, s);
+    return;
+  }
+  out.push_back((char)kHexRaw);
+  put_varint(out, s.size() / 2);
+  for (std::size_t i = 0; i < s.size(); i += 2) {
+    out.push_back((char)((hex_val(s[i]) << 4) | hex_val(s[i + 1])));
+  }
+}
+
+std::uint64_t Reader::varint() {
+  std::uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (pos >= in.size()) break;
+    auto byte = (std::uint8_t)in[pos++];
+    v |= (std::uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return v;
+  }
+  ok = false;
+  return 0;
+}
+
+std::string_view Reader::bytes(std::uint64_t n) {
+  if (!ok || n > in.size() - pos) { ok = false; return {}; }
+  auto s = in.substr(pos, n);
+  pos += n;
+  return s;
+}
+
+std::string Reader::hex() {
+  auto tag = bytes(1);
+  if (!ok) return {};
+  if ((std::uint8_t)tag[0] == kVerbatim) return str();
+  if ((std::uint8_t)tag[0] != kHexRaw) { ok = false; return {}; }
+  static const char* digits = "0123456789abcdef";
+  auto raw = bytes(varint());
+  std::string s;
+  s.reserve(raw.size() * 2);
+  for (char c : raw) {
+    s.push_back(digits[((std::uint8_t)c) >> 4]);
+    s.push_back(digits[((std::uint8_t)c) & 0xf]);
+  }
+  return s;
+}
+
+}  // namespace codec
+
+namespace {
+
+using codec::put_hex;
+using codec::put_str;
+using codec::put_varint;
+using codec::Reader;
+
+// Transaction list: each sender PEM (~180 bytes) is stored once.
+//   varint key count, str key...; varint tx count, per tx: varint key ref,
+//   hex to_addr, varint amount, varint nonce, hex signature
+void put_txs(std::string& out, const std::vector<Tx>& txs) {
+  std::unordered_map<std::string_view, std::uint64_t> key_ref;
+  std::vector<std::string_view> keys;
+  for (const auto& tx : txs) {
+    if (!tx.from_pubkey_pem.empty() && key_ref.emplace(tx.from_pubkey_pem, keys.size() + 1).second) {
+      keys.push_back(tx.from_pubkey_pem);
+    }
+  }
+  put_varint(out, keys.size());
+  for (auto k : keys) put_str(out, k);
+
+  put_varint(out, txs.size());
+  for (const auto& tx : txs) {
+    put_varint(out, tx.from_pubkey_pem.empty() ? 0 : key_ref[tx.from_pubkey_pem]);
+    put_hex(out, tx.to_addr);
+    put_varint(out, tx.amount);
+    put_varint(out, tx.nonce);
+    put_hex(out, tx.signature_hex);
+  }
+}
+
+void read_txs(Reader& r, std::vector<Tx>* out) {
+  std::uint64_t nkeys = r.varint();
+  if (nkeys > r.in.size()) r.ok = false;
+  std::vector<std::string> keys;
+  for (std::uint64_t i = 0; r.ok && i < nkeys; ++i) keys.push_back(r.str());
+
+  std::uint64_t ntx = r.varint();
+  if (ntx > r.in.size()) r.ok = false;
+  if (r.ok) out->reserve(ntx);
+  for (std::uint64_t i = 0; r.ok && i < ntx; ++i) {
+    Tx tx;
+    std::uint64_t ref = r.varint();
+    if (ref > keys.size()) { r.ok = false; break; }
+    if (ref) tx.from_pubkey_pem = keys[ref - 1];
+    tx.to_addr = r.hex();
+    tx.amount = r.varint();
+    tx.nonce = r.varint();
+    tx.signature_hex = r.hex();
+    out->push_back(std::move(tx));
+  }
+}
+
+
+std::string encode_body(const Block& b) {
+  std::string out;
+  out.reserve(256 + b.transactions.size() * 160);
+  put_varint(out, b.index);
+  put_str(out, b.timestamp);
+  put_hex(out, b.prev_hash);
+  put_hex(out, b.merkle_root);
+  put_hex(out, b.hash);
+  put_varint(out, b.nonce);
+  put_varint(out, zigzag(b.difficulty));
+  put_varint(out, b.mine_ms);
+  put_txs(out, b.transactions);
+  return out;
+}
+
+// header_only: stop after the header fields and mark the block pruned
+bool decode_body(std::string_view body, Block* out, std::string* err, bool header_only) {
+  Reader r{body};
+  Block b;
+  b.index = r.varint();
+  b.timestamp = r.str();
+  b.prev_hash = r.hex();
+  b.merkle_root = r.hex();
+  b.hash = r.hex();
+  b.nonce = r.varint();
+  b.difficulty = (int)unzigzag(r.varint());
+  b.mine_ms = r.varint();
+  if (header_only) b.pruned = true;
+  else read_txs(r, &b.transactions);
+  if (!r.ok || (!header_only && r.pos != body.size())) {
+    if (err) *err = "malformed binary block";
+    return false;
+  }
+  *out = std::move(b);
+  return true;
+}
+
+}  // namespace
+
+bool codec_has_compression() {
+#if defined(SBC_HAVE_ZLIB)
+  return true;
+#else
+  return false;
+#endif
+}
+
+std::string encode_block_binary(const Block& b, const CodecOptions& opts) {
+  std::string body = encode_body(b);
+  const std::uint8_t pruned = b.pruned ? kFlagPruned : 0;
+  std::string out;
+  out.push_back((char)kBlockCodecMagic);
+  out.push_back((char)kBlockCodecVersion);
+#if defined(SBC_HAVE_ZLIB)
+  if (opts.compress) {
+    uLongf zlen = compressBound((uLong)body.size());
+    std::string z(zlen, '\0');
+    if (compress2((Bytef*)z.data(), &zlen, (const Bytef*)body.data(), (uLong)body.size(),
+                  Z_DEFAULT_COMPRESSION) == Z_OK &&
+        zlen + 4 < body.size()) {
+      out.push_back((char)(kFlagZlib | pruned));
+      put_varint(out, body.size());
+      out.append(z.data(), zlen);
+      return out;
+    }
+  }
+#else
+  (void)opts;
+#endif
+  out.push_back((char)pruned);
+  out += body;
+  return out;
+}
+
+static bool decode_binary(std::string_view in, Block* out, std::string* err, bool header_only) {
+  if (in.size() < 3 || (std::uint8_t)in[0] != kBlockCodecMagic) {
+    if (err) *err = "not a binary block";
+    return false;
+  }
+  if ((std::uint8_t)in[1] != kBlockCodecVersion) {
+    if (err) *err = "unsupported block codec version " + std::to_string((std::uint8_t)in[1]);
+    return false;
+  }
+  auto flags = (std::uint8_t)in[2];
+  if (flags & ~(kFlagZlib | kFlagPruned)) {
+    if (err) *err = "unknown block codec flags";
+    return false;
+  }
+  std::string_view body = in.substr(3);
+  if (!(flags & kFlagZlib)) {
+    if (!decode_body(body, out, err, header_only)) return false;
+    out->pruned |= (flags & kFlagPruned) != 0;
+    return true;
+  }
+#if defined(SBC_HAVE_ZLIB)
+  Reader r{body};
+  std::uint64_t raw_len = r.varint();
+  if (!r.ok || raw_len > (64ull << 20)) {
+    if (err) *err = "malformed compressed block";
+    return false;
+  }
+  std::string raw(raw_len, '\0');
+  uLongf len = (uLongf)raw_len;
+  if (uncompress((Bytef*)raw.data(), &len, (const Bytef*)body.data() + r.pos,
+                 (uLong)(body.size() - r.pos)) != Z_OK ||
+      len != raw_len) {
+    if (err) *err = "corrupt compressed block";
+    return false;
+  }
+  if (!decode_body(raw, out, err, header_only)) return false;
+  out->pruned |= (flags & kFlagPruned) != 0;
+  return true;
+#else
+  if (err) *err = "compressed block, but built without zlib";
+  return false;
+#endif
+}
+
+bool decode_block_binary(std::string_view in, Block* out, std::string* err) {
+  return decode_binary(in, out, err, /*header_only=*/false);
+}
+
+std::string encode_txs_binary(const std::vector<Tx>& txs) {
+  std::string out;
+  out.reserve(16 + txs.size() * 160);
+  put_txs(out, txs);
+  return out;
+}
+
+bool decode_txs_binary(std::string_view in, std::vector<Tx>* out, std::string* err) {
+  Reader r{in};
+  std::vector<Tx> txs;
+  read_txs(r, &txs);
+  if (!r.ok || r.pos != in.size()) {
+    if (err) *err = "malformed binary tx list";
+    return false;
+  }
+  *out = std::move(txs);
+  return true;
+}
+
+std::string encode_block_record(const Block& b, const CodecOptions& opts) {
+  return encode_block_binary(b, opts);
+}
+
+bool decode_block_record(std::string_view rec, Block* out, std::string* err) {
+  if (!rec.empty() && rec.front() == '{') {  // JSON records written before the binary codec
+    try {
+      *out = Block::from_json(nlohmann::json::parse(rec.begin(), rec.end()));
+      return true;
+    } catch (const std::exception& e) {
+      if (err) *err = e.what();
+      return false;
+    }
+  }
+  return decode_block_binary(rec, out, err);
+}
+
+bool decode_block_header(std::string_view rec, Block* out, std::string* err) {
+  if (!rec.empty() && rec.front() == '{') {
+    Block b;
+    if (!decode_block_record(rec, &b, err)) return false;
+    *out = b.pruned ? std::move(b) : b.header_only();
+    return true;
+  }
+  return decode_binary(rec, out, err, /*header_only=*/true);
+}
+
+bool prune_block_record(std::string_view rec, std::string* out, const CodecOptions& opts) {
+  Block b;
+  if (!decode_block_record(rec, &b, nullptr)) return false;
+  if (b.pruned) {
+    out->assign(rec.data(), rec.size());
+  } else {
+    *out = encode_block_record(b.header_only(), opts);
+  }
+  return true;
+}
+
+}  // namespace sbc
@@ -0,0 +1,84 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "block.hpp"
+
+namespace sbc {
+
+// Compact binary block encoding (format version 1).
+//
+//   u8 magic 0xB7, u8 version, u8 flags            flags bit0: body is zlib-compressed
+//                                                  flags bit1: pruned (header only)
+//   [varint raw body length]                       only when compressed
+//   body:
+//     varint index, str timestamp, hex prev_hash, hex merkle_root, hex hash,
+//     varint nonce, zigzag difficulty, varint mine_ms
+//     varint key count, str key...                 distinct sender PEMs, first use order
+//     varint tx count, per tx:
+//       varint key ref (0 = coinbase, k = key k-1), hex to_addr, varint amount,
+//       varint nonce, hex signature
+//
+// "hex" fields are stored as raw bytes when they are lowercase hex (hashes,
+// addresses, DER signatures), otherwise verbatim; either way they round-trip
+// exactly. Integers are LEB128 varints.
+struct CodecOptions {
+  bool compress = false;  // zlib the body if that makes it smaller
+};
+
+constexpr std::uint8_t kBlockCodecMagic = 0xB7;
+constexpr std::uint8_t kBlockCodecVersion = 1;
+
+std::string encode_block_binary(const Block& b, const CodecOptions& opts = {});
+bool decode_block_binary(std::string_view in, Block* out, std::string* err);
+
+// One block as stored in a storage::BlockLog record: the binary encoding.
+// Decoding also accepts the JSON records written by earlier versions.
+std::string encode_block_record(const Block& b, const CodecOptions& opts = {});
+bool decode_block_record(std::string_view rec, Block* out, std::string* err);
+// Just the header fields of a record, as a header-only block (pruned set);
+// skips decoding the transactions.
+bool decode_block_header(std::string_view rec, Block* out, std::string* err);
+
+// Rewrite a block record as its header-only (pruned) form; a storage
+// BlockLog::RecordRewriter for compacting a pruned node's log.
+bool prune_block_record(std::string_view rec, std::string* out, const CodecOptions& opts = {});
+
+// A transaction list in the same layout as a block body's tx section (one
+// copy of each sender key), e.g. for txs sent on their own between peers.
+std::string encode_txs_binary(const std::vector<Tx>& txs);
+bool decode_txs_binary(std::string_view in, std::vector<Tx>* out, std::string* err);
+
+// Field primitives of the encoding, shared with the peer wire format.
+namespace codec {
+
+void put_varint(std::string& out, std::uint64_t v);  // LEB128
+void put_str(std::string& out, std::string_view s);  // varint length, bytes
+void put_hex(std::string& out, std::string_view s);  // raw bytes when lowercase hex
+
+// Bounds-checked cursor over encoded bytes; any overrun sets ok = false.
+struct Reader {
+  std::string_view in;
+  std::size_t pos = 0;
+  bool ok = true;
+
+  std::uint64_t varint();
+  std::string_view bytes(std::uint64_t n);  // a view into in, no copy
+  std::string str() { return std::string(bytes(varint())); }
+  std::string hex();
+};
+
+}  // namespace codec
+
+// True when zlib support was compiled in (otherwise compress is ignored and
+// compressed input is rejected).
+bool codec_has_compression();
+
+}  // namespace sbc
@@ -0,0 +1,275 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sbc {
+
+// Persistent string-keyed hash map: a 16-way trie on the key hash whose
+// leaves hold a few entries each. Copying a CowMap shares every node, so it
+// costs O(1); a write then copies only the nodes on the path to its key
+// (O(log n)) that another copy may still be reading. This keeps publishing
+// an account table per commit independent of the number of accounts.
+//
+// Each map carries an owner token and mutates in place only nodes stamped
+// with it. Copying hands both sides fresh tokens, so neither touches a node
+// the other can see. Readers of a copy never see later writes.
+template <class V>
+class CowMap {
+  struct Node;
+
+ public:
+  using key_type = std::string;
+  using mapped_type = V;
+  using value_type = std::pair<std::string, V>;
+
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = CowMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    const_iterator() = default;
+    reference operator*() const { return path_.back().first->items[path_.back().second]; }
+    pointer operator->() const { return &**this; }
+    const_iterator& operator++() {
+      ++path_.back().second;
+      settle();
+      return *this;
+    }
+    const_iterator operator++(int) { auto t = *this; ++*this; return t; }
+    bool operator==(const const_iterator& o) const {
+      return path_.empty() ? o.path_.empty() : !o.path_.empty() && path_.back() == o.path_.back();
+    }
+    bool operator!=(const const_iterator& o) const { return !(*this == o); }
+
+   private:
+    friend class CowMap;
+    // descend from the current position to the next entry, if any
+    void settle() {
+      while (!path_.empty()) {
+        auto& [n, i] = path_.back();
+        if (n->leaf ? i < n->items.size() : false) return;
+        if (!n->leaf && i < kFanout) {
+          if (const Node* kid = n->kids[i].get()) path_.emplace_back(kid, 0);
+          else ++i;
+          continue;
+        }
+        path_.pop_back();
+        if (!path_.empty()) ++path_.back().second;
+      }
+    }
+    std::vector<std::pair<const Node*, std::size_t>> path_;  // (node, child or item index)
+  };
+
+  CowMap() : owner_(next_token()) {}
+  CowMap(std::initializer_list<value_type> init) : CowMap() {
+    for (const auto& kv : init) (*this)[kv.first] = kv.second;
+  }
+  CowMap(const CowMap& o) : root_(o.root_), size_(o.size_), owner_(next_token()) { o.disown(); }
+  CowMap(CowMap&& o) noexcept : root_(std::move(o.root_)), size_(o.size_), owner_(next_token()) {
+    o.size_ = 0;
+  }
+  CowMap& operator=(const CowMap& o) {
+    if (this != &o) {
+      root_ = o.root_;
+      size_ = o.size_;
+      disown();
+      o.disown();
+    }
+    return *this;
+  }
+  CowMap& operator=(CowMap&& o) noexcept {
+    if (this != &o) {
+      root_ = std::move(o.root_);
+      size_ = o.size_;
+      o.size_ = 0;
+      disown();
+    }
+    return *this;
+  }
+
+  // Builds a map from entries with distinct keys in O(n log n): one sort by
+  // trie path, then each node is made once, instead of a root-to-leaf walk
+  // (and leaf splits) per key as with operator[].
+  static CowMap build(std::vector<value_type> items) {
+    std::vector<std::pair<std::size_t, value_type>> byPath;
+    byPath.reserve(items.size());
+    for (auto& kv : items) {
+      const std::size_t h = hash(kv.first);
+      std::size_t path = 0;
+      for (unsigned d = 0; d < kLevels; ++d) path = (path << 4) | child(h, d);
+      byPath.emplace_back(path, std::move(kv));
+    }
+    std::sort(byPath.begin(), byPath.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    CowMap m;
+    m.size_ = byPath.size();
+    if (!byPath.empty()) m.root_ = m.buildNode(byPath, 0, byPath.size(), 0);
+    return m;
+  }
+
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  void clear() {
+    root_.reset();
+    size_ = 0;
+  }
+
+  const_iterator begin() const {
+    const_iterator it;
+    if (root_) {
+      it.path_.emplace_back(root_.get(), 0);
+      it.settle();
+    }
+    return it;
+  }
+  const_iterator end() const { return {}; }
+
+  const_iterator find(const std::string& key) const {
+    const std::size_t h = hash(key);
+    const_iterator it;
+    const Node* n = root_.get();
+    for (unsigned depth = 0; n; ++depth) {
+      if (n->leaf) {
+        for (std::size_t i = 0; i < n->items.size(); ++i) {
+          if (n->items[i].first == key) {
+            it.path_.emplace_back(n, i);
+            return it;
+          }
+        }
+        break;
+      }
+      std::size_t slot = child(h, depth);
+      it.path_.emplace_back(n, slot);
+      n = n->kids[slot].get();
+    }
+    return {};
+  }
+  std::size_t count(const std::string& key) const { return find(key) != end() ? 1 : 0; }
+  const V& at(const std::string& key) const {
+    auto it = find(key);
+    if (it == end()) throw std::out_of_range("CowMap::at");
+    return it->second;
+  }
+
+  // Inserts a default value if key is absent. Copies shared nodes on the way.
+  V& operator[](const std::string& key) {
+    const std::size_t h = hash(key);
+    std::shared_ptr<Node>* slot = &root_;
+    unsigned depth = 0;
+    for (;;) {
+      if (!*slot) {
+        *slot = std::make_shared<Node>();
+        (*slot)->leaf = true;
+        (*slot)->owner = owner_;
+      } else if ((*slot)->owner != owner_) {
+        *slot = std::make_shared<Node>(**slot);  // shallow: children stay shared
+        (*slot)->owner = owner_;
+      }
+      Node& n = **slot;
+      if (!n.leaf) {
+        slot = &n.kids[child(h, depth++)];
+        continue;
+      }
+      for (auto& kv : n.items) {
+        if (kv.first == key) return kv.second;
+      }
+      if (n.items.size() < kLeafMax || depth + 1 >= kLevels) {
+        n.items.emplace_back(key, V{});
+        ++size_;
+        return n.items.back().second;
+      }
+      // full leaf: turn it into a branch and retry one level down
+      std::vector<value_type> items = std::move(n.items);
+      n.items.clear();
+      n.leaf = false;
+      for (auto& kv : items) {
+        auto& kid = n.kids[child(hash(kv.first), depth)];
+        if (!kid) {
+          kid = std::make_shared<Node>();
+          kid->leaf = true;
+          kid->owner = owner_;
+        }
+        kid->items.push_back(std::move(kv));
+      }
+    }
+  }
+
+  bool operator==(const CowMap& o) const {
+    if (size_ != o.size_) return false;
+    if (root_ == o.root_) return true;
+    for (const auto& kv : *this) {
+      auto it = o.find(kv.first);
+      if (it == o.end() || !(it->second == kv.second)) return false;
+    }
+    return true;
+  }
+  bool operator!=(const CowMap& o) const { return !(*this == o); }
+
+ private:
+  static constexpr std::size_t kFanout = 16;
+  static constexpr std::size_t kLeafMax = 8;
+  static constexpr unsigned kLevels = sizeof(std::size_t) * 8 / 4;  // 4 hash bits per level
+
+  struct Node {
+    std::uint64_t owner = 0;  // token of the map allowed to mutate it in place
+    bool leaf = false;
+    std::array<std::shared_ptr<Node>, kFanout> kids;  // branch
+    std::vector<value_type> items;                    // leaf
+  };
+
+  static std::size_t hash(const std::string& key) { return std::hash<std::string>{}(key); }
+  static std::size_t child(std::size_t h, unsigned depth) { return (h >> (4 * depth)) & (kFanout - 1); }
+  static std::uint64_t next_token() {
+    static std::atomic<std::uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+  void disown() const { owner_.store(next_token(), std::memory_order_relaxed); }
+
+  // items[lo, hi) share their first `depth` path nibbles; the path is the
+  // hash with child(h, 0) as its top nibble, so each child is a subrange.
+  std::shared_ptr<Node> buildNode(std::vector<std::pair<std::size_t, value_type>>& items, std::size_t lo,
+                                  std::size_t hi, unsigned depth) const {
+    auto n = std::make_shared<Node>();
+    n->owner = owner_;
+    if (hi - lo <= kLeafMax || depth + 1 >= kLevels) {
+      n->leaf = true;
+      n->items.reserve(hi - lo);
+      for (std::size_t i = lo; i < hi; ++i) n->items.push_back(std::move(items[i].second));
+      return n;
+    }
+    const unsigned shift = 4 * (kLevels - 1 - depth);
+    for (std::size_t i = lo; i < hi;) {
+      const std::size_t slot = (items[i].first >> shift) & (kFanout - 1);
+      std::size_t j = i;
+      while (j < hi && ((items[j].first >> shift) & (kFanout - 1)) == slot) ++j;
+      n->kids[slot] = buildNode(items, i, j, depth + 1);
+      i = j;
+    }
+    return n;
+  }
+
+  std::shared_ptr<Node> root_;
+  std::size_t size_ = 0;
+  // mutable: copying from a const map must stop it writing shared nodes
+  mutable std::atomic<std::uint64_t> owner_;
+};
+
+}  // namespace sbc
@@ -0,0 +1,133 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "dispatch.hpp"
+
+#include <algorithm>
+
+namespace sbc {
+
+MessageDispatcher::MessageDispatcher(Handler handle, DispatcherOptions opts) : handle_(std::move(handle)) {
+  lanes_[static_cast<std::size_t>(Lane::Block)].opts = opts.block;
+  lanes_[static_cast<std::size_t>(Lane::Request)].opts = opts.request;
+  lanes_[static_cast<std::size_t>(Lane::Tx)].opts = opts.tx;
+  for (auto& l : lanes_) l.opts.capacity = std::max<std::size_t>(l.opts.capacity, 1);
+  std::size_t n = std::max<std::size_t>(opts.workers, 1);
+  for (std::size_t i = 0; i < n; ++i) workers_.emplace_back([this] { run(); });
+}
+
+MessageDispatcher::~MessageDispatcher() { stop(); }
+
+Lane MessageDispatcher::classify(MsgType type) {
+  switch (type) {
+    case MsgType::CmpctBlock:
+    case MsgType::NewBlock:
+    case MsgType::BlockTxn:
+    case MsgType::Tip:
+    case MsgType::Headers:
+    case MsgType::Blocks:
+      return Lane::Block;
+    case MsgType::Inv:
+    case MsgType::Tx:
+      return Lane::Tx;
+    default:
+      return Lane::Request;
+  }
+}
+
+bool MessageDispatcher::post(std::string frame) {
+  MsgType type;
+  bool ok = peek_wire_header(frame, &type);
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!ok) {
+      ++malformed_;
+      return false;
+    }
+    if (stopping_) return false;
+    LaneState& l = lanes_[static_cast<std::size_t>(classify(type))];
+    if (l.q.size() >= l.opts.capacity) {
+      ++l.stats.dropped;
+      if (l.opts.policy == DropPolicy::DropNewest) return false;
+      l.q.pop_front();
+    }
+    l.q.push_back(std::move(frame));
+    ++l.stats.enqueued;
+    l.stats.max_depth = std::max(l.stats.max_depth, l.q.size());
+  }
+  work_cv_.notify_one();
+  return true;
+}
+
+void MessageDispatcher::run() {
+  std::unique_lock<std::mutex> lk(mu_);
+  for (;;) {
+    LaneState* pick = nullptr;
+    work_cv_.wait(lk, [&] {
+      if (stopping_) return true;
+      for (auto& l : lanes_) {
+        if (!l.q.empty() && !(l.opts.serial && l.running)) {
+          pick = &l;
+          return true;
+        }
+      }
+      return false;
+    });
+    if (stopping_) return;
+    std::string frame = std::move(pick->q.front());
+    pick->q.pop_front();
+    ++pick->running;
+    lk.unlock();
+    bool bad = false;
+    try {
+      WireReader msg(frame);  // checksum verified here, off the network thread
+      handle_(msg);
+    } catch (const std::runtime_error&) {
+      bad = true;
+    } catch (...) {
+      // handlers drop bad messages themselves; never let one kill a worker
+    }
+    lk.lock();
+    if (bad) ++malformed_;
+    --pick->running;
+    ++pick->stats.processed;
+    // a serial lane may have more work that no other worker could take
+    if (pick->opts.serial && !pick->q.empty()) work_cv_.notify_one();
+    idle_cv_.notify_all();
+  }
+}
+
+bool MessageDispatcher::drain(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lk(mu_);
+  return idle_cv_.wait_for(lk, timeout, [&] {
+    return std::all_of(lanes_.begin(), lanes_.end(), [](const LaneState& l) { return l.q.empty() && !l.running; });
+  });
+}
+
+void MessageDispatcher::stop() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (stopping_ && workers_.empty()) return;
+    stopping_ = true;
+    for (auto& l : lanes_) l.q.clear();
+  }
+  work_cv_.notify_all();
+  for (auto& t : workers_) t.join();
+  workers_.clear();
+  idle_cv_.notify_all();
+}
+
+DispatchStats MessageDispatcher::stats() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  DispatchStats s;
+  for (std::size_t i = 0; i < lanes_.size(); ++i) {
+    s.lanes[i] = lanes_[i].stats;
+    s.lanes[i].depth = lanes_[i].q.size();
+  }
+  s.malformed = malformed_;
+  return s;
+}
+
+}  // namespace sbc
@@ -0,0 +1,118 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "wire.hpp"
+
+namespace sbc {
+
+// Inbound peer messages are queued in one lane per class, served in this
+// priority order.
+enum class Lane : std::size_t {
+  Block,    // CMPCTBLOCK, NEWBLOCK, BLOCKTXN, TIP, HEADERS, BLOCKS
+  Request,  // GET* requests from peers
+  Tx,       // INV, TX
+  Count
+};
+
+enum class DropPolicy {
+  DropNewest,  // a full lane rejects the incoming message
+  DropOldest,  // a full lane evicts its oldest message to make room
+};
+
+struct LaneOptions {
+  std::size_t capacity;
+  DropPolicy policy;
+  bool serial;  // at most one worker runs this lane at a time (keeps arrival order)
+};
+
+struct DispatcherOptions {
+  std::size_t workers = 2;
+  // Blocks apply one at a time under the node's writer lock anyway, so a
+  // serial lane loses nothing and keeps compact blocks ahead of their
+  // BLOCKTXN. Newer block traffic is worth more than stale, and sync
+  // re-requests what it misses.
+  LaneOptions block{256, DropPolicy::DropOldest, true};
+  // Requests are cheap to resend, so excess ones are refused.
+  LaneOptions request{512, DropPolicy::DropNewest, false};
+  // Signature checks run in parallel here; a dropped tx is requested again
+  // from another peer that announced it once TxGossip's request times out.
+  LaneOptions tx{4096, DropPolicy::DropNewest, false};
+};
+
+struct LaneStats {
+  std::size_t depth{};      // queued now
+  std::size_t max_depth{};  // high-water mark
+  std::uint64_t enqueued{};
+  std::uint64_t processed{};
+  std::uint64_t dropped{};  // by the lane's drop policy
+};
+
+struct DispatchStats {
+  std::array<LaneStats, static_cast<std::size_t>(Lane::Count)> lanes{};
+  std::uint64_t malformed{};  // bad header (on arrival) or checksum/payload (in a worker)
+  const LaneStats& operator[](Lane l) const { return lanes[static_cast<std::size_t>(l)]; }
+};
+
+// Bounded work queue between the network thread and message handlers. The
+// listener thread only checks a frame's wire header and queues the frame
+// (post() never blocks); a pool of workers verifies the checksum and runs
+// handle(msg) on a reader over the queued frame, so decoding, signature
+// checks, hashing and block commits never stall socket handling. When a lane
+// is full its drop policy applies and the message is counted as dropped.
+class MessageDispatcher {
+ public:
+  using Handler = std::function<void(WireReader& msg)>;
+
+  explicit MessageDispatcher(Handler handle, DispatcherOptions opts = {});
+  ~MessageDispatcher();
+  MessageDispatcher(const MessageDispatcher&) = delete;
+  MessageDispatcher& operator=(const MessageDispatcher&) = delete;
+
+  // Queue a received frame; false if its header is bad, or it was dropped,
+  // or the dispatcher is stopped.
+  bool post(std::string frame);
+
+  // Wait until every lane is empty and no handler is running (or timeout).
+  bool drain(std::chrono::milliseconds timeout);
+  // Finish running handlers and join the workers; queued messages are discarded.
+  void stop();
+
+  DispatchStats stats() const;
+
+  static Lane classify(MsgType type);
+
+ private:
+  struct LaneState {
+    LaneOptions opts;
+    std::deque<std::string> q;
+    std::size_t running = 0;
+    LaneStats stats;
+  };
+  void run();
+
+  Handler handle_;
+  mutable std::mutex mu_;
+  std::condition_variable work_cv_;  // message queued, or stopping
+  std::condition_variable idle_cv_;  // a handler finished
+  std::array<LaneState, static_cast<std::size_t>(Lane::Count)> lanes_;
+  std::uint64_t malformed_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace sbc
@@ -0,0 +1,268 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "gossip.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "state.hpp"
+
+namespace sbc {
+
+TxGossip::TxGossip(Node& node, SendFn send, const std::vector<std::string>& peers)
+    : node_(node), send_(std::move(send)) {
+  for (const auto& p : peers) peers_[p];
+  th_ = std::thread([this] { run(); });
+}
+
+TxGossip::~TxGossip() { stop(); }
+
+void TxGossip::stop() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (th_.joinable()) th_.join();
+}
+
+void TxGossip::setSelfAddress(std::string addr) {
+  std::lock_guard<std::mutex> lk(mu_);
+  self_ = std::move(addr);
+}
+
+void TxGossip::addPeer(const std::string& peer) {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (!peer.empty() && peer != self_) peers_[peer];
+}
+
+GossipStats TxGossip::stats() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return stats_;
+}
+
+TxGossip::Peer* TxGossip::peerLocked(const std::string& peer) {
+  auto it = peers_.find(peer);
+  return it == peers_.end() ? nullptr : &it->second;
+}
+
+void TxGossip::rememberLocked(const std::string& id, const Tx& tx) {
+  if (!recent_.emplace(id, tx).second) return;
+  recent_order_.push_back(id);
+  while (recent_order_.size() > kMaxRecent) {
+    recent_.erase(recent_order_.front());
+    recent_order_.pop_front();
+  }
+}
+
+void TxGossip::announceLocked(const std::string& id, const std::string& except,
+                              std::map<std::string, std::vector<std::string>>* inv) {
+  for (auto& [addr, p] : peers_) {
+    if (addr == except || p.known.testAndInsert(id)) continue;
+    (*inv)[addr].push_back(id);
+    ++stats_.announced;
+  }
+}
+
+TxGossip::Outbox TxGossip::idMessagesLocked(MsgType type,
+                                            std::map<std::string, std::vector<std::string>>& by_peer) const {
+  Outbox out;
+  for (auto& [addr, ids] : by_peer) {
+    for (std::size_t i = 0; i < ids.size(); i += kMaxInvIds) {
+      std::size_t end = std::min(ids.size(), i + kMaxInvIds);
+      WireWriter w(type, self_);
+      w.u64(end - i);
+      for (std::size_t k = i; k < end; ++k) w.hex(ids[k]);
+      out.emplace_back(addr, w.finish());
+    }
+  }
+  return out;
+}
+
+void TxGossip::send(const Outbox& out) {
+  for (const auto& [peer, msg] : out) send_(peer, msg);
+}
+
+void TxGossip::submit(Tx tx) {
+  if (tx.from_pubkey_pem.empty()) throw std::invalid_argument("Use coinbase via miner address");
+  std::string id = tx.hash();
+  Outbox out;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    ++stats_.local;
+    // The filter can false-positive, so it only decides whether to announce;
+    // the node always gets the user's own tx.
+    if (!seen_.testAndInsert(id)) {
+      rememberLocked(id, tx);
+      std::map<std::string, std::vector<std::string>> inv;
+      announceLocked(id, "", &inv);
+      out = idMessagesLocked(MsgType::Inv, inv);
+    }
+  }
+  node_.submitTx(std::move(tx));
+  send(out);
+}
+
+bool TxGossip::handle(WireReader& msg) {
+  try {
+    switch (msg.type()) {
+      case MsgType::Inv: onInv(msg); break;
+      case MsgType::GetTx: onGetTx(msg); break;
+      case MsgType::Tx: onTx(msg); break;
+      default: return false;
+    }
+  } catch (const std::exception&) {
+    // malformed peer message: drop it
+  }
+  return true;
+}
+
+void TxGossip::onInv(WireReader& msg) {
+  const std::string& from = msg.from();
+  if (from.empty()) return;  // nobody to ask
+  std::vector<std::string> ids(msg.count(kMaxInvIds));
+  for (auto& id : ids) id = msg.hex();
+  auto now = std::chrono::steady_clock::now();
+  std::vector<std::string> want;
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    Peer* p = peerLocked(from);
+    if (!p) return;
+    for (auto& id : ids) {
+      p->known.insert(id);
+      if (seen_.contains(id)) continue;
+      auto r = requested_.find(id);
+      if (r != requested_.end()) {
+        // asked someone else: keep this announcer in case that goes unanswered
+        Request& req = r->second;
+        if (req.peer != from && req.next.size() < kMaxAnnouncers &&
+            std::find(req.next.begin(), req.next.end(), from) == req.next.end()) {
+          req.next.push_back(from);
+        }
+        continue;
+      }
+      requested_[id] = Request{from, now, {}};
+      want.push_back(std::move(id));
+    }
+    stats_.requested += want.size();
+    self = self_;
+  }
+  if (!want.empty()) {
+    WireWriter w(MsgType::GetTx, self);
+    w.u64(want.size());
+    for (const auto& id : want) w.hex(id);
+    send_(from, w.finish());
+  }
+}
+
+void TxGossip::run() {
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!stopping_) {
+    cv_.wait_for(lk, kRequestTimeout / 4);
+    auto now = std::chrono::steady_clock::now();
+    std::map<std::string, std::vector<std::string>> ask;
+    for (auto it = requested_.begin(); it != requested_.end();) {
+      Request& req = it->second;
+      if (now - req.sent <= kRequestTimeout) {
+        ++it;
+      } else if (req.next.empty()) {
+        it = requested_.erase(it);
+      } else {
+        req.peer = std::move(req.next.front());
+        req.next.pop_front();
+        req.sent = now;
+        ask[req.peer].push_back(it->first);
+        ++stats_.requested;
+        ++stats_.refetched;
+        ++it;
+      }
+    }
+    if (ask.empty() || stopping_) continue;
+    Outbox out = idMessagesLocked(MsgType::GetTx, ask);
+    lk.unlock();
+    send(out);
+    lk.lock();
+  }
+}
+
+void TxGossip::onGetTx(WireReader& msg) {
+  const std::string& from = msg.from();
+  std::vector<std::string> ids(msg.count(kMaxInvIds));
+  for (auto& id : ids) id = msg.hex();
+  std::vector<Tx> txs;
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    Peer* p = peerLocked(from);
+    if (!p) return;  // bodies go to our peers only, not to any claimed sender
+    for (const auto& id : ids) {
+      auto it = recent_.find(id);
+      if (it == recent_.end()) continue;  // mined or evicted meanwhile
+      txs.push_back(it->second);
+      p->known.insert(id);
+    }
+    stats_.served += txs.size();
+    self = self_;
+  }
+  if (txs.empty()) return;
+  send_(from, WireWriter(MsgType::Tx, self).txs(txs).finish());
+}
+
+void TxGossip::onTx(WireReader& msg) {
+  const std::string& from = msg.from();
+  std::vector<Tx> txs = msg.txs();
+  std::vector<std::pair<std::string, Tx>> fresh;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    Peer* p = peerLocked(from);
+    for (auto& tx : txs) {
+      std::string id = tx.hash();
+      ++stats_.received;
+      requested_.erase(id);
+      if (p) p->known.insert(id);
+      if (seen_.contains(id)) {
+        ++stats_.duplicates;
+        continue;
+      }
+      fresh.emplace_back(std::move(id), std::move(tx));
+    }
+  }
+
+  // signature checks are the expensive part; run them unlocked
+  std::vector<bool> ok(fresh.size());
+  for (std::size_t i = 0; i < fresh.size(); ++i) {
+    const Tx& tx = fresh[i].second;
+    ok[i] = !tx.from_pubkey_pem.empty() && StateMachine::verifySignature(tx);
+  }
+
+  Outbox out;
+  std::vector<Tx> admit;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::map<std::string, std::vector<std::string>> inv;
+    for (std::size_t i = 0; i < fresh.size(); ++i) {
+      auto& [id, tx] = fresh[i];
+      if (seen_.testAndInsert(id)) {  // another peer delivered it meanwhile
+        ++stats_.duplicates;
+        continue;
+      }
+      if (!ok[i]) {
+        ++stats_.invalid;
+        continue;
+      }
+      ++stats_.admitted;
+      rememberLocked(id, tx);
+      announceLocked(id, from, &inv);
+      admit.push_back(std::move(tx));
+    }
+    out = idMessagesLocked(MsgType::Inv, inv);
+  }
+  for (auto& tx : admit) node_.submitTx(std::move(tx));
+  send(out);
+}
+
+}  // namespace sbc
@@ -0,0 +1,123 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bloom.hpp"
+#include "node.hpp"
+#include "wire.hpp"
+
+namespace sbc {
+
+struct GossipStats {
+  std::uint64_t local{};       // submitted on this node
+  std::uint64_t announced{};   // tx ids sent in INVs, summed over peers
+  std::uint64_t requested{};   // tx ids asked for with GETTX
+  std::uint64_t refetched{};   // of those, re-asked from another announcer after a timeout
+  std::uint64_t received{};    // tx bodies received
+  std::uint64_t admitted{};    // new, correctly signed txs handed to the node
+  std::uint64_t duplicates{};  // bodies for txs already seen
+  std::uint64_t invalid{};     // bad signature or coinbase
+  std::uint64_t served{};      // bodies sent in reply to GETTX
+};
+
+// Transaction gossip by inventory:
+//
+//   INV   {txids}  -> GETTX {txids}  (only ids never seen here)
+//   GETTX {txids}  -> TX    {txs}
+//
+// A tx is fetched from the first peer that announces it. Later announcers
+// (up to kMaxAnnouncers) are remembered, and a background thread asks the
+// next one whenever a request goes unanswered for kRequestTimeout; once none
+// are left the id is forgotten, so the next INV naming it asks again. Each
+// admitted tx is announced once to every peer not already known to have it
+// (it announced or sent us the tx, or we announced it to them), tracked with
+// a rolling Bloom filter per peer. A node-wide rolling filter of seen tx ids
+// makes re-announcements no-ops, so a tx crosses each link at most once.
+// Thread-safe; send is never called with the gossip lock held.
+class TxGossip {
+ public:
+  using SendFn = std::function<void(const std::string& peer, const std::string& msg)>;
+
+  TxGossip(Node& node, SendFn send, const std::vector<std::string>& peers = {});
+  ~TxGossip();
+  TxGossip(const TxGossip&) = delete;
+  TxGossip& operator=(const TxGossip&) = delete;
+
+  // Stop re-requesting timed-out txs (also done by the destructor).
+  void stop();
+
+  void setSelfAddress(std::string addr);  // "host:port" peers reply to
+  // Peers we announce to and answer. INV and GETTX from any other sender are
+  // ignored; txs they push are still checked and admitted.
+  void addPeer(const std::string& peer);
+
+  // Submit a locally created tx to the node and announce it; a tx already
+  // seen is ignored. Throws std::invalid_argument for a coinbase.
+  void submit(Tx tx);
+
+  // Handle a peer message; false if its type is not a gossip message.
+  bool handle(WireReader& msg);
+
+  GossipStats stats() const;
+
+  static constexpr std::size_t kMaxInvIds = 1000;   // per INV / GETTX
+  static constexpr std::size_t kMaxRecent = 8192;   // bodies kept to serve GETTX
+  static constexpr std::chrono::milliseconds kRequestTimeout{2000};
+  static constexpr std::size_t kMaxAnnouncers = 8;  // remembered per requested tx
+
+ private:
+  struct Peer {
+    RollingBloom known{5000, 0.00001};
+  };
+  struct Request {
+    std::string peer;  // asked
+    std::chrono::steady_clock::time_point sent;
+    std::deque<std::string> next;  // other announcers, asked in turn on timeout
+  };
+  using Outbox = std::vector<std::pair<std::string, std::string>>;  // (peer, msg)
+
+  void onInv(WireReader& msg);
+  void onGetTx(WireReader& msg);
+  void onTx(WireReader& msg);
+  void send(const Outbox& out);  // without mu_ held
+  void run();  // re-requests timed-out txs
+
+  // *Locked helpers run with mu_ held.
+  Peer* peerLocked(const std::string& peer);  // nullptr unless added
+  void rememberLocked(const std::string& id, const Tx& tx);
+  // Add id to the INV batches of every peer but `except` that lacks it.
+  void announceLocked(const std::string& id, const std::string& except,
+                      std::map<std::string, std::vector<std::string>>* inv);
+  // INV or GETTX messages carrying each peer's ids, kMaxInvIds per message.
+  Outbox idMessagesLocked(MsgType type, std::map<std::string, std::vector<std::string>>& ids) const;
+
+  Node& node_;
+  SendFn send_;
+  mutable std::mutex mu_;
+  std::condition_variable cv_;  // stopping
+  bool stopping_ = false;
+  std::thread th_;
+  std::string self_;
+  std::map<std::string, Peer> peers_;
+  RollingBloom seen_;                                        // admitted or rejected tx ids
+  std::unordered_map<std::string, Request> requested_;       // by tx id, until its body arrives
+  std::unordered_map<std::string, Tx> recent_;                // by tx id
+  std::deque<std::string> recent_order_;                      // oldest first, for eviction
+  GossipStats stats_;
+};
+
+}  // namespace sbc
@@ -3,8 +3,11 @@ SPDX-License-Identifier: MIT
 Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 */
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -12,11 +15,57 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 
 #include "blockchain.hpp"
 #include "crypto.hpp"
+#include "dispatch.hpp"
+#include "gossip.hpp"
+#include "node.hpp"
 #include "p2p.hpp"
+#include "relay.hpp"
+#include "sync.hpp"
+#include "statefile.hpp"
 #include "storage.hpp"
 
 using namespace sbc;
 
+static void print_reindex_progress(const ReindexProgress& p) {
+  std::cout << "\rReplaying chain: block " << p.height << "/" << p.tip << ", " << p.txs << " txs, "
+            << (std::uint64_t)p.txs_per_sec << " tx/s";
+  if (p.sigs_skipped) std::cout << " (" << p.sigs_skipped << " sigs assumed valid)";
+  std::cout << std::flush;
+  if (p.height == p.tip) std::cout << "\n";
+}
+
+// Load a chain file. State comes from the "<path>.state" snapshot saved next
+// to it when that matches the chain, otherwise from a full replay. Returns
+// false (with err) on failure.
+static bool load_chain(const std::string& path, const std::string& assume_valid, Node& node,
+                       std::string* err) {
+  storage::MappedFile file;  // parse straight from the mapping, no file-sized copy
+  if (!file.open(path, err)) return false;
+  file.adviseSequential();
+  std::string_view s = file.data();
+  LoadOptions opts;
+  opts.progress = print_reindex_progress;
+  opts.assume_valid = assume_valid;
+  StateSnapshot snap;
+  std::string snap_err;
+  if (load_state_snapshot(path + ".state", &snap, &snap_err)) {
+    opts.state_snapshot = std::make_shared<const StateSnapshot>(std::move(snap));
+  }
+  try {
+    try {
+      node.replace(Blockchain::fromJson(s, opts));
+    } catch (const std::exception&) {
+      if (!opts.state_snapshot) throw;
+      opts.state_snapshot.reset();  // stale snapshot: fall back to replay
+      node.replace(Blockchain::fromJson(s, opts));
+    }
+  } catch (const std::exception& e) {
+    *err = e.what();
+    return false;
+  }
+  return true;
+}
+
 static void print_menu() {
   std::cout << "\nSimpleBlockchain Advanced CLI\n"
             << "1) Generate keypair\n"
@@ -28,6 +77,10 @@ static void print_menu() {
             << "7) Save chain to JSON\n"
             << "8) Load chain from JSON\n"
             << "9) Set target block time (sec)\n"
+            << "10) Show balance of address\n"
+            << "11) Show tx index stats\n"
+            << "12) Deep verify chain (re-check every block)\n"
+            << "13) Show network queue stats\n"
             << "0) Exit\n> ";
 }
 
@@ -36,19 +89,133 @@ int main(int argc, char** argv) {
   params.initial_difficulty = 2;
   params.target_block_time_sec = 6;
   params.retarget_interval = 5;
-  Blockchain bc(params);
 
   // P2P setup
   std::string listen = "127.0.0.1:0";
   std::vector<std::string> peers;
-  std::string persist_path;
+  std::string data_dir;
+  long sync_ms = 0;  // durability window for the block log
+  CodecOptions codec;  // block log record encoding
+  std::uint64_t snapshot_every = 0;  // pruned mode: blocks between state snapshots
 
   // Parse simple args
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
     if (arg == "--listen" && i + 1 < argc) listen = argv[++i];
     else if (arg == "--peer" && i + 1 < argc) peers.push_back(argv[++i]);
-    else if (arg == "--db" && i + 1 < argc) persist_path = argv[++i];
+    else if (arg == "--db" && i + 1 < argc) data_dir = argv[++i];
+    else if (arg == "--sync-ms" && i + 1 < argc) sync_ms = std::stol(argv[++i]);
+    else if (arg == "--compress") codec.compress = true;
+    else if (arg == "--prune" && i + 1 < argc) params.prune_keep = std::stoul(argv[++i]);
+    else if (arg == "--snapshot-every" && i + 1 < argc) snapshot_every = std::stoull(argv[++i]);
+    else if (arg == "--txindex") params.tx_index = true;
+    else if (arg == "--assume-valid" && i + 1 < argc) params.assume_valid = argv[++i];
+  }
+
+  if (params.prune_keep && params.tx_index) {
+    std::cerr << "--prune and --txindex cannot be combined\n";
+    return 1;
+  }
+  if (params.prune_keep && !snapshot_every) snapshot_every = std::max<std::uint64_t>(1, params.prune_keep / 2);
+  const std::string snap_path = data_dir + "/state.snapshot";
+  const std::string validated_path = data_dir + "/validated";
+
+  Node node{Blockchain(params)};
+
+  // Block log: replay it on start, then append each committed block (O(block))
+  storage::BlockLog log;
+  if (!data_dir.empty()) {
+    std::string err;
+    if (!log.open(data_dir, &err)) {
+      std::cerr << "Failed to open " << data_dir << ": " << err << "\n";
+      return 1;
+    }
+    try {
+      if (log.size() > 0) {
+        LoadOptions opts;
+        opts.progress = print_reindex_progress;
+        // Start from the latest state snapshot: only blocks after it are
+        // replayed (a pruned node has no other way to rebuild state).
+        StateSnapshot snap;
+        if (load_state_snapshot(snap_path, &snap, &err)) {
+          std::cout << "Using state snapshot at block #" << snap.height << "\n";
+          opts.state_snapshot = std::make_shared<const StateSnapshot>(std::move(snap));
+        }
+        ValidatedCheckpoint cp;
+        if (load_validated_checkpoint(validated_path, &cp.height, &cp.hash, &err)) opts.validated = cp;
+        try {
+          node.replace(Blockchain::fromBlockLog(log, params, opts));
+        } catch (const std::exception& e) {
+          if (!opts.state_snapshot || params.prune_keep) throw;
+          std::cout << "State snapshot not usable (" << e.what() << "), replaying from genesis\n";
+          opts.state_snapshot.reset();
+          node.replace(Blockchain::fromBlockLog(log, params, opts));
+        }
+      } else {
+        node.withChain([&](const Blockchain& bc) {
+          for (const auto& b : bc.chain()) log.append(encode_block_record(b, codec), &err);
+        });
+      }
+    } catch (const std::exception& e) {
+      std::cerr << "Failed to load " << data_dir << ": " << e.what() << "\n";
+      return 1;
+    }
+  }
+  // Committed blocks are handed to a background group-commit writer, so
+  // mining and peer acceptance never wait on the disk.
+  std::unique_ptr<storage::AsyncLogWriter> log_writer;
+  if (log.isOpen()) {
+    log_writer = std::make_unique<storage::AsyncLogWriter>(
+        &log, std::chrono::milliseconds(sync_ms), [](const std::string& err, bool fatal) {
+          std::cerr << "[db] write failed: " << err
+                    << (fatal ? " (no further blocks will be saved)" : "") << "\n";
+        });
+    node.setCommitHook([w = log_writer.get(), codec, &node, &params, snapshot_every, snap_path](const Block& b) {
+      if (!w->enqueue(encode_block_record(b, codec))) return;
+      if (!snapshot_every || b.index % snapshot_every != 0) return;
+      // Once this block is durable, snapshot the state as of it; in pruned
+      // mode then strip bodies the snapshot covers from sealed log segments.
+      StateSnapshot snap = node.snapshot()->stateAtTip();  // published just before the hook
+      std::uint64_t keep = params.prune_keep;
+      w->enqueueTask([snap, keep, codec, snap_path](storage::BlockLog& log, std::string* err) {
+        if (!save_state_snapshot(snap_path, snap, err)) return false;
+        if (!keep) return true;
+        std::uint64_t below = snap.height + 1 > keep ? snap.height + 1 - keep : 0;
+        return log.compact(below, [&codec](std::string_view in, std::string* out) {
+          return prune_block_record(in, out, codec);
+        }, err);
+      });
+    });
+    // A chain loaded over the running one (menu 8) replaces the log contents:
+    // the rewrite is queued ahead of any block committed on top of it.
+    node.setReplaceHook([w = log_writer.get(), codec, snapshot_every, snap_path](const Blockchain& bc) {
+      std::vector<std::string> records;
+      records.reserve(bc.chain().size());
+      for (std::uint64_t h = 0; h < bc.chain().size(); ++h) {
+        auto b = bc.body(h);  // header-only only if the body was pruned
+        records.push_back(encode_block_record(b ? *b : bc.chain()[h], codec));
+      }
+      StateSnapshot snap = bc.snapshot()->stateAtTip();
+      w->enqueueTask([records = std::move(records), snap, snapshot_every, snap_path](storage::BlockLog& log,
+                                                                                     std::string* err) {
+        // written beside the old log and renamed into place: a crash leaves one or the other
+        if (!log.replaceAll(records, err)) return false;
+        return !snapshot_every || save_state_snapshot(snap_path, snap, err);
+      });
+    });
+    // A reorg only drops the records above the fork; the commit hook then
+    // appends the branch. A state snapshot is rewritten at the fork, since
+    // one above it may describe blocks that are no longer in the log.
+    node.setReorgHook([w = log_writer.get(), snapshot_every, snap_path](std::uint64_t fork,
+                                                                       const StateSnapshot& at_fork) {
+      w->enqueueTask([fork, at_fork, snapshot_every, snap_path](storage::BlockLog& log, std::string* err) {
+        if (!log.truncate(fork + 1, err)) {
+          log.close();  // tail unknown: later blocks must not be appended to it
+          return false;
+        }
+        return !snapshot_every || save_state_snapshot(snap_path, at_fork, err);
+      });
+    });
   }
 
   // Listener
@@ -59,23 +226,36 @@ int main(int argc, char** argv) {
     host = listen.substr(0, pos);
     port = std::stoi(listen.substr(pos + 1));
   }
-  p2p::Listener listener(host, port, [&](std::string msg) {
-    // Expect a JSON object with {"type":"NEWBLOCK","block":{...}}
-    try {
-      auto j = nlohmann::json::parse(msg);
-      if (j.value("type", "") == "NEWBLOCK") {
-        Block b = Block::from_json(j.at("block"));
-        // naive acceptance: append if links to our tip
-        if (b.prev_hash == bc.chain().back().hash && calculate_block_hash(b) == b.hash) {
-          const_cast<std::vector<Block>&>(bc.chain()).push_back(b);
-          std::cout << "\n[peer] Accepted new block #" << b.index << " from network.\n> ";
-        }
-      }
-    } catch (...) {
-      // ignore
-    }
+  p2p::PeerPool peer_pool(peers);  // persistent outbound connections
+  // Blocks travel as compact blocks; accepted ones link to our tip and verify
+  // (serialized with the miner).
+  auto send_to = [&peer_pool](const std::string& peer, const std::string& msg) { peer_pool.sendTo(peer, msg); };
+  BlockRelay relay(node, send_to, [&peer_pool, &relay](const Block& b) {
+    std::cout << "\n[peer] Accepted new block #" << b.index << " from network.\n> ";
+    peer_pool.broadcast(relay.announce(b));  // forward, so blocks cross multi-hop topologies
   });
-  listener.start();
+  ChainSync sync(node, send_to);  // catch up with peers that are ahead
+  relay.setGapHandler([&sync](const std::string& peer) { sync.peerAhead(peer); });
+  TxGossip gossip(node, send_to, peers);  // pending txs reach every peer's mempool
+  // The listener thread only checks headers and queues; decoding, validation
+  // and commits run on the dispatcher's workers.
+  MessageDispatcher dispatcher([&](WireReader& m) {
+    if (!relay.handle(m) && !sync.handle(m)) gossip.handle(m);
+  });
+  p2p::Listener listener(host, port, [&dispatcher](std::string msg) { dispatcher.post(std::move(msg)); });
+  {
+    std::string err;
+    if (listener.start(&err)) {
+      std::string self = host + ":" + std::to_string(listener.port());
+      relay.setSelfAddress(self);
+      sync.setSelfAddress(self);
+      gossip.setSelfAddress(self);
+      std::cout << "Listening for peers on " << self << "\n";
+    } else {
+      std::cerr << "[p2p] " << err << "\n";
+    }
+  }
+  sync.start(peers);
 
   // Simple CLI
   while (true) {
@@ -108,44 +288,100 @@ int main(int argc, char** argv) {
       Tx tx; tx.from_pubkey_pem = pub; tx.to_addr = to; tx.amount = amt; tx.nonce = nonce;
       auto sig = crypto::ecdsa_sign_p256(priv, tx.message());
       tx.signature_hex = sig;
-      bc.addTransaction(std::move(tx));
-      std::cout << "Tx added to mempool.\n";
+      gossip.submit(std::move(tx));
+      std::cout << "Tx added to mempool and announced to peers.\n";
     } else if (c == 4) {
       std::string miner;
       std::cout << "Miner address: "; std::getline(std::cin, miner);
-      const Block& b = bc.minePending(miner);
+      Block b = node.mine(miner);
       std::cout << "Mined block #" << b.index << " in " << b.mine_ms << " ms, hash=" << b.hash << "\n";
-      // Broadcast to peers
-      nlohmann::json j = {{"type", "NEWBLOCK"}, {"block", b.to_json()}};
-      p2p::broadcast(peers, j.dump());
-      if (!persist_path.empty()) {
-        std::string err;
-        storage::save_json_to_file(persist_path, bc.toJson(), &err);
-      }
+      // Announce to peers; they fetch whatever txs they lack
+      peer_pool.broadcast(relay.announce(b));
     } else if (c == 5) {
-      for (const auto& b : bc.chain()) {
+      auto snap = node.snapshot();
+      for (const auto& b : snap->blocks) {
+        auto full = b.pruned ? snap->body(b.index) : nullptr;
         std::cout << "Block #" << b.index << " ts=" << b.timestamp << " diff=" << b.difficulty
-                  << " txs=" << b.transactions.size() << "\n"
+                  << " txs=" << (full ? full.get() : &b)->transactions.size() << "\n"
                   << "  prev=" << b.prev_hash.substr(0, 16) << "...\n"
                   << "  hash=" << b.hash.substr(0, 16) << "...\n";
       }
     } else if (c == 6) {
-      std::cout << (bc.isValid() ? "VALID" : "INVALID") << "\n";
+      std::size_t bad = 0;
+      if (node.validate(Blockchain::ValidateMode::Incremental, &bad)) std::cout << "VALID\n";
+      else std::cout << "INVALID (first bad block #" << bad << ")\n";
     } else if (c == 7) {
       std::string path; std::cout << "Path: "; std::getline(std::cin, path);
-      std::string err; if (storage::save_json_to_file(path, bc.toJson(), &err)) std::cout << "Saved.\n";
+      // streamed block by block, plus a state snapshot for instant reloads;
+      // holds the writer lock for the duration
+      std::string err; bool ok = false;
+      node.withChain([&](const Blockchain& bc) {
+        ok = storage::save_file_atomically(path, [&bc](std::ostream& out) { bc.writeJson(out); }, &err) &&
+             save_state_snapshot(path + ".state", bc.snapshot()->stateAtTip(), &err);
+      });
+      if (ok) std::cout << "Saved.\n";
       else std::cout << "Save failed: " << err << "\n";
     } else if (c == 8) {
       std::string path; std::cout << "Path: "; std::getline(std::cin, path);
-      std::string s, err; if (!storage::load_file_to_string(path, &s, &err)) { std::cout << "Load failed: " << err << "\n"; }
-      else { bc = Blockchain::fromJson(s); std::cout << "Loaded.\n"; }
+      std::string err; if (!load_chain(path, params.assume_valid, node, &err)) { std::cout << "Load failed: " << err << "\n"; }
+      else { std::cout << (data_dir.empty() ? "Loaded.\n" : "Loaded (block log rewritten).\n"); }
     } else if (c == 9) {
       std::uint64_t t; std::cout << "Target block time (sec): "; std::cin >> t; std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
       // not persisted for simplicity
       std::cout << "Set (session only).\n";
+    } else if (c == 10) {
+      std::string addr; std::cout << "Address: "; std::getline(std::cin, addr);
+      auto snap = node.snapshot();
+      std::cout << "Balance: " << snap->balanceOf(addr) << " (nonce " << snap->nonceOf(addr)
+                << ", height " << snap->height() << ")\n";
+      auto history = node.addressHistory(addr);
+      if (!history.empty()) std::cout << "Transfers: " << history.size() << "\n";
+    } else if (c == 11) {
+      node.withChain([](const Blockchain& bc) {
+        const TxIndex* idx = bc.txIndex();
+        if (!idx) { std::cout << "Tx index disabled (start with --txindex).\n"; return; }
+        std::cout << "Indexed txs: " << idx->txCount() << ", addresses: " << idx->addressCount()
+                  << ", memory: " << idx->memoryUsage() / 1024 << " KiB\n";
+      });
+    } else if (c == 12) {
+      std::size_t bad = 0;
+      if (node.validate(Blockchain::ValidateMode::Deep, &bad)) std::cout << "VALID\n";
+      else std::cout << "INVALID (first bad block #" << bad << ")\n";
+    } else if (c == 13) {
+      auto ls = listener.stats();
+      std::cout << "Connections: " << ls.open << " open, " << ls.accepted << " accepted; messages: "
+                << ls.messages << "\n";
+      auto ds = dispatcher.stats();
+      const char* names[] = {"block", "request", "tx"};
+      for (std::size_t i = 0; i < ds.lanes.size(); ++i) {
+        const auto& l = ds.lanes[i];
+        std::cout << "  " << names[i] << " queue: depth " << l.depth << " (max " << l.max_depth << "), processed "
+                  << l.processed << ", dropped " << l.dropped << "\n";
+      }
+      if (ds.malformed) std::cout << "  malformed: " << ds.malformed << "\n";
     }
   }
 
+  sync.stop();
+  peer_pool.flush(std::chrono::milliseconds(500));  // let the last blocks go out
+  peer_pool.stop();
   listener.stop();
+  dispatcher.stop();  // no more peer blocks after this
+  if (log_writer) {
+    std::string err;
+    node.setCommitHook({});
+    node.setReplaceHook({});
+    node.setReorgHook({});
+    // failures were reported as they happened; unless an append failed,
+    // every block up to the watermark is durable now and can be trusted on restart
+    log_writer->flush();
+    if (!log_writer->failed()) {
+      ValidatedCheckpoint cp;
+      node.withChain([&cp](const Blockchain& bc) { cp = bc.validatedCheckpoint(); });
+      if (!save_validated_checkpoint(validated_path, cp.height, cp.hash, &err)) {
+        std::cerr << "[db] saving validated height failed: " << err << "\n";
+      }
+    }
+  }
   return 0;
 }
@@ -0,0 +1,51 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "mempool.hpp"
+
+namespace sbc {
+
+Mempool::~Mempool() {
+  Node* n = head_.exchange(nullptr, std::memory_order_acquire);
+  while (n) {
+    Node* next = n->next;
+    delete n;
+    n = next;
+  }
+}
+
+void Mempool::push(Tx tx) {
+  // Count first so a concurrent drain() can never push size_ below zero.
+  size_.fetch_add(1, std::memory_order_relaxed);
+  Node* n = new Node{std::move(tx), head_.load(std::memory_order_relaxed)};
+  while (!head_.compare_exchange_weak(n->next, n, std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+  }
+}
+
+std::size_t Mempool::drain(std::vector<Tx>* out) {
+  // Detach the whole stack at once, then reverse it to restore FIFO order.
+  Node* n = head_.exchange(nullptr, std::memory_order_acquire);
+  Node* fifo = nullptr;
+  std::size_t count = 0;
+  while (n) {
+    Node* next = n->next;
+    n->next = fifo;
+    fifo = n;
+    n = next;
+    ++count;
+  }
+  out->reserve(out->size() + count);
+  while (fifo) {
+    Node* next = fifo->next;
+    out->push_back(std::move(fifo->tx));
+    delete fifo;
+    fifo = next;
+  }
+  size_.fetch_sub(count, std::memory_order_relaxed);
+  return count;
+}
+
+}  // namespace sbc
@@ -0,0 +1,42 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "tx.hpp"
+
+namespace sbc {
+
+// Lock-free multi-producer / single-consumer intake queue for transactions.
+// Any thread (CLI, network) may push(); only the chain writer calls drain().
+// Producers never block each other: a push is one CAS on the list head.
+class Mempool {
+ public:
+  Mempool() = default;
+  ~Mempool();
+  Mempool(const Mempool&) = delete;
+  Mempool& operator=(const Mempool&) = delete;
+
+  void push(Tx tx);
+
+  // Move every queued tx into *out (appended in arrival order per producer).
+  // Returns the number of txs drained. Single consumer only.
+  std::size_t drain(std::vector<Tx>* out);
+
+  std::size_t approxSize() const noexcept { return size_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Node {
+    Tx tx;
+    Node* next;
+  };
+  std::atomic<Node*> head_{nullptr};
+  std::atomic<std::size_t> size_{0};
+};
+
+}  // namespace sbc
@@ -0,0 +1,206 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "node.hpp"
+
+#include <future>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+namespace sbc {
+
+Node::Node(Blockchain bc) : bc_(std::move(bc)) { publishLocked(); }
+
+void Node::publishLocked() { std::atomic_store(&snap_, bc_.snapshot()); }
+
+void Node::submitTx(Tx tx) {
+  if (tx.from_pubkey_pem.empty()) throw std::invalid_argument("Use coinbase via miner address");
+  intake_.push(std::move(tx));
+}
+
+void Node::drainIntakeLocked() {
+  std::vector<Tx> batch;
+  intake_.drain(&batch);
+  for (auto& tx : batch) bc_.addTransaction(std::move(tx));
+}
+
+bool Node::submitBlock(const Block& b, std::string* err) {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  drainIntakeLocked();
+  if (!bc_.acceptBlock(b, err)) return false;
+  publishLocked();
+  if (on_commit_) on_commit_(b);
+  return true;
+}
+
+Block Node::mine(const std::string& miner_addr) { return mineBlocks(1, miner_addr).front(); }
+
+std::vector<Block> Node::mineBlocks(std::size_t count, const std::string& miner_addr) {
+  std::vector<Block> out;
+  BlockTemplate cur;
+  bool have_template = false;
+  while (out.size() < count) {
+    Block b;
+    {
+      std::lock_guard<std::mutex> lk(writer_mu_);
+      drainIntakeLocked();
+      if (!have_template || !bc_.templateIsCurrent(cur)) cur = bc_.buildTemplate(miner_addr);
+      b = bc_.makeBlock(cur);
+    }
+
+    std::future<BlockTemplate> next;
+    if (out.size() + 1 < count) {
+      std::unordered_set<std::string> taken;
+      for (const auto& tx : cur.txs) taken.insert(tx.hash());
+      for (const auto& tx : cur.rejected) taken.insert(tx.hash());
+      next = std::async(std::launch::async,
+                        [this, base = cur.post_state, taken = std::move(taken), miner_addr,
+                         height = b.index + 1] {
+                          std::vector<Tx> candidates;
+                          std::shared_ptr<SigCache> sigs;
+                          {
+                            std::lock_guard<std::mutex> lk(writer_mu_);
+                            drainIntakeLocked();
+                            for (const auto& tx : bc_.pending()) {
+                              if (!taken.count(tx.hash())) candidates.push_back(tx);
+                            }
+                            sigs = bc_.sigCache();
+                          }
+                          return Blockchain::buildTemplate(base, candidates, miner_addr, height,
+                                                           sigs.get());
+                        });
+    }
+
+    mine_block(b);
+
+    bool committed;
+    {
+      std::lock_guard<std::mutex> lk(writer_mu_);
+      committed = bc_.commitTemplate(b, cur);
+      if (committed) {
+        publishLocked();
+        if (on_commit_) on_commit_(b);
+      }
+    }
+    if (!committed) {
+      // a peer block won the race; the prepared follow-up is stale too
+      if (next.valid()) next.wait();
+      have_template = false;
+      continue;
+    }
+    out.push_back(std::move(b));
+    have_template = next.valid();
+    if (have_template) {
+      cur = next.get();
+      cur.base_tip = out.back().hash;
+    }
+  }
+  return out;
+}
+
+void Node::replace(Blockchain bc) {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  bc_ = std::move(bc);
+  publishLocked();
+  if (on_replace_) on_replace_(bc_);
+}
+
+bool Node::switchBranch(std::uint64_t fork, const std::vector<Block>& branch, std::string* err) {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  drainIntakeLocked();
+  const BlockList& chain = bc_.chain();
+  if (branch.empty() || fork >= chain.size()) {
+    if (err) *err = "branch does not fork from our chain";
+    return false;
+  }
+  // the branch's work, from its headers: acceptance holds each block to the
+  // difficulty it claims
+  std::uint64_t work = bc_.work();
+  for (std::uint64_t h = fork + 1; h < chain.size(); ++h) work -= block_work(chain[h].difficulty);
+  for (const auto& b : branch) work += block_work(b.difficulty);
+  if (!chain_outweighs(work, branch.back().hash, bc_.work(), chain.back().hash)) {
+    if (err) *err = "branch does not outweigh our chain";
+    return false;
+  }
+
+  // the view after the rewind and after each block, so readers and hooks see
+  // the same sequence a rewind and commits would produce
+  std::vector<std::shared_ptr<const ChainSnapshot>> views;
+  views.reserve(branch.size() + 1);
+  if (!bc_.switchBranch(fork, branch, err, [&] { views.push_back(bc_.snapshot()); })) return false;
+  std::atomic_store(&snap_, views[0]);
+  if (on_reorg_) on_reorg_(fork, views[0]->stateAtTip());
+  for (std::size_t i = 0; i < branch.size(); ++i) {
+    std::atomic_store(&snap_, views[i + 1]);
+    if (on_commit_) on_commit_(branch[i]);
+  }
+  return true;
+}
+
+void Node::setCommitHook(std::function<void(const Block&)> hook) {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  on_commit_ = std::move(hook);
+}
+
+void Node::setReplaceHook(std::function<void(const Blockchain&)> hook) {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  on_replace_ = std::move(hook);
+}
+
+void Node::setReorgHook(std::function<void(std::uint64_t, const StateSnapshot&)> hook) {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  on_reorg_ = std::move(hook);
+}
+
+bool Node::validate(Blockchain::ValidateMode mode, std::size_t* first_bad) {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  return bc_.validate(mode, first_bad);
+}
+
+std::optional<Block> Node::findBlock(const std::string& hash) const {
+  std::optional<Block> header;
+  {
+    std::lock_guard<std::mutex> lk(writer_mu_);
+    const Block* b = bc_.findBlock(hash);
+    if (!b) return std::nullopt;
+    if (!b->pruned) return *b;
+    header = *b;
+  }
+  // body left on disk: read it back without holding the writer lock
+  auto full = snapshot()->body(header->index);
+  if (full && full->hash == hash) return *full;
+  return header;
+}
+
+std::optional<TxLocation> Node::findTx(const std::string& txid) const {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  const TxIndex* idx = bc_.txIndex();
+  return idx ? idx->find(txid) : std::nullopt;
+}
+
+std::vector<TxLocation> Node::addressHistory(const std::string& addr) const {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  const TxIndex* idx = bc_.txIndex();
+  return idx ? idx->history(addr) : std::vector<TxLocation>{};
+}
+
+std::vector<Tx> Node::pendingTxs() {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  drainIntakeLocked();
+  return bc_.pending();
+}
+
+Blockchain::Params Node::params() const {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  return bc_.params();
+}
+
+void Node::withChain(const std::function<void(const Blockchain&)>& f) const {
+  std::lock_guard<std::mutex> lk(writer_mu_);
+  f(bc_);
+}
+
+}  // namespace sbc
@@ -0,0 +1,97 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "blockchain.hpp"
+#include "mempool.hpp"
+
+namespace sbc {
+
+// Thread-safe front end for a Blockchain shared by the CLI and the network.
+// Transactions from any thread land in a lock-free intake queue; every chain
+// mutation (mining, peer blocks, reload) goes through one writer lock, which
+// is also where the intake queue is drained into the chain's mempool.
+// After each mutation the writer publishes an immutable ChainSnapshot, so
+// queries never wait for mining or commits.
+class Node {
+ public:
+  explicit Node(Blockchain bc);
+
+  // Any thread. Never blocks on the writer.
+  void submitTx(Tx tx);
+
+  // Any thread. Serialized with the writer.
+  bool submitBlock(const Block& b, std::string* err = nullptr);
+  Block mine(const std::string& miner_addr);
+
+  // Mine `count` blocks back to back. The nonce search runs outside the writer
+  // lock, and the next template (tx selection, overlay state, Merkle root) is
+  // built in the background meanwhile, so the next search starts right after
+  // each commit. If a peer block moves the tip, the stale work is redone.
+  std::vector<Block> mineBlocks(std::size_t count, const std::string& miner_addr);
+  void replace(Blockchain bc);
+  // Reorg: replace the blocks above height `fork` with `branch` (which must
+  // link to block `fork` and apply cleanly) if the result outweighs the
+  // current chain (see chain_outweighs). The reorg hook then sees `fork` and
+  // the commit hook each branch block, so storage drops and appends only
+  // what changed. False, with the chain unchanged, otherwise.
+  bool switchBranch(std::uint64_t fork, const std::vector<Block>& branch, std::string* err = nullptr);
+  bool validate(Blockchain::ValidateMode mode, std::size_t* first_bad = nullptr);
+
+  // Called with each block appended by mining or peer acceptance, in chain
+  // order, under the writer lock (e.g. to append it to a storage::BlockLog).
+  // replace() does not invoke it.
+  void setCommitHook(std::function<void(const Block&)> hook);
+  // Called with the new chain at the end of replace(), under the writer lock,
+  // so it runs before the commit hook sees any block on top of that chain.
+  void setReplaceHook(std::function<void(const Blockchain&)> hook);
+  // Called by switchBranch() under the writer lock once the blocks above
+  // `fork` are gone, with the account table as of `fork`, before the commit
+  // hook sees the branch blocks (e.g. to truncate a storage::BlockLog).
+  void setReorgHook(std::function<void(std::uint64_t fork, const StateSnapshot& at_fork)> hook);
+
+  // Chain parameters (difficulty rule, pruning). Serialized with the writer.
+  Blockchain::Params params() const;
+
+  // Run f against the live chain (holds the writer lock; prefer snapshot()).
+  void withChain(const std::function<void(const Blockchain&)>& f) const;
+
+  // Any thread, lock-free: latest published chain/state view.
+  std::shared_ptr<const ChainSnapshot> snapshot() const { return std::atomic_load(&snap_); }
+
+  // Block by hash via the chain's hash index (writer lock held for the probe
+  // only). A body kept on disk is read back; header-only if it was pruned.
+  std::optional<Block> findBlock(const std::string& hash) const;
+
+  // Tx-index queries; nullopt / empty when the chain was built without it.
+  std::optional<TxLocation> findTx(const std::string& txid) const;
+  std::vector<TxLocation> addressHistory(const std::string& addr) const;
+
+  std::size_t pendingIntake() const noexcept { return intake_.approxSize(); }
+  // Copy of the pending tx set (intake drained first). Serialized with the writer.
+  std::vector<Tx> pendingTxs();
+
+ private:
+  void drainIntakeLocked();
+  void publishLocked();
+
+ private:
+  mutable std::mutex writer_mu_;
+  Blockchain bc_;
+  Mempool intake_;
+  std::shared_ptr<const ChainSnapshot> snap_;
+  std::function<void(const Block&)> on_commit_;
+  std::function<void(const Blockchain&)> on_replace_;
+  std::function<void(std::uint64_t, const StateSnapshot&)> on_reorg_;
+};
+
+}  // namespace sbc
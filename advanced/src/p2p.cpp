@@ -4,9 +4,16 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 */
 
 #include "p2p.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
 
 #if defined(_WIN32)
 #include <winsock2.h>
@@ -14,10 +21,17 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 #pragma comment(lib, "Ws2_32.lib")
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 namespace p2p {
 
@@ -32,86 +46,591 @@ static bool split_hostport(const std::string& hp, std::string* host, int* port)
 Listener::Listener(const std::string& host, int port, std::function<void(std::string)> on_message)
     : host_(host), port_(port), on_message_(std::move(on_message)) {}
 
-void Listener::start() {
-  running_ = true;
-  th_ = std::thread([this] {
+static void close_socket(int fd) {
 #if defined(_WIN32)
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
-#endif
-    int server_fd = ::socket(AF_INET, SOCK_STREAM, 0);
-    int server_fd_close_marker = server_fd;
-    if (server_fd < 0) return;
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port_);
-    addr.sin_addr.s_addr = inet_addr(host_.c_str());
-    int yes = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
-    if (::bind(server_fd, (sockaddr*)&addr, sizeof(addr)) < 0) { /* fail silently */ }
-    ::listen(server_fd, 8);
-    while (running_) {
-      sockaddr_in cli{};
-      socklen_t clilen = sizeof(cli);
-      int cfd = ::accept(server_fd, (sockaddr*)&cli, &clilen);
-      if (cfd < 0) continue;
-      std::string buf;
-      char tmp[1024];
-      int n;
+  closesocket(fd);
+#else
+  ::close(fd);
+#endif
+}
+
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL;  // a dead peer is an error, not SIGPIPE
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+#if defined(_WIN32)
+static int poll_fds(pollfd* fds, std::size_t n, int ms) { return WSAPoll(fds, (ULONG)n, ms); }
+static bool would_block() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+#else
+static int poll_fds(pollfd* fds, std::size_t n, int ms) { return ::poll(fds, (nfds_t)n, ms); }
+static bool would_block() { return errno == EINPROGRESS || errno == EAGAIN || errno == EWOULDBLOCK; }
+#endif
+
+static void set_nonblocking(int fd, bool on) {
+#if defined(_WIN32)
+  u_long mode = on ? 1 : 0;
+  ioctlsocket(fd, FIONBIO, &mode);
+#else
+  int fl = ::fcntl(fd, F_GETFL);
+  ::fcntl(fd, F_SETFL, on ? (fl | O_NONBLOCK) : (fl & ~O_NONBLOCK));
+#endif
+}
+
+static int socket_error(int fd) {
+  int e = 0;
+  socklen_t len = sizeof(e);
+  if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*)&e, &len) != 0) return -1;
+  return e;
+}
+
+// Non-blocking socket with a connect to host:port in progress (or done);
+// -1 if it failed outright.
+static int start_connect(const std::string& host, int port) {
+  int fd = (int)::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  set_nonblocking(fd, true);
+#if defined(SO_NOSIGPIPE)
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = inet_addr(host.c_str());
+  if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0 && !would_block()) {
+    close_socket(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Blocking socket connected to host:port within timeout, with sends
+// limited to send_timeout each; -1 on failure, *timed_out set if the
+// connect ran out of time.
+static int connect_to(const std::string& host, int port, std::chrono::milliseconds timeout,
+                      std::chrono::milliseconds send_timeout, bool* timed_out) {
+  *timed_out = false;
+  int fd = start_connect(host, port);
+  if (fd < 0) return -1;
+  pollfd p{(decltype(pollfd::fd))fd, POLLOUT, 0};
+  int r = poll_fds(&p, 1, (int)timeout.count());
+  if (r <= 0 || socket_error(fd) != 0) {
+    *timed_out = r == 0;
+    close_socket(fd);
+    return -1;
+  }
+  set_nonblocking(fd, false);
 #if defined(_WIN32)
-      while ((n = ::recv(cfd, tmp, sizeof(tmp), 0)) > 0) buf.append(tmp, tmp + n);
-      closesocket(cfd);
+  DWORD tv = (DWORD)send_timeout.count();
 #else
-      while ((n = ::recv(cfd, tmp, sizeof(tmp), 0)) > 0) buf.append(tmp, tmp + n);
-      ::close(cfd);
+  timeval tv{(time_t)(send_timeout.count() / 1000), (suseconds_t)(send_timeout.count() % 1000 * 1000)};
 #endif
-      if (!buf.empty() && on_message_) on_message_(buf);
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof(tv));
+  return fd;
+}
+
+// Writes all of p; false on error, *timed_out set if SO_SNDTIMEO expired.
+// *written is how many bytes the socket took either way.
+static bool send_all(int fd, const char* p, std::size_t n, std::size_t* written, bool* timed_out) {
+  *timed_out = false;
+  *written = 0;
+  while (n > 0) {
+    auto w = ::send(fd, p, (int)std::min<std::size_t>(n, 1u << 30), kSendFlags);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) {
+      *timed_out = w < 0 && would_block();
+      return false;
     }
+    p += w;
+    n -= (std::size_t)w;
+    *written += (std::size_t)w;
+  }
+  return true;
+}
+
+// An idle outbound connection never expects data, so readable means the
+// peer closed or reset it; checked before reusing the socket.
+static bool peer_hung_up(int fd) {
+#if defined(_WIN32)
+  (void)fd;
+  return false;
+#else
+  pollfd p{fd, POLLIN, 0};
+  if (::poll(&p, 1, 0) <= 0) return false;
+  char c;
+  return ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0;
+#endif
+}
+
+bool Listener::start(std::string* err) {
+  auto fail = [&](const std::string& why) {
+    if (err) *err = why + ": " + std::strerror(errno);
+    if (listen_fd_ >= 0) close_socket(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  };
+  if (running_) return true;
 #if defined(_WIN32)
-    WSACleanup();
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2, 2), &wsaData);
 #endif
-            #if defined(_WIN32)
-            closesocket(server_fd_close_marker);
-            #else
-            ::close(server_fd_close_marker);
-            #endif
-      });
+  listen_fd_ = (int)::socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) return fail("socket");
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port_);
+  addr.sin_addr.s_addr = inet_addr(host_.c_str());
+  int yes = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(yes));
+  if (::bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) return fail("bind " + host_);
+  if (::listen(listen_fd_, SOMAXCONN) < 0) return fail("listen");
+  socklen_t len = sizeof(addr);
+  if (::getsockname(listen_fd_, (sockaddr*)&addr, &len) == 0) port_ = ntohs(addr.sin_port);
+#if defined(__linux__)
+  ::fcntl(listen_fd_, F_SETFL, ::fcntl(listen_fd_, F_GETFL) | O_NONBLOCK);
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) return fail("eventfd");
+#endif
+  running_ = true;
+  th_ = std::thread([this] { run(); });
+  return true;
+}
+
+void Listener::deliver(std::string msg) {
+  if (msg.empty()) return;
+  messages_.fetch_add(1, std::memory_order_relaxed);
+  if (on_message_) on_message_(std::move(msg));
+}
+
+std::string frame_message(std::string_view payload) {
+  std::string out(4 + payload.size(), '\0');
+  auto n = (std::uint32_t)payload.size();
+  for (int i = 0; i < 4; ++i) out[i] = (char)((n >> (24 - 8 * i)) & 0xff);
+  payload.copy(&out[4], payload.size());
+  return out;
+}
+
+namespace {
+
+// Bytes read from one connection per pass of the event loop, so a peer that
+// keeps its socket full cannot starve the others.
+constexpr std::size_t kReadBudget = 256u << 10;
+
+// Receive buffer of one inbound connection; the first byte fixes its framing.
+struct Conn {
+  enum class Mode { Unknown, Lines, Frames };
+  Mode mode = Mode::Unknown;
+  std::string buf;
+  std::size_t scanned = 0;  // Lines: bytes of buf already searched for '\n'
+  bool ready = false;       // on the ready list: budget ran out before EAGAIN
+
+  // Hands every complete message in buf to out. At eof a trailing
+  // unterminated line is delivered too, a partial frame is discarded.
+  // Returns false on a protocol error (oversized message).
+  template <class Out>
+  bool consume(bool eof, Out&& out) {
+    if (mode == Mode::Unknown && !buf.empty()) {
+      mode = (unsigned char)buf[0] < 0x04 ? Mode::Frames : Mode::Lines;
+    }
+    std::size_t begin = 0;
+    if (mode == Mode::Frames) {
+      while (buf.size() - begin >= 4) {
+        std::uint32_t len = 0;
+        for (int i = 0; i < 4; ++i) len = (len << 8) | (unsigned char)buf[begin + i];
+        if (len > kMaxMessageBytes) return false;
+        if (buf.size() - begin - 4 < len) break;
+        out(buf.substr(begin + 4, len));
+        begin += 4 + len;
+      }
+      buf.erase(0, begin);
+      return true;
+    }
+    std::size_t nl;
+    while ((nl = buf.find('\n', scanned)) != std::string::npos) {
+      out(buf.substr(begin, nl - begin));
+      begin = scanned = nl + 1;
+    }
+    buf.erase(0, begin);
+    scanned = buf.size();
+    if (buf.size() > kMaxMessageBytes) return false;
+    if (eof) out(std::move(buf));
+    return true;
+  }
+};
+
+}  // namespace
+
+#if defined(__linux__)
+
+void Listener::run() {
+  int ep = ::epoll_create1(EPOLL_CLOEXEC);
+  std::unordered_map<int, Conn> conns;
+  auto watch = [ep](int fd, std::uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    return ::epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == 0;
+  };
+  auto drop = [&](int fd, bool error) {
+    ::close(fd);  // also removes it from the epoll set
+    conns.erase(fd);
+    open_.fetch_sub(1, std::memory_order_relaxed);
+    if (error) dropped_.fetch_add(1, std::memory_order_relaxed);
+  };
+
+  // Edge-triggered: a connection whose read budget ran out before EAGAIN
+  // gets no new event, so it goes on the ready list and is read again on
+  // the next pass, after the loop has polled everyone else.
+  std::vector<int> ready;
+  char tmp[64 * 1024];
+  auto serve = [&](int fd) {
+    auto it = conns.find(fd);
+    if (it == conns.end()) return;
+    Conn& c = it->second;
+    auto out = [this](std::string m) { deliver(std::move(m)); };
+    bool eof = false, error = false, ok = true;
+    std::size_t budget = kReadBudget;
+    while (budget > 0) {
+      ssize_t r = ::recv(fd, tmp, std::min(sizeof(tmp), budget), 0);
+      if (r > 0) {
+        budget -= (std::size_t)r;
+        c.buf.append(tmp, (std::size_t)r);
+        // hand off as we go: buf then never holds more than one message
+        if (!(ok = c.consume(false, out))) break;
+        continue;
+      }
+      if (r == 0) eof = true;
+      else if (errno == EINTR) continue;
+      else if (errno != EAGAIN && errno != EWOULDBLOCK) error = true;
+      break;
+    }
+    if (ok && eof && !error) ok = c.consume(true, out);
+    if (error || !ok) drop(fd, true);
+    else if (eof) drop(fd, false);
+    else if (budget == 0 && !c.ready) {
+      c.ready = true;
+      ready.push_back(fd);
+    }
+  };
+
+  if (ep < 0 || !watch(listen_fd_, EPOLLIN | EPOLLET) || !watch(wake_fd_, EPOLLIN)) running_ = false;
+  std::vector<epoll_event> events(256);
+  while (running_) {
+    int n = ::epoll_wait(ep, events.data(), (int)events.size(), ready.empty() ? -1 : 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        running_ = false;
+        break;
+      }
+      if (fd == listen_fd_) {
+        // edge-triggered: accept until the backlog is empty
+        for (;;) {
+          int cfd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+          if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;  // EAGAIN, or out of descriptors: retried on the next connection
+          }
+          if (!watch(cfd, EPOLLIN | EPOLLRDHUP | EPOLLET)) {
+            ::close(cfd);
+            continue;
+          }
+          conns.emplace(cfd, Conn{});
+          accepted_.fetch_add(1, std::memory_order_relaxed);
+          open_.fetch_add(1, std::memory_order_relaxed);
+        }
+        continue;
+      }
+      serve(fd);
+    }
+    if (!running_) break;
+    // connections left over from earlier passes; serve() may queue them again
+    std::vector<int> again;
+    again.swap(ready);
+    for (int fd : again) {
+      auto it = conns.find(fd);
+      if (it == conns.end()) continue;  // dropped meanwhile
+      it->second.ready = false;
+      serve(fd);
+    }
+  }
+
+  for (auto& kv : conns) ::close(kv.first);
+  open_.fetch_sub(conns.size(), std::memory_order_relaxed);
+  if (ep >= 0) ::close(ep);
 }
 
+#else
+
+// Portable fallback: one connection at a time, read until the peer closes.
+// accept waits in select() with a timeout so stop() is still observed.
+void Listener::run() {
+  while (running_) {
+    fd_set rd;
+    FD_ZERO(&rd);
+    FD_SET(listen_fd_, &rd);
+    timeval tv{0, 200 * 1000};
+    if (::select(listen_fd_ + 1, &rd, nullptr, nullptr, &tv) <= 0) continue;
+    int cfd = (int)::accept(listen_fd_, nullptr, nullptr);
+    if (cfd < 0) continue;
+    accepted_.fetch_add(1, std::memory_order_relaxed);
+    Conn c;
+    char tmp[1024];
+    int n;
+    bool ok = true;
+    while (ok && (n = ::recv(cfd, tmp, sizeof(tmp), 0)) > 0) {
+      c.buf.append(tmp, tmp + n);
+      ok = c.consume(false, [this](std::string m) { deliver(std::move(m)); });
+    }
+    close_socket(cfd);
+    if (ok) c.consume(true, [this](std::string m) { deliver(std::move(m)); });
+    else dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+#endif
 
 void Listener::stop() {
+  if (!th_.joinable()) return;
+#if defined(__linux__)
+  std::uint64_t one = 1;
+  if (::write(wake_fd_, &one, sizeof(one)) < 0) { /* already signalled */ }
+#endif
   running_ = false;
-  if (th_.joinable()) th_.join();
+  th_.join();
+  close_socket(listen_fd_);
+  listen_fd_ = -1;
+#if defined(__linux__)
+  ::close(wake_fd_);
+  wake_fd_ = -1;
+#elif defined(_WIN32)
+  WSACleanup();
+#endif
 }
 
 Listener::~Listener() { stop(); }
 
-void broadcast(const std::vector<std::string>& peers, const std::string& line) {
+ListenerStats Listener::stats() const {
+  ListenerStats s;
+  s.accepted = accepted_.load(std::memory_order_relaxed);
+  s.messages = messages_.load(std::memory_order_relaxed);
+  s.dropped = dropped_.load(std::memory_order_relaxed);
+  s.open = open_.load(std::memory_order_relaxed);
+  return s;
+}
+
+struct PeerPool::Peer {
+  std::string name, host;
+  int port = 0;
+  mutable std::mutex mu;
+  std::condition_variable cv;       // queue non-empty, or stopping
+  std::condition_variable drained;  // queue empty and nothing in flight
+  struct Item {
+    std::shared_ptr<const std::string> framed;
+    std::chrono::steady_clock::time_point queued_at;
+  };
+  std::deque<Item> queue;
+  std::size_t in_flight = 0;
+  bool stopping = false;
+  int fd = -1;
+  PeerStats stats;
+  std::thread th;
+};
+
+PeerPool::PeerPool(const std::vector<std::string>& peers, PeerPoolOptions opts) : opts_(opts) {
 #if defined(_WIN32)
   WSADATA wsaData;
   WSAStartup(MAKEWORD(2, 2), &wsaData);
 #endif
-  for (const auto& hp : peers) {
-    std::string host; int port;
-    if (!split_hostport(hp, &host, &port)) continue;
-    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) continue;
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = inet_addr(host.c_str());
-    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
-      ::send(fd, line.data(), (int)line.size(), 0);
-    }
-#if defined(_WIN32)
-    closesocket(fd);
-#else
-    ::close(fd);
-#endif
+  std::lock_guard<std::mutex> lk(peers_mu_);
+  for (const auto& hp : peers) addPeerLocked(hp);
+}
+
+PeerPool::Peer* PeerPool::findPeerLocked(const std::string& hp) const {
+  for (const auto& p : peers_) {
+    if (p->name == hp) return p.get();
+  }
+  return nullptr;
+}
+
+PeerPool::Peer* PeerPool::addPeerLocked(const std::string& hp) {
+  if (Peer* known = findPeerLocked(hp)) return known;
+  if (peers_.size() >= opts_.max_peers) return nullptr;
+  auto p = std::make_unique<Peer>();
+  try {
+    if (!split_hostport(hp, &p->host, &p->port)) return nullptr;
+  } catch (const std::exception&) {
+    return nullptr;
+  }
+  p->name = hp;
+  p->stats.peer = hp;
+  p->th = std::thread([this, peer = p.get()] { run(*peer); });
+  peers_.push_back(std::move(p));
+  return peers_.back().get();
+}
+
+void PeerPool::enqueue(Peer& p, const std::shared_ptr<const std::string>& framed,
+                       std::chrono::steady_clock::time_point now) {
+  std::lock_guard<std::mutex> lk(p.mu);
+  if (p.stopping) return;
+  if (p.queue.size() >= opts_.max_queue) {
+    p.queue.pop_front();
+    ++p.stats.dropped;
   }
+  p.queue.push_back({framed, now});
+  p.cv.notify_one();
+}
+
+PeerPool::~PeerPool() {
+  stop();
 #if defined(_WIN32)
   WSACleanup();
 #endif
 }
 
+void PeerPool::broadcast(std::string_view msg) {
+  auto framed = std::make_shared<const std::string>(frame_message(msg));
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lk(peers_mu_);
+  for (auto& p : peers_) enqueue(*p, framed, now);
+}
+
+bool PeerPool::addPeer(const std::string& peer) {
+  std::lock_guard<std::mutex> lk(peers_mu_);
+  return !stopped_ && addPeerLocked(peer);
+}
+
+bool PeerPool::sendTo(const std::string& peer, std::string_view msg) {
+  Peer* p;
+  {
+    std::lock_guard<std::mutex> lk(peers_mu_);
+    if (stopped_ || !(p = findPeerLocked(peer))) return false;
+  }
+  // peers are only removed by the destructor, so p stays valid
+  enqueue(*p, std::make_shared<const std::string>(frame_message(msg)), std::chrono::steady_clock::now());
+  return true;
+}
+
+bool PeerPool::flush(std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  bool all = true;
+  std::vector<Peer*> peers;
+  {
+    std::lock_guard<std::mutex> lk(peers_mu_);
+    for (auto& p : peers_) peers.push_back(p.get());
+  }
+  for (Peer* p : peers) {
+    std::unique_lock<std::mutex> lk(p->mu);
+    all &= p->drained.wait_until(lk, deadline, [&] { return p->queue.empty() && !p->in_flight; });
+  }
+  return all;
+}
+
+void PeerPool::stop() {
+  std::lock_guard<std::mutex> plk(peers_mu_);
+  stopped_ = true;
+  for (auto& p : peers_) {
+    std::lock_guard<std::mutex> lk(p->mu);
+    p->stopping = true;
+    // unblock a send stuck on a full socket buffer; the worker closes the fd
+    if (p->fd >= 0) ::shutdown(p->fd, 2);
+    p->cv.notify_all();
+  }
+  for (auto& p : peers_) {
+    if (p->th.joinable()) p->th.join();
+  }
+}
+
+std::vector<PeerStats> PeerPool::stats() const {
+  std::vector<PeerStats> out;
+  std::lock_guard<std::mutex> plk(peers_mu_);
+  for (const auto& p : peers_) {
+    std::lock_guard<std::mutex> lk(p->mu);
+    out.push_back(p->stats);
+    out.back().connected = p->fd >= 0;
+    out.back().queued = p->queue.size();
+  }
+  return out;
+}
+
+void PeerPool::run(Peer& p) {
+  auto backoff = opts_.min_backoff;
+  std::unique_lock<std::mutex> lk(p.mu);
+  while (true) {
+    p.cv.wait(lk, [&] { return p.stopping || !p.queue.empty(); });
+    if (p.stopping) break;
+
+    if (p.fd >= 0 && peer_hung_up(p.fd)) {
+      close_socket(p.fd);
+      p.fd = -1;
+    }
+    if (p.fd < 0) {
+      lk.unlock();
+      bool timed_out;
+      int fd = connect_to(p.host, p.port, opts_.connect_timeout, opts_.send_timeout, &timed_out);
+      lk.lock();
+      if (fd < 0) {
+        ++(timed_out ? p.stats.timeouts : p.stats.failures);
+        p.cv.wait_for(lk, backoff, [&] { return p.stopping; });
+        backoff = std::min(backoff * 2, opts_.max_backoff);
+        continue;
+      }
+      if (p.stopping) {
+        close_socket(fd);
+        break;
+      }
+      p.fd = fd;
+      ++p.stats.connects;
+      backoff = opts_.min_backoff;
+    }
+
+    // take the whole queue and write it as one buffer
+    std::vector<Peer::Item> batch(p.queue.begin(), p.queue.end());
+    p.queue.clear();
+    p.in_flight = batch.size();
+    int fd = p.fd;
+    lk.unlock();
+    std::string buf;
+    for (const auto& m : batch) buf += *m.framed;
+    bool timed_out;
+    std::size_t written;
+    bool ok = send_all(fd, buf.data(), buf.size(), &written, &timed_out);
+    auto done = std::chrono::steady_clock::now();
+    lk.lock();
+    p.in_flight = 0;
+    if (ok) {
+      p.stats.sent += batch.size();
+      // the oldest message waited longest: queueing, reconnects and the write
+      auto lat = std::chrono::duration_cast<std::chrono::microseconds>(done - batch.front().queued_at);
+      p.stats.last_latency = lat;
+      p.stats.max_latency = std::max(p.stats.max_latency, lat);
+    } else {
+      ++(timed_out ? p.stats.timeouts : p.stats.failures);
+      // frames the socket took whole count as sent; the receiver drops the
+      // partial one at EOF, so requeue from the frame the failure cut off
+      std::size_t whole = 0;
+      for (std::size_t end = 0; whole < batch.size(); ++whole) {
+        end += batch[whole].framed->size();
+        if (end > written) break;
+      }
+      p.stats.sent += whole;
+      close_socket(p.fd);
+      p.fd = -1;
+      for (std::size_t i = batch.size(); i > whole && p.queue.size() < opts_.max_queue; --i) {
+        p.queue.push_front(batch[i - 1]);
+      }
+    }
+    if (p.queue.empty()) p.drained.notify_all();
+  }
+  if (p.fd >= 0) close_socket(p.fd);
+  p.fd = -1;
+  p.drained.notify_all();
+}
+
 }  // namespace p2p
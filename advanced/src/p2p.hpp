@@ -5,30 +5,148 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 
 #pragma once
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
 namespace p2p {
 
-// Starts a background listener on host:port and calls on_message(json) for each line of input.
+struct ListenerStats {
+  std::uint64_t accepted{};   // connections accepted since start
+  std::uint64_t messages{};   // messages delivered to on_message
+  std::uint64_t dropped{};    // connections closed for an oversized message or a socket error
+  std::size_t open{};         // connections currently open
+};
+
+// Messages larger than this close the connection instead of growing its buffer.
+constexpr std::size_t kMaxMessageBytes = 32u << 20;
+
+// Wire framing: a 4-byte big-endian payload length, then the payload. A
+// length prefix starts with a byte below 0x04 (kMaxMessageBytes), which a
+// text line never does, so receivers tell framed connections from legacy
+// newline-delimited ones by their first byte.
+std::string frame_message(std::string_view payload);
+
+// Background listener on host:port that calls on_message(payload) for each
+// message from any peer: length-prefixed frames, or newline-terminated
+// lines from legacy peers (a final unterminated line is delivered when the
+// peer closes). On Linux one thread serves every peer from an
+// edge-triggered epoll loop over non-blocking sockets, so a slow peer only
+// holds its own buffer, and a busy one is read a bounded amount per pass
+// (messages are handed off as they complete, so a buffer never holds more
+// than one); stop() wakes the loop through an eventfd.
+// Elsewhere connections are served one at a time. on_message runs on the
+// listener thread.
 class Listener {
  public:
   Listener(const std::string& host, int port, std::function<void(std::string)> on_message);
   ~Listener();
-  void start();
+  Listener(const Listener&) = delete;
+  Listener& operator=(const Listener&) = delete;
+
+  // Binds and listens on the calling thread, then starts the loop. Port 0
+  // picks a free port (see port()). Returns false (with err) if the socket
+  // cannot be set up.
+  bool start(std::string* err = nullptr);
   void stop();
 
+  int port() const noexcept { return port_; }  // bound port once started
+  ListenerStats stats() const;
+
  private:
+  void run();
+  void deliver(std::string line);
+
   std::string host_;
   int port_;
   std::function<void(std::string)> on_message_;
   std::atomic<bool> running_{false};
   std::thread th_;
+  int listen_fd_ = -1;
+  int wake_fd_ = -1;  // eventfd (Linux only)
+  std::atomic<std::uint64_t> accepted_{0};
+  std::atomic<std::uint64_t> messages_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<std::size_t> open_{0};
+};
+
+struct PeerPoolOptions {
+  std::size_t max_peers = 64;    // each peer costs a thread and a queue
+  std::size_t max_queue = 1024;  // per peer; the oldest message is dropped beyond this
+  std::chrono::milliseconds min_backoff{100};  // reconnect delay, doubled per failure
+  std::chrono::milliseconds max_backoff{5000};
+  // Per-peer limits: an unreachable or stalled peer costs at most this much
+  // of its own worker's time and never delays the other peers.
+  std::chrono::milliseconds connect_timeout{2000};
+  std::chrono::milliseconds send_timeout{2000};
 };
 
-// Broadcast a line of text (json) to each peer host:port ("127.0.0.1:9002", ...)
-void broadcast(const std::vector<std::string>& peers, const std::string& line);
+struct PeerStats {
+  std::string peer;           // host:port
+  bool connected{};
+  std::uint64_t sent{};       // messages written to the socket
+  std::uint64_t dropped{};    // evicted from a full queue
+  std::uint64_t connects{};   // successful (re)connects
+  std::uint64_t timeouts{};   // connects or writes that ran out of time
+  std::uint64_t failures{};   // connects or writes refused or reset
+  std::size_t queued{};
+  // queued to written to the socket, for the oldest message of a write
+  std::chrono::microseconds last_latency{0};
+  std::chrono::microseconds max_latency{0};
+};
+
+// Persistent outbound connections, one per peer host:port. Each peer has its
+// own send queue and thread: messages are framed once, queued for every
+// peer, and written back to back over an open socket, so a message costs a
+// single write instead of a connect per send. A broken or refused
+// connection is retried with exponential backoff while messages queue up.
+// A failed write resends only from the message it cut off: messages the
+// socket took whole are not repeated, so each is written whole at least
+// once (while it stays queued). Being taken by the socket is not receipt, so
+// one can still be lost with the connection; messages must be safe to repeat
+// or miss (blocks and txs are deduplicated by hash and refetched).
+class PeerPool {
+ public:
+  explicit PeerPool(const std::vector<std::string>& peers, PeerPoolOptions opts = {});
+  ~PeerPool();
+  PeerPool(const PeerPool&) = delete;
+  PeerPool& operator=(const PeerPool&) = delete;
+
+  // Add a configured peer (host:port). False if it does not parse, the pool
+  // is full (max_peers) or stopped. Adding a pooled peer again is a no-op.
+  bool addPeer(const std::string& peer);
+  // Queue msg for every pooled peer; never blocks on the network.
+  void broadcast(std::string_view msg);
+  // Queue msg for one pooled peer. The sender address a message claims is
+  // not authenticated, so replies go only to peers configured here: false
+  // (nothing sent) for any other address, or if the pool is stopped.
+  bool sendTo(const std::string& peer, std::string_view msg);
+  // Wait until every queue is empty (or timeout); true if all were drained.
+  bool flush(std::chrono::milliseconds timeout);
+  // Close connections; anything still queued is discarded. A worker inside
+  // a connect finishes it first, so this can take up to connect_timeout.
+  void stop();
+  std::vector<PeerStats> stats() const;
+
+ private:
+  struct Peer;
+  Peer* findPeerLocked(const std::string& hp) const;
+  Peer* addPeerLocked(const std::string& hp);
+  void enqueue(Peer& p, const std::shared_ptr<const std::string>& framed,
+               std::chrono::steady_clock::time_point now);
+  void run(Peer& p);
+
+  PeerPoolOptions opts_;
+  mutable std::mutex peers_mu_;  // guards peers_ (workers only touch their own Peer)
+  std::vector<std::unique_ptr<Peer>> peers_;
+  bool stopped_ = false;
+};
 
 }  // namespace p2p
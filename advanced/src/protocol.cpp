@@ -0,0 +1,116 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "protocol.hpp"
+#include "crypto.hpp"
+#include "merkle.hpp"
+
+#include <stdexcept>
+#include <unordered_map>
+
+namespace sbc {
+
+namespace {
+
+constexpr std::size_t kShortIdHex = 12;  // 48 bits
+constexpr std::size_t kShortIdBytes = 6;
+constexpr std::uint64_t kAmbiguous = ~0ull;
+
+}  // namespace
+
+std::uint64_t short_txid(std::string_view block_hash, std::string_view txid) {
+  std::string salted;
+  salted.reserve(block_hash.size() + txid.size());
+  salted.append(block_hash).append(txid);
+  return std::stoull(crypto::sha256(salted).substr(0, kShortIdHex), nullptr, 16);
+}
+
+CompactBlock make_compact_block(const Block& b) {
+  CompactBlock cb;
+  cb.header = b;
+  cb.header.transactions.clear();
+  for (std::size_t i = 0; i < b.transactions.size(); ++i) {
+    const Tx& tx = b.transactions[i];
+    if (tx.from_pubkey_pem.empty()) cb.prefilled.emplace_back(i, tx);  // coinbase
+    else cb.short_ids.push_back(short_txid(b.hash, tx.hash()));
+  }
+  return cb;
+}
+
+void CompactBlock::write(WireWriter& w) const {
+  w.block(header);
+  w.u64(short_ids.size());
+  char id[kShortIdBytes];
+  for (std::uint64_t v : short_ids) {
+    for (std::size_t i = 0; i < kShortIdBytes; ++i) id[i] = (char)(v >> (8 * i));
+    w.bytes(std::string_view(id, kShortIdBytes));
+  }
+  std::vector<Tx> txs;
+  w.u64(prefilled.size());
+  for (const auto& p : prefilled) {
+    w.u64(p.first);
+    txs.push_back(p.second);
+  }
+  w.txs(txs);
+}
+
+CompactBlock CompactBlock::read(WireReader& r) {
+  CompactBlock cb;
+  cb.header = r.block();
+  cb.header.transactions.clear();
+  std::uint64_t n = r.count(kMaxTxsPerMessage);
+  cb.short_ids.reserve(n);
+  for (std::uint64_t k = 0; k < n; ++k) {
+    auto id = r.bytes(kShortIdBytes);
+    std::uint64_t v = 0;
+    for (std::size_t i = 0; i < kShortIdBytes; ++i) v |= (std::uint64_t)(std::uint8_t)id[i] << (8 * i);
+    cb.short_ids.push_back(v);
+  }
+  std::uint64_t npre = r.count(kMaxTxsPerMessage);
+  std::vector<std::size_t> pos;
+  for (std::uint64_t k = 0; k < npre; ++k) {
+    std::size_t i = r.u64();
+    if ((!pos.empty() && i <= pos.back()) || i >= n + npre) throw std::runtime_error("compact block: bad prefilled index");
+    pos.push_back(i);
+  }
+  std::vector<Tx> txs = r.txs();
+  if (txs.size() != npre) throw std::runtime_error("compact block: bad prefilled txs");
+  for (std::uint64_t k = 0; k < npre; ++k) cb.prefilled.emplace_back(pos[k], std::move(txs[k]));
+  return cb;
+}
+
+bool reconstruct_block(const CompactBlock& cb, const std::vector<Tx>& mempool, Block* out,
+                       std::vector<std::size_t>* missing) {
+  std::unordered_map<std::uint64_t, std::size_t> by_id;  // short id -> mempool index
+  by_id.reserve(mempool.size());
+  for (std::size_t i = 0; i < mempool.size(); ++i) {
+    auto r = by_id.emplace(short_txid(cb.header.hash, mempool[i].hash()), i);
+    if (!r.second) r.first->second = kAmbiguous;
+  }
+
+  *out = cb.header;
+  out->transactions.assign(cb.txCount(), Tx{});
+  missing->clear();
+  std::size_t next_short = 0, next_pre = 0;
+  for (std::size_t pos = 0; pos < cb.txCount(); ++pos) {
+    if (next_pre < cb.prefilled.size() && cb.prefilled[next_pre].first == pos) {
+      out->transactions[pos] = cb.prefilled[next_pre++].second;
+      continue;
+    }
+    auto it = by_id.find(cb.short_ids[next_short++]);
+    if (it == by_id.end() || it->second == kAmbiguous) missing->push_back(pos);
+    else out->transactions[pos] = mempool[it->second];
+  }
+  return missing->empty();
+}
+
+bool block_merkle_matches(const Block& b) {
+  std::vector<std::string> txids;
+  txids.reserve(b.transactions.size());
+  for (const auto& t : b.transactions) txids.push_back(t.hash());
+  return merkle::merkle_root(txids) == b.merkle_root;
+}
+
+}  // namespace sbc
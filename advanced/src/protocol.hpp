@@ -0,0 +1,52 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "block.hpp"
+#include "wire.hpp"
+
+namespace sbc {
+
+// Compact block: the header plus a 48-bit short id per transaction instead
+// of the transaction itself. Short ids are salted with the block hash, so a
+// collision in one block says nothing about the next. The coinbase (which no
+// mempool holds) travels in full as a prefilled transaction.
+struct CompactBlock {
+  Block header;                                 // transactions empty
+  std::vector<std::uint64_t> short_ids;         // non-prefilled txs, block order
+  std::vector<std::pair<std::size_t, Tx>> prefilled;  // (block position, tx), ascending
+
+  std::size_t txCount() const { return short_ids.size() + prefilled.size(); }
+
+  // block header, varint count, 6 bytes per short id (little-endian),
+  // varint count, varint position..., txs (the prefilled ones)
+  void write(WireWriter& w) const;
+  static CompactBlock read(WireReader& r);  // throws on malformed input
+};
+
+// Upper bound on transactions per block accepted from a peer.
+constexpr std::uint64_t kMaxTxsPerMessage = 1u << 20;
+
+std::uint64_t short_txid(std::string_view block_hash, std::string_view txid);
+
+CompactBlock make_compact_block(const Block& b);
+
+// Rebuild b's transactions from the prefilled ones and a mempool. Positions
+// no mempool tx matches, or that match more than one, are left empty and
+// listed in *missing (ascending). Returns true when nothing is missing; the
+// caller still has to check the Merkle root, since a short id can collide.
+bool reconstruct_block(const CompactBlock& cb, const std::vector<Tx>& mempool, Block* out,
+                       std::vector<std::size_t>* missing);
+
+// Merkle root over b.transactions matches b.merkle_root.
+bool block_merkle_matches(const Block& b);
+
+}  // namespace sbc
@@ -0,0 +1,171 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "relay.hpp"
+
+namespace sbc {
+
+BlockRelay::BlockRelay(Node& node, SendFn send, AcceptedFn on_accepted)
+    : node_(node), send_(std::move(send)), on_accepted_(std::move(on_accepted)) {}
+
+void BlockRelay::setSelfAddress(std::string addr) {
+  std::lock_guard<std::mutex> lk(mu_);
+  self_ = std::move(addr);
+}
+
+void BlockRelay::setGapHandler(GapFn on_gap) {
+  std::lock_guard<std::mutex> lk(mu_);
+  on_gap_ = std::move(on_gap);
+}
+
+std::string BlockRelay::announce(const Block& b) const {
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    self = self_;
+  }
+  WireWriter w(MsgType::CmpctBlock, self);
+  make_compact_block(b).write(w);
+  return w.finish();
+}
+
+RelayStats BlockRelay::stats() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return stats_;
+}
+
+bool BlockRelay::handle(WireReader& msg) {
+  try {
+    switch (msg.type()) {
+      case MsgType::NewBlock: submit(msg.block(), ""); break;
+      case MsgType::CmpctBlock: onCompact(msg); break;
+      case MsgType::BlockTxn: onBlockTxn(msg); break;
+      case MsgType::GetBlockTxn: onGetBlockTxn(msg); break;
+      case MsgType::GetBlock: onGetBlock(msg); break;
+      default: return false;
+    }
+  } catch (const std::exception&) {
+    // malformed peer message: drop it
+  }
+  return true;
+}
+
+void BlockRelay::submit(const Block& b, const std::string& from) {
+  if (node_.submitBlock(b)) {
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      ++stats_.accepted;
+    }
+    if (on_accepted_) on_accepted_(b);
+  } else if (!from.empty() && !block_merkle_matches(b)) {
+    requestFull(from, b.hash);  // a short id matched the wrong tx
+  }
+}
+
+void BlockRelay::requestFull(const std::string& from, const std::string& hash) {
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    ++stats_.full_fallbacks;
+    self = self_;
+  }
+  send_(from, WireWriter(MsgType::GetBlock, self).hex(hash).finish());
+}
+
+void BlockRelay::onCompact(WireReader& msg) {
+  CompactBlock cb = CompactBlock::read(msg);
+  const std::string& from = msg.from();
+  // cheap header checks before spending anything on the body
+  if (!header_is_valid(cb.header)) return;
+  if (node_.findBlock(cb.header.hash)) return;
+  auto snap = node_.snapshot();
+  if (cb.header.index > snap->height() + 1 || cb.header.prev_hash != snap->tip().hash) {
+    GapFn on_gap;
+    {
+      std::lock_guard<std::mutex> lk(mu_);
+      on_gap = on_gap_;
+    }
+    if (on_gap && !from.empty()) on_gap(from);
+    return;
+  }
+
+  Block b;
+  std::vector<std::size_t> missing;
+  bool complete = reconstruct_block(cb, node_.pendingTxs(), &b, &missing);
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    ++stats_.compact_received;
+    if (complete) {
+      ++stats_.reconstructed;
+    } else if (!from.empty()) {
+      if (!partial_.count(b.hash)) partial_order_.push_back(b.hash);
+      partial_[b.hash] = Partial{b, missing, from};
+      while (partial_order_.size() > kMaxPartial) {
+        partial_.erase(partial_order_.front());
+        partial_order_.pop_front();
+      }
+      ++stats_.round_trips;
+      stats_.txs_requested += missing.size();
+    }
+    self = self_;
+  }
+  if (complete) {
+    submit(b, from);
+  } else if (!from.empty()) {
+    WireWriter w(MsgType::GetBlockTxn, self);
+    w.hex(b.hash).u64(missing.size());
+    for (std::size_t i : missing) w.u64(i);
+    send_(from, w.finish());
+  }
+}
+
+void BlockRelay::onBlockTxn(WireReader& msg) {
+  std::string hash = msg.hex();
+  std::vector<Tx> txs = msg.txs();
+  Partial p;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = partial_.find(hash);
+    if (it == partial_.end()) return;  // unknown or evicted
+    if (txs.size() != it->second.missing.size()) return;
+    p = std::move(it->second);
+    partial_.erase(it);
+  }
+  for (std::size_t i = 0; i < txs.size(); ++i) p.block.transactions[p.missing[i]] = std::move(txs[i]);
+  submit(p.block, p.from);
+}
+
+void BlockRelay::onGetBlockTxn(WireReader& msg) {
+  auto b = node_.findBlock(msg.hex());
+  if (!b || b->pruned) return;
+  std::uint64_t n = msg.count(b->transactions.size());
+  std::vector<Tx> txs;
+  txs.reserve(n);
+  for (std::uint64_t k = 0; k < n; ++k) {
+    std::uint64_t pos = msg.u64();
+    if (pos >= b->transactions.size()) return;
+    txs.push_back(b->transactions[pos]);
+  }
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    self = self_;
+  }
+  send_(msg.from(), WireWriter(MsgType::BlockTxn, self).hex(b->hash).txs(txs).finish());
+}
+
+void BlockRelay::onGetBlock(WireReader& msg) {
+  auto b = node_.findBlock(msg.hex());
+  if (!b || b->pruned) return;
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    self = self_;
+  }
+  send_(msg.from(), WireWriter(MsgType::NewBlock, self).block(*b).finish());
+}
+
+}  // namespace sbc
@@ -0,0 +1,92 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "node.hpp"
+#include "protocol.hpp"
+#include "wire.hpp"
+
+namespace sbc {
+
+struct RelayStats {
+  std::uint64_t compact_received{};
+  std::uint64_t reconstructed{};    // rebuilt from the mempool alone
+  std::uint64_t round_trips{};      // needed a GETBLOCKTXN first
+  std::uint64_t txs_requested{};
+  std::uint64_t full_fallbacks{};   // fell back to fetching the full block
+  std::uint64_t accepted{};         // blocks submitted to the node successfully
+};
+
+// Block relay between nodes. Mined blocks are announced as CMPCTBLOCK
+// (header, short tx ids, coinbase); the receiver rebuilds the body from its
+// mempool and asks the announcing peer only for what it lacks:
+//
+//   CMPCTBLOCK  {block, short_ids, prefilled}  -> rebuild, or
+//   GETBLOCKTXN {hash, indexes}                -> BLOCKTXN {hash, txs}
+//   GETBLOCK    {hash}                         -> NEWBLOCK {block}
+//
+// GETBLOCK is the fallback when a rebuilt block fails its Merkle check
+// (short id collision). Replies go to the message's sender address through
+// send(peer, msg). Thread-safe; send is never called with the
+// relay's lock held, so it may deliver synchronously.
+class BlockRelay {
+ public:
+  using SendFn = std::function<void(const std::string& peer, const std::string& msg)>;
+  using AcceptedFn = std::function<void(const Block&)>;
+  using GapFn = std::function<void(const std::string& peer)>;
+
+  BlockRelay(Node& node, SendFn send, AcceptedFn on_accepted = {});
+
+  void setSelfAddress(std::string addr);  // "host:port" peers reply to
+  // Called instead of rebuilding when a peer announces a block that does not
+  // build on our tip: we are behind it, or it is on another branch (see
+  // ChainSync::peerAhead).
+  void setGapHandler(GapFn on_gap);
+
+  // Message announcing a block we mined or accepted.
+  std::string announce(const Block& b) const;
+
+  // Handle a peer message. Returns false if its type is not a relay message
+  // (so another handler can try it); malformed relay messages are dropped
+  // and still return true.
+  bool handle(WireReader& msg);
+
+  RelayStats stats() const;
+
+  static constexpr std::size_t kMaxPartial = 16;  // blocks awaiting BLOCKTXN
+
+ private:
+  struct Partial {
+    Block block;
+    std::vector<std::size_t> missing;
+    std::string from;
+  };
+  void onCompact(WireReader& msg);
+  void onBlockTxn(WireReader& msg);
+  void onGetBlockTxn(WireReader& msg);
+  void onGetBlock(WireReader& msg);
+  void submit(const Block& b, const std::string& from);
+  void requestFull(const std::string& from, const std::string& hash);
+
+  Node& node_;
+  SendFn send_;
+  AcceptedFn on_accepted_;
+  GapFn on_gap_;
+  mutable std::mutex mu_;
+  std::string self_;
+  std::unordered_map<std::string, Partial> partial_;  // by block hash
+  std::deque<std::string> partial_order_;             // oldest first, for eviction
+  RelayStats stats_;
+};
+
+}  // namespace sbc
@@ -0,0 +1,95 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "snapshot.hpp"
+
+#include <algorithm>
+
+namespace sbc {
+
+BlockList::BlockList(const BlockList& o) : segs_(o.segs_), size_(o.size_), tail_shared_(true) {
+  o.tail_shared_ = true;
+}
+
+BlockList& BlockList::operator=(const BlockList& o) {
+  if (this != &o) {
+    segs_ = o.segs_;
+    size_ = o.size_;
+    tail_shared_ = true;
+    o.tail_shared_ = true;
+  }
+  return *this;
+}
+
+void BlockList::push_back(Block b) {
+  if (segs_.empty() || segs_.back()->size() == kSegment) {
+    segs_.push_back(std::make_shared<Segment>());
+    segs_.back()->reserve(kSegment);
+  } else if (tail_shared_) {
+    // Tail is shared with a published snapshot: copy-on-write.
+    auto copy = std::make_shared<Segment>();
+    copy->reserve(kSegment);
+    copy->assign(segs_.back()->begin(), segs_.back()->end());
+    segs_.back() = std::move(copy);
+  }
+  tail_shared_ = false;
+  segs_.back()->push_back(std::make_shared<const Block>(std::move(b)));
+  ++size_;
+}
+
+void BlockList::truncate(std::size_t n) {
+  if (n >= size_) return;
+  segs_.resize((n + kSegment - 1) / kSegment);
+  if (n % kSegment) {
+    auto copy = std::make_shared<Segment>();
+    copy->reserve(kSegment);
+    copy->assign(segs_.back()->begin(), segs_.back()->begin() + n % kSegment);
+    segs_.back() = std::move(copy);
+  }
+  size_ = n;
+  tail_shared_ = false;
+}
+
+void BlockList::pruneBodies(std::size_t from, std::size_t to) {
+  to = std::min(to, size_);
+  for (std::size_t s = from / kSegment; s * kSegment < to; ++s) {
+    const Segment& old = *segs_[s];
+    const std::size_t lo = std::max(from, s * kSegment) % kSegment;
+    const std::size_t hi = std::min(to - s * kSegment, old.size());
+    bool any = false;
+    for (std::size_t i = lo; i < hi && !any; ++i) any = !old[i]->pruned;
+    if (!any) continue;
+    auto copy = std::make_shared<Segment>();
+    copy->reserve(kSegment);
+    copy->assign(old.begin(), old.end());
+    for (std::size_t i = lo; i < hi; ++i) {
+      if (!(*copy)[i]->pruned) (*copy)[i] = std::make_shared<const Block>((*copy)[i]->header_only());
+    }
+    segs_[s] = std::move(copy);
+    if (s + 1 == segs_.size()) tail_shared_ = false;
+  }
+}
+
+std::shared_ptr<const Block> load_full_block(const BlockList& blocks, const BodyLoader& load,
+                                             std::uint64_t h) {
+  if (h >= blocks.size()) return nullptr;
+  const auto& b = blocks.ptr(h);
+  if (!b->pruned) return b;
+  Block full;
+  if (!load || !load(h, &full) || full.pruned || full.hash != b->hash) return nullptr;
+  return std::make_shared<const Block>(std::move(full));
+}
+
+std::int64_t ChainSnapshot::balanceOf(const std::string& addr) const {
+  auto it = state->balance.find(addr);
+  return it == state->balance.end() ? 0 : it->second;
+}
+
+std::uint64_t ChainSnapshot::nonceOf(const std::string& addr) const {
+  auto it = state->nonce.find(addr);
+  return it == state->nonce.end() ? 0 : it->second;
+}
+
+}  // namespace sbc
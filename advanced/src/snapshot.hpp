@@ -0,0 +1,115 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "block.hpp"
+#include "state.hpp"
+
+namespace sbc {
+
+// Append-only list of immutable blocks stored in fixed-size segments.
+// Copying a BlockList shares every segment, so a copy costs O(n / kSegment)
+// pointer copies; the writer copies a segment only when appending to one that
+// a snapshot still references. Readers of a copy never see later appends.
+class BlockList {
+ public:
+  static constexpr std::size_t kSegment = 1024;
+
+  class const_iterator {
+   public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Block;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Block*;
+    using reference = const Block&;
+
+    const_iterator(const BlockList* l, std::size_t i) : l_(l), i_(i) {}
+    reference operator*() const { return (*l_)[i_]; }
+    pointer operator->() const { return &(*l_)[i_]; }
+    const_iterator& operator++() { ++i_; return *this; }
+    const_iterator operator++(int) { auto t = *this; ++i_; return t; }
+    difference_type operator-(const const_iterator& o) const {
+      return (difference_type)i_ - (difference_type)o.i_;
+    }
+    bool operator==(const const_iterator& o) const { return i_ == o.i_; }
+    bool operator!=(const const_iterator& o) const { return i_ != o.i_; }
+
+   private:
+    const BlockList* l_;
+    std::size_t i_;
+  };
+
+  BlockList() = default;
+  BlockList(const BlockList& o);
+  BlockList& operator=(const BlockList& o);
+  BlockList(BlockList&&) noexcept = default;
+  BlockList& operator=(BlockList&&) noexcept = default;
+
+  std::size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  const Block& operator[](std::size_t i) const { return *ptr(i); }
+  const std::shared_ptr<const Block>& ptr(std::size_t i) const { return segs_[i / kSegment]->at(i % kSegment); }
+  const Block& front() const { return (*this)[0]; }
+  const Block& back() const { return (*this)[size_ - 1]; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, size_}; }
+
+  void push_back(Block b);
+  // Replace blocks [from, to) with header-only copies. Touched segments are
+  // copied first, so snapshots holding them keep the full bodies.
+  void pruneBodies(std::size_t from, std::size_t to);
+  // Drop blocks from height n on. A tail segment a copy still holds is
+  // copied first.
+  void truncate(std::size_t n);
+  void clear() { segs_.clear(); size_ = 0; tail_shared_ = false; }
+
+ private:
+  using Segment = std::vector<std::shared_ptr<const Block>>;
+  std::vector<std::shared_ptr<Segment>> segs_;
+  std::size_t size_ = 0;
+  // Set whenever the tail segment has been handed to a copy; the next append
+  // then copies the tail instead of mutating storage a reader may be using.
+  mutable bool tail_shared_ = false;
+};
+
+// Reads the full block at a height back from where bodies that are not kept
+// in memory live (the block log). False if the stored record cannot be read;
+// a header-only block if there is no body for that height. Thread-safe.
+using BodyLoader = std::function<bool(std::uint64_t height, Block* out)>;
+
+// Block h with its transactions: the resident copy if it has them, else one
+// read through load and checked against the header's hash. nullptr if h is
+// out of range or the body is gone.
+std::shared_ptr<const Block> load_full_block(const BlockList& blocks, const BodyLoader& load,
+                                             std::uint64_t h);
+
+// Immutable view of the chain and account state at one height. Published by
+// the writer after every commit; any number of readers may hold one.
+struct ChainSnapshot {
+  BlockList blocks;
+  std::shared_ptr<const AccountState> state;
+  int difficulty{};
+  std::uint64_t work{};  // sum of block_work over the blocks
+  BodyLoader load_body;  // for blocks held header-only (may be empty)
+
+  std::uint64_t height() const { return blocks.size() - 1; }
+  const Block& tip() const { return blocks.back(); }
+  const Block* blockAt(std::uint64_t h) const { return h < blocks.size() ? &blocks[h] : nullptr; }
+  // Full block h (see load_full_block); may read from disk.
+  std::shared_ptr<const Block> body(std::uint64_t h) const { return load_full_block(blocks, load_body, h); }
+  std::int64_t balanceOf(const std::string& addr) const;
+  std::uint64_t nonceOf(const std::string& addr) const;
+  // The account table as of the tip, shared rather than copied.
+  StateSnapshot stateAtTip() const { return {height(), tip().hash, state}; }
+};
+
+}  // namespace sbc
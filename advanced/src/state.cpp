@@ -8,8 +8,8 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 
 namespace sbc {
 
-bool StateMachine::verifySignature(const Tx& tx) const {
-  if (tx.from_pubkey_pem.empty()) return true;  # noqa
+bool StateMachine::verifySignature(const Tx& tx) {
+  if (tx.from_pubkey_pem.empty()) return true;
   // from address must match pubkey-derived address for non-coinbase
   if (Tx::addr_from_pubkey(tx.from_pubkey_pem) != tx.to_addr && tx.amount == 0) {
     // no specific rule here; allow 0-amount? keep simple
@@ -17,21 +17,39 @@ bool StateMachine::verifySignature(const Tx& tx) const {
   return crypto::ecdsa_verify_p256(tx.from_pubkey_pem, tx.message(), tx.signature_hex);
 }
 
-ApplyResult StateMachine::applyTx(const Tx& tx) {
+bool SigCache::verify(const Tx& tx) {
+  if (tx.from_pubkey_pem.empty()) return true;
+  std::string id = tx.hash();
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (cur_.count(id) || old_.count(id)) return true;
+  }
+  checks_.fetch_add(1, std::memory_order_relaxed);
+  if (!StateMachine::verifySignature(tx)) return false;
+  std::lock_guard<std::mutex> lk(mu_);
+  if (cur_.size() >= per_generation_) {
+    old_ = std::move(cur_);
+    cur_.clear();
+  }
+  cur_.insert(std::move(id));
+  return true;
+}
+
+ApplyResult StateMachine::applyTx(const Tx& tx, bool check_signature) {
   if (tx.from_pubkey_pem.empty()) {
     return {false, "coinbase must be applied via applyCoinbase"};
   }
-  if (!verifySignature(tx)) {
+  if (check_signature && !verifySignature(tx)) {
     return {false, "invalid signature"};
   }
   auto sender = Tx::addr_from_pubkey(tx.from_pubkey_pem);
   auto& n = st_.nonce[sender];
   if (tx.nonce != n + 1) {
-    return {false, "bad nonce"};
+    return {false, "bad nonce", tx.nonce > n + 1};
   }
   auto& sbal = st_.balance[sender];
   if (sbal < (std::int64_t)tx.amount) {
-    return {false, "insufficient funds"};
+    return {false, "insufficient funds", true};
   }
   sbal -= (std::int64_t)tx.amount;
   st_.balance[tx.to_addr] += (std::int64_t)tx.amount;
@@ -43,4 +61,11 @@ void StateMachine::applyCoinbase(const std::string& miner_addr) {
   st_.balance[miner_addr] += reward_;
 }
 
+ApplyResult StateMachine::applyCoinbaseTx(const Tx& tx) {
+  if (!tx.from_pubkey_pem.empty()) return {false, "not a coinbase"};
+  if ((std::int64_t)tx.amount != reward_) return {false, "bad coinbase amount"};
+  applyCoinbase(tx.to_addr);
+  return {true, ""};
+}
+
 }  // namespace sbc
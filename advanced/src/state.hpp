@@ -4,22 +4,40 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 */
 
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
+#include "cowmap.hpp"
 #include "tx.hpp"
 
 namespace sbc {
 
+// Copies share structure (see CowMap), so snapshots, block templates and
+// trial applies copy the table in O(1) and pay only for what they change.
 struct AccountState {
-  std::unordered_map<std::string, std::int64_t> balance;  // can go negative in invalid cases
-  std::unordered_map<std::string, std::uint64_t> nonce;   // last accepted nonce per address
+  CowMap<std::int64_t> balance;  // can go negative in invalid cases
+  CowMap<std::uint64_t> nonce;   // last accepted nonce per address
+};
+
+// Account state as of one block. Replay can start from it instead of genesis,
+// and once block bodies are pruned it is the only record of older history.
+struct StateSnapshot {
+  std::uint64_t height{};
+  std::string block_hash;
+  std::shared_ptr<const AccountState> accounts;
 };
 
 struct ApplyResult {
   bool ok;
   std::string error;
+  // Failed only against this state (nonce ahead of the sender's, balance not
+  // yet funded): the tx may still apply once earlier txs land.
+  bool retry_later = false;
 };
 
 class StateMachine {
@@ -27,18 +45,44 @@ class StateMachine {
   explicit StateMachine(std::int64_t coinbase_reward = 50) : reward_(coinbase_reward) {}
   const AccountState& state() const { return st_; }
 
-  // Verify and apply a transaction (no signature check for coinbase)
-  ApplyResult applyTx(const Tx& tx);
+  std::int64_t reward() const noexcept { return reward_; }
+  // Replace the account table wholesale (loading a StateSnapshot).
+  void restore(AccountState st) { st_ = std::move(st); }
+
+  // Verify and apply a transaction (no signature check for coinbase).
+  // check_signature=false is for replay paths that verified signatures up front.
+  ApplyResult applyTx(const Tx& tx, bool check_signature = true);
 
   // Apply coinbase to miner address
   void applyCoinbase(const std::string& miner_addr);
+  // Apply a recorded coinbase tx (empty sender, amount must equal the reward)
+  ApplyResult applyCoinbaseTx(const Tx& tx);
 
- private:
-  bool verifySignature(const Tx& tx) const;
+  // Stateless; safe to call from many threads at once.
+  static bool verifySignature(const Tx& tx);
 
  private:
   AccountState st_;
   std::int64_t reward_;
 };
 
+// Ids of txs whose signatures verified (the id covers the signature), so a
+// tx waiting in the mempool is checked once, not on every template. Keeps
+// two generations of up to `per_generation` ids, so memory stays bounded.
+// Thread-safe; the ECDSA check itself runs outside the lock.
+class SigCache {
+ public:
+  explicit SigCache(std::size_t per_generation = 100000) : per_generation_(per_generation) {}
+
+  // StateMachine::verifySignature(tx), skipped if this id already passed.
+  bool verify(const Tx& tx);
+  std::uint64_t checks() const noexcept { return checks_.load(std::memory_order_relaxed); }
+
+ private:
+  std::size_t per_generation_;
+  std::mutex mu_;
+  std::unordered_set<std::string> cur_, old_;
+  std::atomic<std::uint64_t> checks_{0};  // signatures actually verified
+};
+
 }  // namespace sbc
@@ -0,0 +1,188 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "statefile.hpp"
+#include "storage.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+namespace sbc {
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'B', 'C', 'S', 'T', 'A', 'T', 'E'};
+constexpr std::uint32_t kVersion = 2;
+constexpr std::size_t kHeaderBytes = 72;
+constexpr std::size_t kValueBytes = 8 + 8;  // balance, nonce
+constexpr std::size_t kHashBytes = 32;
+// version 1: fixed entries of a zero-padded 40-byte address + values
+constexpr std::uint32_t kVersionFixed = 1;
+constexpr std::size_t kFixedAddrBytes = 40;
+constexpr std::size_t kFixedEntryBytes = kFixedAddrBytes + kValueBytes;
+
+void put_u32(char* p, std::uint32_t v) {
+  for (int i = 0; i < 4; ++i) p[i] = (char)((v >> (8 * i)) & 0xff);
+}
+void put_u64(char* p, std::uint64_t v) {
+  for (int i = 0; i < 8; ++i) p[i] = (char)((v >> (8 * i)) & 0xff);
+}
+std::uint32_t get_u32(const char* p) {
+  std::uint32_t v = 0;
+  for (int i = 3; i >= 0; --i) v = (v << 8) | (unsigned char)p[i];
+  return v;
+}
+std::uint64_t get_u64(const char* p) {
+  std::uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) v = (v << 8) | (unsigned char)p[i];
+  return v;
+}
+
+int hex_val(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+}  // namespace
+
+bool save_state_snapshot(const std::string& path, const StateSnapshot& snap, std::string* err) {
+  auto fail = [&](const char* why) {
+    if (err) *err = why;
+    return false;
+  };
+  if (!snap.accounts) return fail("empty snapshot");
+  if (snap.block_hash.size() != 2 * kHashBytes) return fail("block hash is not a sha256 hex digest");
+  const AccountState& st = *snap.accounts;
+
+  // every address with a balance or a nonce, in byte order
+  std::vector<const std::string*> addrs;
+  addrs.reserve(st.balance.size());
+  for (const auto& kv : st.balance) addrs.push_back(&kv.first);
+  for (const auto& kv : st.nonce) {
+    if (!st.balance.count(kv.first)) addrs.push_back(&kv.first);
+  }
+  std::sort(addrs.begin(), addrs.end(), [](auto* a, auto* b) { return *a < *b; });
+
+  std::size_t bytes = kHeaderBytes;
+  for (const std::string* a : addrs) bytes += 4 + a->size() + kValueBytes;
+  std::string out(bytes, '\0');
+  char* e = &out[kHeaderBytes];
+  for (const std::string* a : addrs) {
+    if (a->size() > std::numeric_limits<std::uint32_t>::max()) return fail("address too long");
+    auto b = st.balance.find(*a);
+    auto n = st.nonce.find(*a);
+    put_u32(e, (std::uint32_t)a->size());
+    std::memcpy(e + 4, a->data(), a->size());
+    e += 4 + a->size();
+    put_u64(e, (std::uint64_t)(b == st.balance.end() ? 0 : b->second));
+    put_u64(e + 8, n == st.nonce.end() ? 0 : n->second);
+    e += kValueBytes;
+  }
+
+  char* h = &out[0];
+  std::memcpy(h, kMagic, sizeof(kMagic));
+  put_u32(h + 8, kVersion);
+  put_u32(h + 12, 0);  // entry size: variable
+  put_u64(h + 16, snap.height);
+  for (std::size_t i = 0; i < kHashBytes; ++i) {
+    int hi = hex_val(snap.block_hash[2 * i]), lo = hex_val(snap.block_hash[2 * i + 1]);
+    if (hi < 0 || lo < 0) return fail("block hash is not a sha256 hex digest");
+    h[24 + i] = (char)((hi << 4) | lo);
+  }
+  put_u64(h + 56, addrs.size());
+  put_u32(h + 64, storage::crc32(std::string_view(out).substr(kHeaderBytes)));
+  return storage::save_file_atomically(path, out, err);
+}
+
+bool load_state_snapshot(const std::string& path, StateSnapshot* out, std::string* err) {
+  auto fail = [&](const char* why) {
+    if (err) *err = why;
+    return false;
+  };
+  storage::MappedFile file;
+  if (!file.open(path, err)) return false;
+  std::string_view data = file.data();
+  if (data.size() < kHeaderBytes || std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+    return fail("not a state snapshot");
+  }
+  const char* h = data.data();
+  const std::uint32_t version = get_u32(h + 8);
+  if (version != kVersion && version != kVersionFixed) return fail("unsupported state snapshot version");
+  if (get_u32(h + 12) != (version == kVersionFixed ? kFixedEntryBytes : 0)) {
+    return fail("unexpected state snapshot entry size");
+  }
+  const std::uint64_t count = get_u64(h + 56);
+  std::string_view entries = data.substr(kHeaderBytes);
+  const std::size_t min_entry = version == kVersionFixed ? kFixedEntryBytes : 4 + kValueBytes;
+  if (count > entries.size() / min_entry ||
+      (version == kVersionFixed && count * kFixedEntryBytes != entries.size())) {
+    return fail("truncated state snapshot");
+  }
+  if (storage::crc32(entries) != get_u32(h + 64)) return fail("state snapshot checksum mismatch");
+
+  std::vector<std::pair<std::string, std::int64_t>> balances;
+  std::vector<std::pair<std::string, std::uint64_t>> nonces;
+  balances.reserve(count);
+  std::size_t pos = 0;
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::string addr;
+    if (version == kVersionFixed) {
+      const char* e = entries.data() + pos;
+      addr.assign(e, strnlen(e, kFixedAddrBytes));
+      pos += kFixedAddrBytes;
+    } else {
+      if (entries.size() - pos < 4) return fail("truncated state snapshot");
+      const std::uint32_t len = get_u32(entries.data() + pos);
+      if (entries.size() - pos - 4 < (std::uint64_t)len + kValueBytes) return fail("truncated state snapshot");
+      addr.assign(entries.data() + pos + 4, len);
+      pos += 4 + len;
+    }
+    const char* v = entries.data() + pos;
+    pos += kValueBytes;
+    // strictly increasing addresses keep the keys distinct for CowMap::build
+    if (!balances.empty() && !(balances.back().first < addr)) return fail("unsorted state snapshot");
+    std::uint64_t nonce = get_u64(v + 8);
+    if (nonce) nonces.emplace_back(addr, nonce);
+    balances.emplace_back(std::move(addr), (std::int64_t)get_u64(v));
+  }
+  if (pos != entries.size()) return fail("truncated state snapshot");
+  auto accounts = std::make_shared<AccountState>();
+  accounts->balance = CowMap<std::int64_t>::build(std::move(balances));
+  accounts->nonce = CowMap<std::uint64_t>::build(std::move(nonces));
+
+  static const char* digits = "0123456789abcdef";
+  out->block_hash.clear();
+  for (std::size_t i = 0; i < kHashBytes; ++i) {
+    auto b = (unsigned char)h[24 + i];
+    out->block_hash.push_back(digits[b >> 4]);
+    out->block_hash.push_back(digits[b & 0xf]);
+  }
+  out->height = get_u64(h + 16);
+  out->accounts = std::move(accounts);
+  return true;
+}
+
+bool save_validated_checkpoint(const std::string& path, std::uint64_t height, const std::string& hash,
+                               std::string* err) {
+  return storage::save_file_atomically(path, std::to_string(height) + " " + hash + "\n", err);
+}
+
+bool load_validated_checkpoint(const std::string& path, std::uint64_t* height, std::string* hash,
+                               std::string* err) {
+  std::string s;
+  if (!storage::load_file_to_string(path, &s, err)) return false;
+  std::istringstream in(s);
+  if (!(in >> *height >> *hash) || hash->size() != 2 * kHashBytes) {
+    if (err) *err = "malformed validated checkpoint";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace sbc
@@ -0,0 +1,40 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <string>
+
+#include "state.hpp"
+
+namespace sbc {
+
+// Binary state snapshot file (little-endian):
+//
+//   header, 72 bytes:
+//     char[8] "SBCSTATE", u32 version (2), u32 0, u64 height,
+//     u8[32] block hash (raw), u64 account count, u32 crc32(entries), u32 0
+//   entries, sorted by address:
+//     u32 address length, address bytes, i64 balance, u64 nonce
+//
+// Sorted entries make loading one checksum pass plus a bulk build of the
+// account table (CowMap::build), independent of chain length. Addresses are
+// stored as given, whatever their length (txs may pay to any string). A
+// nonce of 0 means "no nonce entry". Version 1 files (u32 entry size 56,
+// char[40] zero-padded addresses) still load. The snapshot only applies to the
+// chain whose block at `height` has `block_hash`; reindex() checks that.
+// Saved with storage::save_file_atomically, so a crash mid-write leaves the
+// previous snapshot in place.
+bool save_state_snapshot(const std::string& path, const StateSnapshot& snap, std::string* err);
+bool load_state_snapshot(const std::string& path, StateSnapshot* out, std::string* err);
+
+// Validated-height watermark kept next to a block log, as one "height hash"
+// text line, replaced crash-safely. A stale file is harmless: the loader
+// re-checks the headers below it and falls back to validating everything.
+bool save_validated_checkpoint(const std::string& path, std::uint64_t height, const std::string& hash,
+                               std::string* err);
+bool load_validated_checkpoint(const std::string& path, std::uint64_t* height, std::string* hash,
+                               std::string* err);
+
+}  // namespace sbc
@@ -4,14 +4,175 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 */
 
 #include "storage.hpp"
+#include <array>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 namespace storage {
-bool save_json_to_file(const std::string& path, const std::string& content, std::string* err) {
-  std::ofstream out(path, std::ios::binary);
-  if (!out) { if (err) *err = "open failed"; return false; }
-  out << content;
-  if (!out.good()) { if (err) *err = "write failed"; return false; }
+
+namespace fs = std::filesystem;
+
+// ---- thin POSIX/Windows file shim -------------------------------------------------
+namespace {
+#if defined(_WIN32)
+int os_open(const std::string& p, bool create) {
+  int flags = _O_RDWR | _O_BINARY | (create ? _O_CREAT : 0);
+  return ::_open(p.c_str(), flags, _S_IREAD | _S_IWRITE);
+}
+int os_close(int fd) { return ::_close(fd); }
+bool os_fsync(int fd) { return ::_commit(fd) == 0; }
+bool os_truncate(int fd, std::uint64_t size) { return ::_chsize_s(fd, (__int64)size) == 0; }
+std::uint64_t os_size(int fd) {
+  struct _stat64 st;
+  return ::_fstat64(fd, &st) == 0 ? (std::uint64_t)st.st_size : 0;
+}
+bool os_pwrite(int fd, const char* p, std::size_t n, std::uint64_t off) {
+  if (::_lseeki64(fd, (__int64)off, SEEK_SET) < 0) return false;
+  while (n) {
+    int w = ::_write(fd, p, (unsigned)n);
+    if (w <= 0) return false;
+    p += w;
+    n -= (std::size_t)w;
+  }
+  return true;
+}
+bool os_pread(int fd, char* p, std::size_t n, std::uint64_t off) {
+  if (::_lseeki64(fd, (__int64)off, SEEK_SET) < 0) return false;
+  while (n) {
+    int r = ::_read(fd, p, (unsigned)n);
+    if (r <= 0) return false;
+    p += r;
+    n -= (std::size_t)r;
+  }
+  return true;
+}
+#else
+int os_open(const std::string& p, bool create) {
+  return ::open(p.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+}
+int os_close(int fd) { return ::close(fd); }
+bool os_fsync(int fd) { return ::fsync(fd) == 0; }
+bool os_truncate(int fd, std::uint64_t size) { return ::ftruncate(fd, (off_t)size) == 0; }
+std::uint64_t os_size(int fd) {
+  struct stat st;
+  return ::fstat(fd, &st) == 0 ? (std::uint64_t)st.st_size : 0;
+}
+bool os_pwrite(int fd, const char* p, std::size_t n, std::uint64_t off) {
+  while (n) {
+    ssize_t w = ::pwrite(fd, p, n, (off_t)off);
+    if (w <= 0) return false;
+    p += w;
+    n -= (std::size_t)w;
+    off += (std::uint64_t)w;
+  }
+  return true;
+}
+bool os_pread(int fd, char* p, std::size_t n, std::uint64_t off) {
+  while (n) {
+    ssize_t r = ::pread(fd, p, n, (off_t)off);
+    if (r <= 0) return false;
+    p += r;
+    n -= (std::size_t)r;
+    off += (std::uint64_t)r;
+  }
+  return true;
+}
+#endif
+
+void put_u32(char* p, std::uint32_t v) {
+  for (int i = 0; i < 4; ++i) p[i] = (char)((v >> (8 * i)) & 0xff);
+}
+void put_u64(char* p, std::uint64_t v) {
+  for (int i = 0; i < 8; ++i) p[i] = (char)((v >> (8 * i)) & 0xff);
+}
+std::uint32_t get_u32(const char* p) {
+  std::uint32_t v = 0;
+  for (int i = 3; i >= 0; --i) v = (v << 8) | (unsigned char)p[i];
+  return v;
+}
+std::uint64_t get_u64(const char* p) {
+  std::uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) v = (v << 8) | (unsigned char)p[i];
+  return v;
+}
+
+constexpr std::size_t kRecordHeader = 8;  // u32 length + u32 crc
+constexpr std::size_t kIndexEntry = 16;
+}  // namespace
+
+std::uint32_t crc32(std::string_view data) {
+  static const auto table = [] {
+    std::array<std::uint32_t, 256> t{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+      std::uint32_t c = i;
+      for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+  std::uint32_t c = 0xFFFFFFFFu;
+  for (unsigned char b : data) c = table[(c ^ b) & 0xff] ^ (c >> 8);
+  return c ^ 0xFFFFFFFFu;
+}
+
+// Make a completed rename durable (POSIX; NTFS journals renames itself).
+static void sync_parent_dir(const std::string& path) {
+#if !defined(_WIN32)
+  auto parent = fs::path(path).parent_path();
+  int fd = ::open(parent.empty() ? "." : parent.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+#else
+  (void)path;
+#endif
+}
+
+bool save_file_atomically(const std::string& path, const std::string& content, std::string* err) {
+  return save_file_atomically(path, [&content](std::ostream& out) { out << content; }, err);
+}
+bool save_file_atomically(const std::string& path, const std::function<void(std::ostream&)>& write,
+                       std::string* err) {
+  const std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out) { if (err) *err = "open failed"; return false; }
+    write(out);
+    out.flush();
+    if (!out.good()) {
+      out.close();
+      fs::remove(tmp);
+      if (err) *err = "write failed";
+      return false;
+    }
+  }
+  int fd = os_open(tmp, false);
+  bool synced = fd >= 0 && os_fsync(fd);
+  if (fd >= 0) os_close(fd);
+  if (!synced) {
+    fs::remove(tmp);
+    if (err) *err = "fsync failed";
+    return false;
+  }
+  std::error_code ec;
+  fs::rename(tmp, path, ec);
+  if (ec) {
+    fs::remove(tmp);
+    if (err) *err = "rename failed: " + ec.message();
+    return false;
+  }
+  sync_parent_dir(path);
   return true;
 }
 bool load_file_to_string(const std::string& path, std::string* out, std::string* err) {
@@ -20,4 +181,669 @@ bool load_file_to_string(const std::string& path, std::string* out, std::string*
   out->assign((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
   return true;
 }
+
+// ---- MappedFile --------------------------------------------------------------------
+
+MappedFile::~MappedFile() { close(); }
+
+MappedFile::MappedFile(MappedFile&& o) noexcept { *this = std::move(o); }
+
+MappedFile& MappedFile::operator=(MappedFile&& o) noexcept {
+  if (this != &o) {
+    close();
+    data_ = o.data_;
+    size_ = o.size_;
+    open_ = o.open_;
+#if defined(_WIN32)
+    buf_ = std::move(o.buf_);
+    data_ = buf_.data();
+#endif
+    o.data_ = nullptr;
+    o.size_ = 0;
+    o.open_ = false;
+  }
+  return *this;
+}
+
+bool MappedFile::open(const std::string& path, std::string* err) {
+  close();
+#if defined(_WIN32)
+  if (!load_file_to_string(path, &buf_, err)) return false;
+  data_ = buf_.data();
+  size_ = buf_.size();
+#else
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) { if (err) *err = "open failed"; return false; }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) { ::close(fd); if (err) *err = "stat failed"; return false; }
+  size_ = (std::size_t)st.st_size;
+  if (size_ > 0) {
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      size_ = 0;
+      if (err) *err = "mmap failed";
+      return false;
+    }
+    data_ = static_cast<const char*>(p);
+  }
+  ::close(fd);  // the mapping keeps the file referenced
+#endif
+  open_ = true;
+  return true;
+}
+
+void MappedFile::close() {
+#if defined(_WIN32)
+  buf_.clear();
+#else
+  if (data_ && size_) ::munmap(const_cast<char*>(data_), size_);
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  open_ = false;
+}
+
+void MappedFile::adviseSequential() const {
+#if !defined(_WIN32)
+  if (data_ && size_) ::madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+#endif
+}
+
+// ---- BlockLog ----------------------------------------------------------------------
+
+BlockLog::~BlockLog() { close(); }
+
+void BlockLog::close() {
+  if (data_fd_ >= 0) os_close(data_fd_);
+  if (index_fd_ >= 0) os_close(index_fd_);
+  data_fd_ = index_fd_ = -1;
+  index_.clear();
+  maps_.clear();
+}
+
+static std::string segment_path(const std::string& dir, std::uint32_t seg) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "blocks_%05u.dat", seg);
+  return (fs::path(dir) / name).string();
+}
+
+std::string BlockLog::segmentPath(std::uint32_t seg) const { return segment_path(dir_, seg); }
+
+bool BlockLog::openSegmentForAppend(std::uint32_t seg, std::string* err) {
+  if (data_fd_ >= 0) os_close(data_fd_);
+  data_fd_ = os_open(segmentPath(seg), /*create=*/true);
+  if (data_fd_ < 0) { if (err) *err = "open segment failed"; return false; }
+  cur_segment_ = seg;
+  cur_size_ = os_size(data_fd_);
+  return true;
+}
+
+bool BlockLog::open(const std::string& dir, std::string* err, std::uint64_t segment_bytes) {
+  close();
+  dir_ = dir;
+  segment_bytes_ = segment_bytes;
+  std::error_code ec;
+  fs::create_directories(dir_, ec);
+  if (ec) { if (err) *err = "create dir failed: " + ec.message(); return false; }
+  if (!finishCompaction(err)) return false;
+  index_fd_ = os_open((fs::path(dir_) / "blocks.idx").string(), /*create=*/true);
+  if (index_fd_ < 0) { if (err) *err = "open index failed"; return false; }
+  if (!recover(err)) { close(); return false; }
+  return true;
+}
+
+// Compaction commit protocol: rewritten segments go to blocks_NNNNN.dat.compact
+// and the new index to blocks.idx.tmp, all fsynced; renaming the index to
+// blocks.idx.next is the commit point. Then each .compact replaces its
+// segment and blocks.idx.next replaces blocks.idx. This rolls a committed
+// compaction forward and throws away an uncommitted one.
+bool BlockLog::finishCompaction(std::string* err) {
+  const fs::path dir(dir_);
+  const bool committed = fs::exists(dir / "blocks.idx.next");
+  std::vector<fs::path> pending;
+  for (const auto& de : fs::directory_iterator(dir)) {
+    if (de.path().extension() == ".compact") pending.push_back(de.path());
+  }
+  std::error_code ec;
+  for (const auto& p : pending) {
+    if (committed) fs::rename(p, fs::path(p).replace_extension(), ec);
+    else fs::remove(p, ec);
+    if (ec) { if (err) *err = "finish compaction: " + ec.message(); return false; }
+  }
+  fs::remove(dir / "blocks.idx.tmp", ec);
+  if (committed) {
+    fs::rename(dir / "blocks.idx.next", dir / "blocks.idx", ec);
+    if (ec) { if (err) *err = "finish compaction: " + ec.message(); return false; }
+  }
+  if (committed || !pending.empty()) sync_parent_dir((dir / "blocks.idx").string());
+  return true;
+}
+
+bool BlockLog::compact(std::uint64_t below, const RecordRewriter& rewrite, std::string* err) {
+  if (data_fd_ < 0) { if (err) *err = "log not open"; return false; }
+  std::vector<Entry> next = index_;
+  std::vector<std::uint32_t> rewritten;
+  for (std::size_t i = 0; i < index_.size() && index_[i].segment < cur_segment_;) {
+    const std::uint32_t seg = index_[i].segment;
+    std::size_t j = i;
+    while (j < index_.size() && index_[j].segment == seg) ++j;
+    if (j > below) break;
+    std::string out;
+    bool changed = false;
+    for (std::size_t k = i; k < j; ++k) {
+      std::string_view rec;
+      std::string nrec;
+      if (!view(k, &rec, err)) return false;
+      if (!rewrite(rec, &nrec)) {
+        if (err) *err = "compaction rewrite failed at height " + std::to_string(k);
+        return false;
+      }
+      changed |= nrec != rec;
+      next[k] = Entry{out.size(), seg, (std::uint32_t)nrec.size()};
+      char hdr[kRecordHeader];
+      put_u32(hdr, (std::uint32_t)nrec.size());
+      put_u32(hdr + 4, crc32(nrec));
+      out.append(hdr, kRecordHeader);
+      out += nrec;
+    }
+    i = j;
+    if (!changed) continue;
+    int fd = os_open(segmentPath(seg) + ".compact", /*create=*/true);
+    bool ok = fd >= 0 && os_truncate(fd, 0) && os_pwrite(fd, out.data(), out.size(), 0) && os_fsync(fd);
+    if (fd >= 0) os_close(fd);
+    if (!ok) { if (err) *err = "write compacted segment failed"; return false; }
+    rewritten.push_back(seg);
+  }
+  if (rewritten.empty()) return true;
+  return commitRewrite(std::move(next), err);
+}
+
+// Writes the new index and renames it into place (the commit point shared
+// by compact() and replaceAll()), then swaps in the .compact segments.
+bool BlockLog::commitRewrite(std::vector<Entry> next, std::string* err) {
+  const fs::path dir(dir_);
+  std::string idx(next.size() * kIndexEntry, '\0');
+  for (std::size_t i = 0; i < next.size(); ++i) {
+    put_u64(&idx[i * kIndexEntry], next[i].offset);
+    put_u32(&idx[i * kIndexEntry + 8], next[i].segment);
+    put_u32(&idx[i * kIndexEntry + 12], next[i].length);
+  }
+  int fd = os_open((dir / "blocks.idx.tmp").string(), /*create=*/true);
+  bool ok = fd >= 0 && os_truncate(fd, 0) && os_pwrite(fd, idx.data(), idx.size(), 0) && os_fsync(fd);
+  if (fd >= 0) os_close(fd);
+  std::error_code ec;
+  if (ok) fs::rename(dir / "blocks.idx.tmp", dir / "blocks.idx.next", ec);  // commit point
+  if (!ok || ec) { if (err) *err = "write rewritten index failed"; return false; }
+  sync_parent_dir((dir / "blocks.idx").string());
+
+  maps_.clear();
+  os_close(index_fd_);
+  index_fd_ = -1;
+  if (!finishCompaction(err)) return false;
+  index_fd_ = os_open((dir / "blocks.idx").string(), /*create=*/false);
+  if (index_fd_ < 0) { if (err) *err = "reopen index failed"; return false; }
+  index_ = std::move(next);
+  return true;
+}
+
+bool BlockLog::replaceAll(const std::vector<std::string>& payloads, std::string* err) {
+  if (data_fd_ < 0) { if (err) *err = "log not open"; return false; }
+  std::vector<Entry> next;
+  next.reserve(payloads.size());
+  std::string out;  // records bound for segment `seg`
+  std::uint32_t seg = 0;
+  auto write_seg = [&]() {
+    int fd = os_open(segmentPath(seg) + ".compact", /*create=*/true);
+    bool ok = fd >= 0 && os_truncate(fd, 0) && (out.empty() || os_pwrite(fd, out.data(), out.size(), 0)) &&
+              os_fsync(fd);
+    if (fd >= 0) os_close(fd);
+    if (!ok && err) *err = "write replacement segment failed";
+    return ok;
+  };
+  for (const auto& payload : payloads) {
+    if (!out.empty() && out.size() + kRecordHeader + payload.size() > segment_bytes_) {
+      if (!write_seg()) return false;
+      out.clear();
+      ++seg;
+    }
+    next.push_back(Entry{out.size(), seg, (std::uint32_t)payload.size()});
+    char hdr[kRecordHeader];
+    put_u32(hdr, (std::uint32_t)payload.size());
+    put_u32(hdr + 4, crc32(payload));
+    out.append(hdr, kRecordHeader);
+    out.append(payload);
+  }
+  if (!write_seg()) return false;
+  // Old segments past the new tail are replaced by empty ones as part of the
+  // same commit, so recovery cannot pick their records up again.
+  const std::uint32_t last = seg;
+  for (seg = last + 1; seg <= cur_segment_; ++seg) {
+    out.clear();
+    if (!write_seg()) return false;
+  }
+
+  os_close(data_fd_);
+  data_fd_ = -1;
+  if (!commitRewrite(std::move(next), err)) { close(); return false; }
+  std::error_code ec;
+  for (seg = last + 1; seg <= cur_segment_; ++seg) fs::remove(segmentPath(seg), ec);
+  return openSegmentForAppend(last, err);
+}
+
+bool BlockLog::recover(std::string* err) {
+  // 1) load complete index entries (a torn trailing entry is ignored)
+  std::uint64_t idx_bytes = os_size(index_fd_);
+  std::size_t n = (std::size_t)(idx_bytes / kIndexEntry);
+  std::string raw(n * kIndexEntry, '\0');
+  if (n && !os_pread(index_fd_, raw.data(), raw.size(), 0)) {
+    if (err) *err = "read index failed";
+    return false;
+  }
+  index_.resize(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    const char* p = raw.data() + i * kIndexEntry;
+    index_[i] = Entry{get_u64(p), get_u32(p + 8), get_u32(p + 12)};
+  }
+
+  // highest segment on disk
+  std::uint32_t last_seg = 0;
+  for (const auto& de : fs::directory_iterator(dir_)) {
+    unsigned seg = 0;
+    if (std::sscanf(de.path().filename().string().c_str(), "blocks_%05u.dat", &seg) == 1 &&
+        seg > last_seg) {
+      last_seg = seg;
+    }
+  }
+
+  // 2) drop index entries whose record did not fully reach disk
+  while (!index_.empty()) {
+    const Entry& e = index_.back();
+    std::string rec;
+    int fd = os_open(segmentPath(e.segment), /*create=*/false);
+    bool ok = fd >= 0 && os_size(fd) >= e.offset + kRecordHeader + e.length;
+    if (ok) {
+      rec.resize(kRecordHeader + e.length);
+      ok = os_pread(fd, rec.data(), rec.size(), e.offset) && get_u32(rec.data()) == e.length &&
+           get_u32(rec.data() + 4) == crc32(std::string_view(rec).substr(kRecordHeader));
+    }
+    if (fd >= 0) os_close(fd);
+    if (ok) break;
+    index_.pop_back();
+  }
+
+  // 3) scan forward past the last indexed record for records the index missed;
+  //    truncate the first torn/corrupt one and everything after it
+  std::uint32_t seg = index_.empty() ? 0 : index_.back().segment;
+  std::uint64_t pos = index_.empty() ? 0 : index_.back().offset + kRecordHeader + index_.back().length;
+  bool truncated = false;
+  for (; seg <= last_seg; ++seg, pos = 0) {
+    int fd = os_open(segmentPath(seg), /*create=*/true);
+    if (fd < 0) { if (err) *err = "open segment failed"; return false; }
+    if (truncated) {
+      os_truncate(fd, 0);  // beyond a hole: discard
+      os_close(fd);
+      continue;
+    }
+    std::uint64_t size = os_size(fd);
+    char hdr[kRecordHeader];
+    while (pos + kRecordHeader <= size) {
+      if (!os_pread(fd, hdr, kRecordHeader, pos)) break;
+      std::uint32_t len = get_u32(hdr);
+      if (pos + kRecordHeader + len > size) break;
+      std::string payload(len, '\0');
+      if (len && !os_pread(fd, payload.data(), len, pos + kRecordHeader)) break;
+      if (get_u32(hdr + 4) != crc32(payload)) break;
+      index_.push_back(Entry{pos, seg, len});
+      pos += kRecordHeader + len;
+    }
+    if (pos < size) {
+      os_truncate(fd, pos);
+      truncated = true;
+    }
+    os_close(fd);
+  }
+
+  // 4) rewrite the index to match
+  std::string out(index_.size() * kIndexEntry, '\0');
+  for (std::size_t i = 0; i < index_.size(); ++i) {
+    char* p = out.data() + i * kIndexEntry;
+    put_u64(p, index_[i].offset);
+    put_u32(p + 8, index_[i].segment);
+    put_u32(p + 12, index_[i].length);
+  }
+  if (!os_truncate(index_fd_, 0) || (!out.empty() && !os_pwrite(index_fd_, out.data(), out.size(), 0))) {
+    if (err) *err = "rewrite index failed";
+    return false;
+  }
+
+  // 5) continue appending to the segment holding the tail
+  std::uint32_t tail = index_.empty() ? 0 : index_.back().segment;
+  if (!openSegmentForAppend(tail, err)) return false;
+  if (!index_.empty()) {
+    const Entry& e = index_.back();
+    std::uint64_t end = e.offset + kRecordHeader + e.length;
+    if (cur_size_ > end) {
+      os_truncate(data_fd_, end);
+      cur_size_ = end;
+    }
+  }
+  return true;
+}
+
+bool BlockLog::append(std::string_view payload, std::string* err) {
+  if (data_fd_ < 0) { if (err) *err = "log not open"; return false; }
+  if (cur_size_ > 0 && cur_size_ + kRecordHeader + payload.size() > segment_bytes_) {
+    if (!openSegmentForAppend(cur_segment_ + 1, err)) return false;
+  }
+  std::string rec(kRecordHeader + payload.size(), '\0');
+  put_u32(rec.data(), (std::uint32_t)payload.size());
+  put_u32(rec.data() + 4, crc32(payload));
+  rec.replace(kRecordHeader, payload.size(), payload.data(), payload.size());
+  // data first, then index: recovery can always rebuild a missing index entry
+  if (!os_pwrite(data_fd_, rec.data(), rec.size(), cur_size_)) {
+    if (err) *err = "write record failed";
+    return false;
+  }
+  Entry e{cur_size_, cur_segment_, (std::uint32_t)payload.size()};
+  char ie[kIndexEntry];
+  put_u64(ie, e.offset);
+  put_u32(ie + 8, e.segment);
+  put_u32(ie + 12, e.length);
+  if (!os_pwrite(index_fd_, ie, kIndexEntry, index_.size() * kIndexEntry)) {
+    if (err) *err = "write index failed";
+    return false;
+  }
+  cur_size_ += rec.size();
+  index_.push_back(e);
+  return true;
+}
+
+bool BlockLog::view(std::uint64_t height, std::string_view* out, std::string* err) const {
+  if (height >= index_.size()) { if (err) *err = "height out of range"; return false; }
+  const Entry& e = index_[height];
+  if (maps_.size() <= e.segment) maps_.resize(e.segment + 1);
+  MappedFile& m = maps_[e.segment];
+  // (re)map if this segment has grown past the current mapping
+  if (!m.isOpen() || m.size() < e.offset + kRecordHeader + e.length) {
+    if (!m.open(segmentPath(e.segment), err)) return false;
+    m.adviseSequential();
+    if (m.size() < e.offset + kRecordHeader + e.length) {
+      if (err) *err = "truncated segment";
+      return false;
+    }
+  }
+  std::string_view rec = m.data().substr(e.offset, kRecordHeader + e.length);
+  std::string_view payload = rec.substr(kRecordHeader);
+  if (get_u32(rec.data()) != e.length || get_u32(rec.data() + 4) != crc32(payload)) {
+    if (err) *err = "corrupt record at height " + std::to_string(height);
+    return false;
+  }
+  *out = payload;
+  return true;
+}
+
+bool BlockLog::read(std::uint64_t height, std::string* out, std::string* err) const {
+  std::string_view v;
+  if (!view(height, &v, err)) return false;
+  out->assign(v.data(), v.size());
+  return true;
+}
+
+std::shared_ptr<const BlockLog::Reader> BlockLog::reader() const {
+  auto r = std::make_shared<Reader>();
+  r->dir_ = dir_;
+  r->index_ = index_;
+  return r;
+}
+
+BlockLog::Reader::~Reader() {
+  for (int fd : fds_) {
+    if (fd >= 0) os_close(fd);
+  }
+}
+
+bool BlockLog::Reader::read(std::uint64_t height, std::string* out, std::string* err) const {
+  if (height >= index_.size()) { if (err) *err = "height out of range"; return false; }
+  const Entry& e = index_[height];
+  std::string rec(kRecordHeader + e.length, '\0');
+  {
+    // one read at a time: the Windows shim seeks the shared descriptor
+    std::lock_guard<std::mutex> lk(mu_);
+    if (fds_.size() <= e.segment) fds_.resize(e.segment + 1, -1);
+    int& fd = fds_[e.segment];
+    if (fd < 0) fd = os_open(segment_path(dir_, e.segment), /*create=*/false);
+    if (fd < 0) { if (err) *err = "cannot open " + segment_path(dir_, e.segment); return false; }
+    if (!os_pread(fd, rec.data(), rec.size(), e.offset)) {
+      if (err) *err = "truncated segment";
+      return false;
+    }
+  }
+  std::string_view payload = std::string_view(rec).substr(kRecordHeader);
+  if (get_u32(rec.data()) != e.length || get_u32(rec.data() + 4) != crc32(payload)) {
+    if (err) *err = "corrupt record at height " + std::to_string(height);
+    return false;
+  }
+  rec.erase(0, kRecordHeader);
+  *out = std::move(rec);
+  return true;
+}
+
+bool BlockLog::appendBatch(const std::vector<std::string>& payloads, std::string* err) {
+  if (data_fd_ < 0) { if (err) *err = "log not open"; return false; }
+  std::vector<Entry> added;
+  added.reserve(payloads.size());
+  std::string buf;  // records bound for the current segment
+  std::uint64_t buf_start = cur_size_;
+  auto flush_buf = [&]() {
+    if (buf.empty()) return true;
+    if (!os_pwrite(data_fd_, buf.data(), buf.size(), buf_start)) return false;
+    buf_start += buf.size();
+    buf.clear();
+    return true;
+  };
+  for (const auto& payload : payloads) {
+    std::uint64_t end = buf_start + buf.size();
+    if (end > 0 && end + kRecordHeader + payload.size() > segment_bytes_) {
+      if (!flush_buf()) { if (err) *err = "write record failed"; return false; }
+      cur_size_ = buf_start;
+      if (!openSegmentForAppend(cur_segment_ + 1, err)) return false;
+      buf_start = cur_size_;
+      end = buf_start;
+    }
+    added.push_back(Entry{end, cur_segment_, (std::uint32_t)payload.size()});
+    char hdr[kRecordHeader];
+    put_u32(hdr, (std::uint32_t)payload.size());
+    put_u32(hdr + 4, crc32(payload));
+    buf.append(hdr, kRecordHeader);
+    buf.append(payload);
+  }
+  if (!flush_buf()) { if (err) *err = "write record failed"; return false; }
+  cur_size_ = buf_start;
+  // data first, then index: recovery can always rebuild missing index entries
+  std::string ie(added.size() * kIndexEntry, '\0');
+  for (std::size_t i = 0; i < added.size(); ++i) {
+    put_u64(&ie[i * kIndexEntry], added[i].offset);
+    put_u32(&ie[i * kIndexEntry + 8], added[i].segment);
+    put_u32(&ie[i * kIndexEntry + 12], added[i].length);
+  }
+  if (!os_pwrite(index_fd_, ie.data(), ie.size(), index_.size() * kIndexEntry)) {
+    if (err) *err = "write index failed";
+    return false;
+  }
+  index_.insert(index_.end(), added.begin(), added.end());
+  return true;
+}
+
+bool BlockLog::sync(std::string* err) {
+  if (data_fd_ < 0) { if (err) *err = "log not open"; return false; }
+  if (!os_fsync(data_fd_) || !os_fsync(index_fd_)) { if (err) *err = "fsync failed"; return false; }
+  return true;
+}
+
+bool BlockLog::truncate(std::uint64_t height, std::string* err) {
+  if (data_fd_ < 0) { if (err) *err = "log not open"; return false; }
+  if (height >= index_.size()) return true;
+  const std::uint32_t seg = index_[height].segment;
+  const std::uint64_t end = index_[height].offset;
+  // data first (later segments, then the tail of seg), so a crash part way
+  // leaves index entries recovery drops rather than records it re-indexes
+  maps_.clear();
+  std::error_code ec;
+  for (std::uint32_t s = cur_segment_; s > seg; --s) {
+    fs::remove(segmentPath(s), ec);
+    if (ec) { if (err) *err = "remove segment failed: " + ec.message(); return false; }
+  }
+  if (!openSegmentForAppend(seg, err)) return false;
+  if (!os_truncate(data_fd_, end) || !os_fsync(data_fd_)) { if (err) *err = "truncate segment failed"; return false; }
+  cur_size_ = end;
+  if (!os_truncate(index_fd_, height * kIndexEntry) || !os_fsync(index_fd_)) {
+    if (err) *err = "truncate index failed";
+    return false;
+  }
+  index_.resize(height);
+  sync_parent_dir(segmentPath(seg));
+  return true;
+}
+
+// ---- AsyncLogWriter ----------------------------------------------------------------
+
+AsyncLogWriter::AsyncLogWriter(BlockLog* log, std::chrono::milliseconds sync_window,
+                               ErrorHandler on_error)
+    : log_(log), window_(sync_window), on_error_(std::move(on_error)), worker_([this] { run(); }) {}
+
+AsyncLogWriter::~AsyncLogWriter() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stop_ = true;
+  }
+  work_cv_.notify_one();
+  worker_.join();
+}
+
+bool AsyncLogWriter::enqueue(std::string record) {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!failed_.empty()) return false;
+    queue_.push_back(Item{std::move(record), nullptr});
+    ++enqueued_;
+  }
+  work_cv_.notify_one();
+  return true;
+}
+
+bool AsyncLogWriter::enqueueTask(Task task) {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!failed_.empty()) return false;
+    queue_.push_back(Item{std::string(), std::move(task)});
+    ++enqueued_;
+  }
+  work_cv_.notify_one();
+  return true;
+}
+
+bool AsyncLogWriter::flush(std::string* err) {
+  std::unique_lock<std::mutex> lk(mu_);
+  const std::uint64_t target = enqueued_;
+  if (target > flush_to_) flush_to_ = target;
+  work_cv_.notify_one();
+  done_cv_.wait(lk, [&] { return durable_ >= target; });
+  if (!failed_.empty()) {
+    if (err) *err = failed_;
+    return false;
+  }
+  if (error_.empty()) return true;
+  if (err) *err = error_;
+  error_.clear();
+  return false;
+}
+
+bool AsyncLogWriter::failed() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return !failed_.empty();
+}
+
+AsyncLogWriter::Stats AsyncLogWriter::stats() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return stats_;
+}
+
+void AsyncLogWriter::run() {
+  using clock = std::chrono::steady_clock;
+  auto last_sync = clock::now();
+  std::unique_lock<std::mutex> lk(mu_);
+  for (;;) {
+    auto has_work = [&] { return stop_ || !queue_.empty() || flush_to_ > durable_; };
+    if (written_ > durable_) work_cv_.wait_until(lk, last_sync + window_, has_work);
+    else work_cv_.wait(lk, has_work);
+    if (stop_ && queue_.empty() && written_ == durable_) break;
+
+    std::vector<Item> batch;
+    batch.swap(queue_);
+    const std::uint64_t target = enqueued_;
+    const bool sync_now = stop_ || flush_to_ > durable_ || window_.count() == 0 ||
+                          clock::now() >= last_sync + window_;
+    lk.unlock();
+
+    // disk I/O happens without the lock, so enqueue() never waits on it.
+    // Runs of records are appended as one batch; a task first makes
+    // everything before it durable. A failed task does not stop the items
+    // behind it; a failed append or fsync stops everything.
+    std::string fatal;
+    std::vector<std::string> task_errors;
+    bool synced = false;
+    std::size_t records = 0, tasks = 0;
+    std::vector<std::string> run_records;
+    for (std::size_t i = 0; fatal.empty() && i <= batch.size(); ++i) {
+      if (i < batch.size() && !batch[i].task) {
+        run_records.push_back(std::move(batch[i].record));
+        continue;
+      }
+      if (!run_records.empty()) {
+        if (log_->appendBatch(run_records, &fatal)) records += run_records.size();
+        run_records.clear();
+      }
+      if (fatal.empty() && i < batch.size() && log_->sync(&fatal)) {
+        std::string err;
+        if (!batch[i].task(*log_, &err)) {
+          if (err.empty()) err = "task failed";
+          // a task that could not leave the log consistent closes it
+          if (log_->isOpen()) task_errors.push_back(err);
+          else fatal = err;
+        }
+        ++tasks;
+      }
+    }
+    if (fatal.empty() && sync_now) {
+      synced = log_->sync(&fatal);
+      last_sync = clock::now();
+    }
+    if (on_error_) {  // before flush() waiters are released
+      for (const auto& e : task_errors) on_error_(e, false);
+      if (!fatal.empty()) on_error_(fatal, true);
+    }
+
+    lk.lock();
+    if (records) {
+      stats_.records += records;
+      ++stats_.batches;
+    }
+    stats_.tasks += tasks;
+    if (synced) ++stats_.syncs;
+    if (!task_errors.empty() && error_.empty()) error_ = task_errors.front();
+    if (!fatal.empty()) {
+      // the log tail is unknown now: drop everything queued (enqueue refuses
+      // new items from here on) and release flush() waiters with the error
+      failed_ = fatal;
+      queue_.clear();
+      written_ = durable_ = enqueued_;
+    } else {
+      written_ = target;
+      if (sync_now) durable_ = target;
+    }
+    done_cv_.notify_all();
+  }
+}
+
 }  // namespace storage
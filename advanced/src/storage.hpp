@@ -4,9 +4,224 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 */
 
 #pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
 #include <string>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 namespace storage {
-bool save_json_to_file(const std::string& path, const std::string& content, std::string* err);
+// Crash-safe replace: the contents go to "<path>.tmp", which is fsynced and
+// then renamed over path, so readers see either the old file or the new one.
+bool save_file_atomically(const std::string& path, const std::string& content, std::string* err);
+// Streaming variant: write(out) produces the file contents piece by piece.
+bool save_file_atomically(const std::string& path, const std::function<void(std::ostream&)>& write,
+                       std::string* err);
 bool load_file_to_string(const std::string& path, std::string* out, std::string* err);
+
+std::uint32_t crc32(std::string_view data);
+
+// Read-only memory map of a whole file (falls back to reading it into memory
+// where mmap is unavailable). Pages are faulted in only when touched.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(MappedFile&& o) noexcept;
+  MappedFile& operator=(MappedFile&& o) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const std::string& path, std::string* err);
+  void close();
+  bool isOpen() const noexcept { return open_; }
+  std::string_view data() const noexcept { return {data_, size_}; }
+  std::size_t size() const noexcept { return size_; }
+  // Hint that the mapping will be read front to back (read-ahead).
+  void adviseSequential() const;
+
+ private:
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+  bool open_ = false;
+#if defined(_WIN32)
+  std::string buf_;
+#endif
+};
+
+// Append-only, segmented log of opaque records (one per block height).
+//
+//   dir/blocks_00000.dat, blocks_00001.dat, ...
+//       records: [u32 length][u32 crc32(payload)][payload]   (little-endian)
+//   dir/blocks.idx
+//       one 16-byte entry per record: [u64 offset][u32 segment][u32 length]
+//
+// Appending costs O(record). open() recovers from a crash mid-append: a torn
+// or corrupt record at the tail of the last segment is truncated away, and
+// the index is reconciled with the records that actually made it to disk.
+class BlockLog {
+  struct Entry {
+    std::uint64_t offset;
+    std::uint32_t segment;
+    std::uint32_t length;  // payload length
+  };
+
+ public:
+  static constexpr std::uint64_t kDefaultSegmentBytes = 64ull << 20;
+
+  BlockLog() = default;
+  ~BlockLog();
+  BlockLog(const BlockLog&) = delete;
+  BlockLog& operator=(const BlockLog&) = delete;
+
+  bool open(const std::string& dir, std::string* err,
+            std::uint64_t segment_bytes = kDefaultSegmentBytes);
+  void close();
+  bool isOpen() const noexcept { return data_fd_ >= 0; }
+
+  bool append(std::string_view payload, std::string* err);
+  // Append several records with one data write per segment and one index
+  // write. Either all records are indexed or none are.
+  bool appendBatch(const std::vector<std::string>& payloads, std::string* err);
+  bool read(std::uint64_t height, std::string* out, std::string* err) const;
+  // Zero-copy access to a record through a lazily created segment mapping.
+  // The view stays valid until releaseMappings()/close(). Not thread-safe.
+  bool view(std::uint64_t height, std::string_view* out, std::string* err) const;
+  void releaseMappings() const { maps_.clear(); }
+  // Flush data and index to stable storage.
+  bool sync(std::string* err);
+  // Drop every record at or above height (e.g. before rewriting the log for
+  // a different chain). Durable on return.
+  bool truncate(std::uint64_t height, std::string* err);
+
+  // Rewrite every sealed segment whose records are all below height `below`,
+  // passing each record through rewrite (e.g. to drop block bodies). Heights
+  // are unchanged; segments the rewrite leaves identical are not touched.
+  // Crash-safe: the new segments and index are fsynced before a commit
+  // marker is renamed into place, and open() finishes or discards an
+  // interrupted compaction.
+  using RecordRewriter = std::function<bool(std::string_view in, std::string* out)>;
+  bool compact(std::uint64_t below, const RecordRewriter& rewrite, std::string* err);
+  // Replace the whole log with `payloads` (e.g. after switching to another
+  // chain). Same commit protocol as compact(): a crash leaves either the old
+  // log or the new one, never a mix.
+  bool replaceAll(const std::vector<std::string>& payloads, std::string* err);
+
+  // Reads the records indexed when it was created, from any thread, while
+  // the log itself keeps being appended to (e.g. by an AsyncLogWriter).
+  // Records are read with pread rather than mapped, so if the log is later
+  // truncated or compacted a read fails (or sees the rewritten record)
+  // instead of faulting. Outlives the log.
+  class Reader {
+   public:
+    ~Reader();
+    bool read(std::uint64_t height, std::string* out, std::string* err) const;
+    std::uint64_t size() const noexcept { return index_.size(); }
+
+   private:
+    friend class BlockLog;
+    std::string dir_;
+    std::vector<Entry> index_;
+    mutable std::mutex mu_;
+    mutable std::vector<int> fds_;  // by segment number, opened on first read
+  };
+  std::shared_ptr<const Reader> reader() const;
+
+  std::uint64_t size() const noexcept { return index_.size(); }
+  const std::string& dir() const noexcept { return dir_; }
+
+ private:
+  std::string segmentPath(std::uint32_t seg) const;
+  bool openSegmentForAppend(std::uint32_t seg, std::string* err);
+  bool recover(std::string* err);
+  bool finishCompaction(std::string* err);
+  bool commitRewrite(std::vector<Entry> next, std::string* err);
+
+ private:
+  std::string dir_;
+  std::uint64_t segment_bytes_ = kDefaultSegmentBytes;
+  std::vector<Entry> index_;
+  mutable std::vector<MappedFile> maps_;  // by segment number
+  std::uint32_t cur_segment_ = 0;
+  std::uint64_t cur_size_ = 0;
+  int data_fd_ = -1;
+  int index_fd_ = -1;
+};
+// Group commit for a BlockLog on a background thread. enqueue() never touches
+// the disk: records are queued, and the worker appends everything queued so
+// far as one batch. It fsyncs at most once per durability window (0 = after
+// every batch), so a crash loses at most the last window of records.
+// flush() is a barrier: it returns once everything enqueued before the call
+// is appended and fsynced. While a writer is running it owns the log; tasks
+// are the way to reach it.
+//
+// A failed task is reported and the records after it are still appended. A
+// failed append or fsync leaves the log's tail unknown, so the writer stops:
+// it drops what is queued and refuses every later record, rather than
+// appending them at heights that no longer match.
+class AsyncLogWriter {
+ public:
+  struct Stats {
+    std::uint64_t records{};
+    std::uint64_t batches{};
+    std::uint64_t syncs{};
+    std::uint64_t tasks{};
+  };
+  // Called on the worker thread as soon as a task (fatal = false) or an
+  // append/fsync (fatal = true) fails.
+  using ErrorHandler = std::function<void(const std::string& err, bool fatal)>;
+
+  explicit AsyncLogWriter(BlockLog* log,
+                          std::chrono::milliseconds sync_window = std::chrono::milliseconds(0),
+                          ErrorHandler on_error = {});
+  ~AsyncLogWriter();  // drains and fsyncs the queue, then stops the worker
+  AsyncLogWriter(const AsyncLogWriter&) = delete;
+  AsyncLogWriter& operator=(const AsyncLogWriter&) = delete;
+
+  // False (nothing queued) once the writer has failed.
+  bool enqueue(std::string record);
+  // Run task on the worker thread once every record enqueued before it is
+  // appended and fsynced (e.g. write a state snapshot, then compact the log).
+  // A task that fails part-way through changing the log should close it,
+  // which fails the writer like a failed append.
+  using Task = std::function<bool(BlockLog& log, std::string* err)>;
+  bool enqueueTask(Task task);
+  // False (with err) if a task failed since the last flush, or for good once
+  // an append or fsync has failed.
+  bool flush(std::string* err = nullptr);
+  bool failed() const;
+  Stats stats() const;
+
+ private:
+  void run();
+
+ private:
+  BlockLog* log_;
+  std::chrono::milliseconds window_;
+  mutable std::mutex mu_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  struct Item {
+    std::string record;
+    Task task;  // set for tasks, record is unused then
+  };
+  std::vector<Item> queue_;
+  std::uint64_t enqueued_ = 0;   // items handed to enqueue()/enqueueTask()
+  std::uint64_t written_ = 0;    // items appended/run (records possibly not yet durable)
+  std::uint64_t durable_ = 0;    // items appended and fsynced
+  std::uint64_t flush_to_ = 0;   // highest item a flush() is waiting on
+  std::string error_;    // first task failure since the last flush
+  std::string failed_;   // append/fsync failure; set for good
+  ErrorHandler on_error_;
+  bool stop_ = false;
+  Stats stats_;
+  std::thread worker_;
+};
+
 }  // namespace storage
@@ -0,0 +1,501 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "sync.hpp"
+#include "protocol.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <set>
+
+namespace sbc {
+
+namespace {
+
+constexpr std::uint64_t kMaxServeHeaders = 2000;
+constexpr std::uint64_t kMaxServeBlocks = 64;
+constexpr std::uint64_t kMaxLocator = 64;   // entries; log2 of any chain height fits easily
+constexpr std::uint64_t kDenseLocator = 10;  // newest entries one block apart, then doubling
+constexpr auto kWorkerTick = std::chrono::milliseconds(100);
+
+}  // namespace
+
+ChainSync::ChainSync(Node& node, SendFn send, SyncOptions opts)
+    : node_(node), send_(std::move(send)), opts_(opts) {}
+
+ChainSync::~ChainSync() { stop(); }
+
+void ChainSync::setSelfAddress(std::string addr) {
+  std::lock_guard<std::mutex> lk(mu_);
+  self_ = std::move(addr);
+}
+
+void ChainSync::start(const std::vector<std::string>& peers) {
+  std::lock_guard<std::mutex> lk(mu_);
+  for (const auto& p : peers) peers_.emplace(p, PeerInfo{});
+  if (th_.joinable()) return;
+  stopping_ = false;
+  th_ = std::thread([this] { run(); });
+}
+
+void ChainSync::stop() {
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (th_.joinable()) th_.join();
+}
+
+bool ChainSync::syncing() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return !headers_peer_.empty() || !todo_.empty() || !inflight_.empty() || !bodies_.empty();
+}
+
+SyncStats ChainSync::stats() const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return stats_;
+}
+
+void ChainSync::send(const Outbox& out) {
+  for (const auto& m : out) send_(m.first, m.second);
+}
+
+bool ChainSync::handle(WireReader& msg) {
+  try {
+    switch (msg.type()) {
+      case MsgType::GetTip:
+      case MsgType::GetHeaders:
+      case MsgType::GetBlocks:
+        // the sender address is not authenticated: serve configured peers
+        // only, so nobody can direct our replies at a third party
+        if (!knownPeer(msg.from())) return true;
+        break;
+      default: break;
+    }
+    switch (msg.type()) {
+      case MsgType::GetTip: {
+        auto snap = node_.snapshot();
+        std::string self;
+        {
+          std::lock_guard<std::mutex> lk(mu_);
+          self = self_;
+        }
+        send_(msg.from(),
+              WireWriter(MsgType::Tip, self).u64(snap->height()).hex(snap->tip().hash).u64(snap->work).finish());
+        break;
+      }
+      case MsgType::Tip: onTip(msg); break;
+      case MsgType::GetHeaders: onGetHeaders(msg); break;
+      case MsgType::Headers: onHeaders(msg); break;
+      case MsgType::GetBlocks: onGetBlocks(msg); break;
+      case MsgType::Blocks: onBlocks(msg); break;
+      default: return false;
+    }
+  } catch (const std::exception&) {
+    // malformed peer message: drop it
+  }
+  return true;
+}
+
+bool ChainSync::knownPeer(const std::string& peer) const {
+  std::lock_guard<std::mutex> lk(mu_);
+  return peers_.count(peer) != 0;
+}
+
+void ChainSync::peerAhead(const std::string& peer) {
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!peers_.count(peer)) return;
+    self = self_;
+  }
+  send_(peer, WireWriter(MsgType::GetTip, self).finish());
+}
+
+void ChainSync::onTip(WireReader& msg) {
+  std::uint64_t height = msg.u64();
+  std::string tip = msg.hex();
+  std::uint64_t work = msg.u64();
+  Outbox out;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto peer = peers_.find(msg.from());
+    if (peer == peers_.end()) return;  // only configured peers are synced from
+    peer->second.height = height;
+    peer->second.tip = std::move(tip);
+    peer->second.work = work;
+    requestHeadersLocked(&out);
+    assignLocked(&out);
+  }
+  send(out);
+}
+
+void ChainSync::requestHeadersLocked(Outbox* out) {
+  if (!headers_peer_.empty()) return;
+  auto snap = node_.snapshot();
+  // the peer with the most work, if that outweighs ours; while a branch is
+  // being fetched, only one whose chain goes past its last header
+  const std::uint64_t next = headers_base_ + headers_.size();
+  auto best = peers_.end();
+  for (auto it = peers_.begin(); it != peers_.end(); ++it) {
+    const PeerInfo& p = it->second;
+    if (!chain_outweighs(p.work, p.tip, snap->work, snap->tip().hash)) continue;
+    if (!headers_.empty() && p.height < next) continue;
+    if (best == peers_.end() || chain_outweighs(p.work, p.tip, best->second.work, best->second.tip)) best = it;
+  }
+  if (best == peers_.end()) return;
+  headers_peer_ = best->first;
+  headers_sent_ = std::chrono::steady_clock::now();
+  ++stats_.requests;
+
+  // locator: the branch's last header, then our chain from the tip back,
+  // dense at first and at doubling steps below, ending at genesis. The peer
+  // answers from just above the highest entry it shares.
+  std::vector<std::pair<std::uint64_t, const std::string*>> locator;
+  if (!headers_.empty()) locator.emplace_back(headers_.back().index, &headers_.back().hash);
+  for (std::uint64_t h = snap->height(), step = 1;; h = h > step ? h - step : 0) {
+    locator.emplace_back(h, &snap->blocks[h].hash);
+    if (h == 0) break;
+    if (locator.size() >= kDenseLocator) step *= 2;
+  }
+  WireWriter w(MsgType::GetHeaders, self_);
+  w.u64(opts_.headers_per_request).u64(locator.size());
+  for (const auto& [h, hash] : locator) w.u64(h).hex(*hash);
+  out->emplace_back(best->first, w.finish());
+}
+
+void ChainSync::onGetHeaders(WireReader& msg) {
+  auto snap = node_.snapshot();
+  std::uint64_t count = msg.u64();
+  std::uint64_t entries = msg.count(kMaxLocator);
+  std::optional<std::uint64_t> shared;  // highest locator entry on our chain
+  for (std::uint64_t i = 0; i < entries; ++i) {
+    std::uint64_t h = msg.u64();
+    std::string hash = msg.hex();
+    const Block* b = snap->blockAt(h);
+    if (b && b->hash == hash && (!shared || h > *shared)) shared = h;
+  }
+  std::uint64_t start = shared ? *shared + 1 : 0;
+  if (!shared) count = 0;  // no common block, not even genesis
+  std::uint64_t end = std::min<std::uint64_t>(start + std::min(count, kMaxServeHeaders), snap->blocks.size());
+  std::uint64_t n = end > start ? end - start : 0;
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stats_.served_headers += n;
+    self = self_;
+  }
+  WireWriter w(MsgType::Headers, self);
+  w.u64(start).u64(n);
+  for (std::uint64_t h = start; h < end; ++h) w.block(snap->blocks[h].header_only());
+  send_(msg.from(), w.finish());
+}
+
+void ChainSync::onHeaders(WireReader& msg) {
+  const std::string& from = msg.from();
+  std::uint64_t start = msg.u64();
+  std::uint64_t n = msg.count(kMaxServeHeaders);
+  std::vector<Block> got;
+  got.reserve(n);
+  for (std::uint64_t i = 0; i < n; ++i) got.push_back(msg.block());
+
+  const Blockchain::Params params = node_.params();
+  Outbox out;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (headers_peer_ != from) return;  // not the GETHEADERS we have out
+    headers_peer_.clear();
+    PeerInfo& peer = peers_[from];
+    auto snap = node_.snapshot();
+    std::uint64_t local = snap->height();
+    // the answer starts above a sparse locator entry, so it may repeat
+    // blocks we have before it reaches the fork
+    std::size_t known = 0;
+    while (known < got.size() && start + known <= local && got[known].hash == snap->blocks[start + known].hash) {
+      ++known;
+    }
+    got.erase(got.begin(), got.begin() + known);
+    start += known;
+    bool extends_branch = !headers_.empty() && !got.empty() && start == headers_base_ + headers_.size() &&
+                          got[0].prev_hash == headers_.back().hash;
+    bool forks_ours = !extends_branch && !got.empty() && start >= 1 && start <= local + 1 &&
+                      got[0].prev_hash == snap->blocks[start - 1].hash;
+    if (got.empty()) {
+      // nothing we lack: its tip was stale, or it shares no block with us
+      peer.forgetTip();
+    } else if (!extends_branch && !forks_ours && start > local + 1) {
+      requestHeadersLocked(&out);  // our chain got shorter meanwhile; ask again
+    } else {
+      if (forks_ours && !headers_.empty()) resetLocked();  // a different branch replaces the one we had
+      // each header must carry the difficulty our retarget rule requires at
+      // its height, not just meet the one it claims
+      auto mine_ms_at = [&](std::uint64_t h) {
+        if (h >= start) return got[h - start].mine_ms;
+        if (h >= headers_base_ && h - headers_base_ < headers_.size()) return headers_[h - headers_base_].mine_ms;
+        return snap->blocks[h].mine_ms;
+      };
+      std::string prev;
+      int required = 0;
+      if (extends_branch) {
+        prev = headers_.back().hash;
+        required = Blockchain::nextDifficulty(params, headers_.back().difficulty, headers_.back().index, mine_ms_at);
+      } else if (forks_ours) {
+        prev = snap->blocks[start - 1].hash;
+        // each of our blocks carries the difficulty required at its height,
+        // which depends only on the blocks below it
+        required = start <= local ? snap->blocks[start].difficulty : snap->difficulty;
+      }
+      bool ok = extends_branch || forks_ours;
+      for (std::size_t i = 0; ok && i < got.size(); ++i) {
+        ok = got[i].index == start + i && got[i].prev_hash == prev && got[i].difficulty == required &&
+             header_is_valid(got[i]);
+        prev = got[i].hash;
+        required = Blockchain::nextDifficulty(params, required, got[i].index, mine_ms_at);
+      }
+      if (!ok) {
+        // bogus headers, or a peer that does not follow its own chain
+        ++stats_.bad_peers;
+        peer.forgetTip();
+      } else {
+        if (headers_.empty()) headers_base_ = start;
+        for (auto& h : got) headers_.push_back(std::move(h));
+        peer.branch = true;
+        stats_.headers += got.size();
+        for (std::uint64_t h = start; h < start + got.size(); h += opts_.blocks_per_request) {
+          todo_.emplace_back(h, std::min<std::uint64_t>(opts_.blocks_per_request, start + got.size() - h));
+        }
+      }
+      requestHeadersLocked(&out);
+    }
+    assignLocked(&out);
+  }
+  send(out);
+}
+
+void ChainSync::assignLocked(Outbox* out) {
+  std::size_t inflight_blocks = 0;
+  for (const auto& kv : inflight_) inflight_blocks += kv.second.count;
+  // peers known to be on the branch: those that sent its headers, and any
+  // that reported the same tip as one of them or as its last header
+  std::set<std::string> branch_tips;
+  if (!headers_.empty()) branch_tips.insert(headers_.back().hash);
+  for (const auto& kv : peers_) {
+    if (kv.second.branch) branch_tips.insert(kv.second.tip);
+  }
+  auto on_branch = [&](const PeerInfo& p) { return p.branch || branch_tips.count(p.tip) != 0; };
+  while (!todo_.empty() && bodies_.size() + inflight_blocks < opts_.max_buffered_blocks) {
+    auto [start, count] = todo_.front();
+    // least loaded peer on the branch whose chain covers the whole range
+    auto best = peers_.end();
+    for (auto it = peers_.begin(); it != peers_.end(); ++it) {
+      if (!on_branch(it->second) || it->second.height < start + count - 1 ||
+          it->second.inflight >= opts_.max_inflight_per_peer) {
+        continue;
+      }
+      if (best == peers_.end() || it->second.inflight < best->second.inflight) best = it;
+    }
+    if (best == peers_.end()) break;
+    todo_.pop_front();
+    ++best->second.inflight;
+    inflight_[start] = Request{count, best->first, std::chrono::steady_clock::now()};
+    inflight_blocks += count;
+    ++stats_.requests;
+    out->emplace_back(best->first, WireWriter(MsgType::GetBlocks, self_).u64(start).u64(count).finish());
+  }
+}
+
+void ChainSync::onGetBlocks(WireReader& msg) {
+  auto snap = node_.snapshot();
+  std::uint64_t start = msg.u64();
+  std::uint64_t count = msg.u64();
+  std::uint64_t end = std::min<std::uint64_t>(start + std::min(count, kMaxServeBlocks), snap->blocks.size());
+  std::vector<std::shared_ptr<const Block>> bodies;  // stop at the first pruned one
+  for (std::uint64_t h = start; h < end; ++h) {
+    auto b = snap->body(h);
+    if (!b) break;
+    bodies.push_back(std::move(b));
+  }
+  const std::uint64_t n = bodies.size();
+  std::string self;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    stats_.served_blocks += n;
+    self = self_;
+  }
+  WireWriter w(MsgType::Blocks, self);
+  w.u64(start).u64(n);
+  for (const auto& b : bodies) w.block(*b);
+  send_(msg.from(), w.finish());
+}
+
+void ChainSync::onBlocks(WireReader& msg) {
+  const std::string& from = msg.from();
+  std::uint64_t start = msg.u64();
+  std::uint64_t n = msg.count(kMaxServeBlocks);
+  std::vector<Block> got;
+  got.reserve(n);
+  for (std::uint64_t i = 0; i < n; ++i) got.push_back(msg.block());
+
+  Outbox out;
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = inflight_.find(start);
+    if (it == inflight_.end() || it->second.peer != from) return;  // late, or not ours
+    std::uint64_t count = it->second.count;
+    inflight_.erase(it);
+    PeerInfo& peer = peers_[from];
+    if (peer.inflight) --peer.inflight;
+
+    std::uint64_t received = 0;
+    for (; received < got.size() && received < count; ++received) {
+      std::uint64_t h = start + received;
+      const Block& b = got[received];
+      // must be the body of the header we verified, and match its Merkle root
+      bool ok = h >= headers_base_ && h - headers_base_ < headers_.size() &&
+                b.hash == headers_[h - headers_base_].hash && block_merkle_matches(b);
+      if (!ok) {
+        ++stats_.bad_peers;
+        peer.forgetTip();
+        break;
+      }
+      bodies_.emplace(h, got[received]);
+      ++stats_.blocks_downloaded;
+    }
+    if (received < count) {
+      // short or bad answer: someone else fetches the rest
+      if (received == 0 && peer.height) peer.height = std::min(peer.height, start - 1);
+      todo_.emplace_front(start + received, count - received);
+    }
+    assignLocked(&out);
+  }
+  cv_.notify_all();
+  send(out);
+}
+
+void ChainSync::resetLocked() {
+  headers_.clear();
+  headers_peer_.clear();
+  todo_.clear();
+  inflight_.clear();
+  bodies_.clear();
+  for (auto& kv : peers_) {
+    kv.second.inflight = 0;
+    kv.second.branch = false;
+  }
+}
+
+void ChainSync::run() {
+  using clock = std::chrono::steady_clock;
+  auto next_poll = clock::now();
+  std::unique_lock<std::mutex> lk(mu_);
+  while (!stopping_) {
+    Outbox out;
+
+    // apply downloaded blocks in height order; the network thread keeps
+    // receiving later ranges meanwhile
+    for (;;) {
+      auto snap = node_.snapshot();
+      std::uint64_t local = snap->height();
+      // headers now on our chain (applied, or arrived through relay) are done
+      while (!headers_.empty() && headers_base_ <= local && snap->blocks[headers_base_].hash == headers_.front().hash) {
+        headers_.pop_front();
+        ++headers_base_;
+      }
+      bodies_.erase(bodies_.begin(), bodies_.lower_bound(headers_base_));
+      if (headers_.empty()) bodies_.clear();
+      if (bodies_.empty() || bodies_.begin()->first != headers_base_) break;
+
+      if (headers_base_ == local + 1) {
+        Block b = std::move(bodies_.begin()->second);
+        bodies_.erase(bodies_.begin());
+        lk.unlock();
+        std::string err;
+        bool ok = node_.submitBlock(b, &err);
+        lk.lock();
+        if (!ok) {
+          // headers checked out but the body does not apply: start over
+          ++stats_.bad_peers;
+          resetLocked();
+          break;
+        }
+        ++stats_.blocks_applied;
+        continue;
+      }
+
+      // the branch forks below our tip: switch to it once the part we have
+      // outweighs the blocks it replaces
+      std::vector<const Block*> have;  // downloaded without a gap from headers_base_
+      std::uint64_t theirs = 0, ours = 0;
+      for (auto it = bodies_.begin(); it != bodies_.end() && it->first == headers_base_ + have.size(); ++it) {
+        have.push_back(&it->second);
+        theirs += block_work(it->second.difficulty);
+      }
+      for (std::uint64_t h = headers_base_; h <= local; ++h) ours += block_work(snap->blocks[h].difficulty);
+      if (!chain_outweighs(theirs, have.back()->hash, ours, snap->tip().hash)) {
+        if (have.size() == headers_.size() && headers_peer_.empty()) {
+          // all of it is here and it still does not: drop it until its peers
+          // report a new tip
+          for (auto& kv : peers_) {
+            if (kv.second.branch) kv.second.forgetTip();
+          }
+          resetLocked();
+        }
+        break;
+      }
+      std::vector<Block> branch;
+      branch.reserve(have.size());
+      for (const Block* blk : have) branch.push_back(*blk);
+      const std::uint64_t fork = headers_base_ - 1;
+      lk.unlock();
+      std::string err;
+      bool ok = node_.switchBranch(fork, branch, &err);
+      lk.lock();
+      if (!ok) {
+        ++stats_.bad_peers;
+        resetLocked();
+        break;
+      }
+      ++stats_.reorgs;
+      stats_.blocks_applied += branch.size();
+    }
+
+    auto now = clock::now();
+    for (auto it = inflight_.begin(); it != inflight_.end();) {
+      if (now - it->second.sent < opts_.request_timeout) {
+        ++it;
+        continue;
+      }
+      ++stats_.timeouts;
+      PeerInfo& p = peers_[it->second.peer];
+      if (p.inflight) --p.inflight;
+      p.forgetTip();  // unresponsive until it reports a tip again
+      todo_.emplace_front(it->first, it->second.count);
+      it = inflight_.erase(it);
+    }
+    if (!headers_peer_.empty() && now - headers_sent_ >= opts_.request_timeout) {
+      ++stats_.timeouts;
+      peers_[headers_peer_].forgetTip();
+      headers_peer_.clear();
+    }
+    if (now >= next_poll) {
+      for (const auto& kv : peers_) {
+        out.emplace_back(kv.first, WireWriter(MsgType::GetTip, self_).finish());
+      }
+      next_poll = now + opts_.tip_poll;
+    }
+    requestHeadersLocked(&out);
+    assignLocked(&out);
+
+    if (!out.empty()) {
+      lk.unlock();
+      send(out);
+      lk.lock();
+    }
+    cv_.wait_for(lk, kWorkerTick);
+  }
+}
+
+}  // namespace sbc
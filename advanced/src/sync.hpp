@@ -0,0 +1,144 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "node.hpp"
+#include "wire.hpp"
+
+namespace sbc {
+
+struct SyncOptions {
+  std::size_t headers_per_request = 500;
+  std::size_t blocks_per_request = 16;
+  std::size_t max_inflight_per_peer = 2;   // outstanding GETBLOCKS per peer
+  std::size_t max_buffered_blocks = 1024;  // downloaded but not yet applied
+  std::chrono::milliseconds request_timeout{5000};
+  std::chrono::milliseconds tip_poll{10000};  // re-ask peers for their tip
+};
+
+struct SyncStats {
+  std::uint64_t headers{};           // headers received and verified
+  std::uint64_t blocks_downloaded{};
+  std::uint64_t blocks_applied{};
+  std::uint64_t reorgs{};            // switched to a peer's branch that outweighed ours
+  std::uint64_t requests{};          // GETHEADERS + GETBLOCKS sent
+  std::uint64_t timeouts{};
+  std::uint64_t bad_peers{};         // sent headers or blocks that failed checks
+  std::uint64_t served_headers{};
+  std::uint64_t served_blocks{};
+};
+
+// Headers-first catch-up with peers, and fork choice:
+//
+//   GETTIP                      -> TIP     {height, hash, work}
+//   GETHEADERS {count, locator} -> HEADERS {start, headers}
+//   GETBLOCKS  {start, count}   -> BLOCKS  {start, blocks}
+//
+// When a peer reports a chain that outweighs ours (chain_outweighs: more
+// work, ties to the lower tip hash), headers are fetched from it in batches.
+// The locator lists (height, hash) of our tip and blocks below it at
+// doubling distances, so the peer answers from the fork point. Headers are
+// checked for linkage, the difficulty our retarget rule requires, and proof
+// of work; their heights are split into ranges downloaded in parallel from
+// every peer on that branch whose tip covers them. A background thread
+// applies downloaded blocks in height order while later ranges are still in
+// flight, re-requests ranges that time out, and polls peer tips. A branch
+// that forks below our tip is switched to (Node::switchBranch) once the
+// bodies downloaded so far outweigh the blocks it replaces, so it has to do
+// so within max_buffered_blocks. Replies are served from the node's
+// published snapshot, so they never wait on the writer. Only the peers
+// passed to start() are served, polled or synced from; messages naming any
+// other sender are ignored.
+class ChainSync {
+ public:
+  using SendFn = std::function<void(const std::string& peer, const std::string& msg)>;
+
+  ChainSync(Node& node, SendFn send, SyncOptions opts = {});
+  ~ChainSync();
+  ChainSync(const ChainSync&) = delete;
+  ChainSync& operator=(const ChainSync&) = delete;
+
+  void setSelfAddress(std::string addr);  // "host:port" peers reply to
+  // Start the worker and ask these peers for their tip; calling it again
+  // adds more peers.
+  void start(const std::vector<std::string>& peers);
+  void stop();
+
+  // Handle a peer message; false if its type is not a sync message.
+  bool handle(WireReader& msg);
+  // A peer announced a block above our tip + 1, or one on another branch:
+  // ask it where its tip is (ignored unless it is one of ours).
+  void peerAhead(const std::string& peer);
+
+  // True while headers or blocks are outstanding or waiting to be applied.
+  bool syncing() const;
+  SyncStats stats() const;
+
+ private:
+  struct PeerInfo {
+    std::uint64_t height{};
+    std::uint64_t work{};
+    std::string tip;
+    std::size_t inflight{};
+    bool branch{};  // sent headers of the branch being downloaded
+
+    void forgetTip() {
+      height = work = 0;
+      tip.clear();
+      branch = false;
+    }
+  };
+  struct Request {
+    std::uint64_t count{};
+    std::string peer;
+    std::chrono::steady_clock::time_point sent;
+  };
+  using Outbox = std::vector<std::pair<std::string, std::string>>;  // (peer, msg)
+
+  void onTip(WireReader& msg);
+  void onGetHeaders(WireReader& msg);
+  void onHeaders(WireReader& msg);
+  void onGetBlocks(WireReader& msg);
+  void onBlocks(WireReader& msg);
+  void run();
+  void send(const Outbox& out);  // without mu_ held
+  bool knownPeer(const std::string& peer) const;
+
+  // *Locked helpers run with mu_ held and queue messages in *out.
+  void requestHeadersLocked(Outbox* out);
+  void assignLocked(Outbox* out);
+  void resetLocked();
+
+  Node& node_;
+  SendFn send_;
+  SyncOptions opts_;
+  mutable std::mutex mu_;
+  std::condition_variable cv_;  // blocks arrived, or stopping
+  bool stopping_ = false;
+  std::thread th_;
+  std::string self_;
+  std::map<std::string, PeerInfo> peers_;
+  std::deque<Block> headers_;                    // verified branch, not yet applied; [0] is at headers_base_
+  std::uint64_t headers_base_ = 0;
+  std::string headers_peer_;                     // peer a GETHEADERS is outstanding with
+  std::chrono::steady_clock::time_point headers_sent_;
+  std::deque<std::pair<std::uint64_t, std::uint64_t>> todo_;  // (start, count) to download
+  std::map<std::uint64_t, Request> inflight_;                 // by start height
+  std::map<std::uint64_t, Block> bodies_;                     // by height, awaiting apply
+  SyncStats stats_;
+};
+
+}  // namespace sbc
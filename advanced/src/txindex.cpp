@@ -0,0 +1,72 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "txindex.hpp"
+
+namespace sbc {
+
+void TxIndex::addBlock(const Block& b) {
+  for (std::size_t i = 0; i < b.transactions.size(); ++i) {
+    const Tx& tx = b.transactions[i];
+    TxLocation loc{b.index, (std::uint32_t)i};
+    by_txid_[tx.hash()] = loc;
+    by_addr_[tx.to_addr].push_back(loc);
+    if (!tx.from_pubkey_pem.empty()) {
+      auto from = Tx::addr_from_pubkey(tx.from_pubkey_pem);
+      if (from != tx.to_addr) by_addr_[from].push_back(loc);
+    }
+  }
+}
+
+void TxIndex::removeBlock(const Block& b) {
+  auto unpost = [&](const std::string& addr) {
+    auto it = by_addr_.find(addr);
+    if (it == by_addr_.end()) return;
+    // posting lists are in chain order, so the tip's entries are at the back
+    while (!it->second.empty() && it->second.back().height == b.index) it->second.pop_back();
+    if (it->second.empty()) by_addr_.erase(it);
+  };
+  for (const auto& tx : b.transactions) {
+    auto it = by_txid_.find(tx.hash());
+    if (it != by_txid_.end() && it->second.height == b.index) by_txid_.erase(it);
+    unpost(tx.to_addr);
+    if (!tx.from_pubkey_pem.empty()) unpost(Tx::addr_from_pubkey(tx.from_pubkey_pem));
+  }
+}
+
+void TxIndex::clear() {
+  by_txid_.clear();
+  by_addr_.clear();
+}
+
+std::optional<TxLocation> TxIndex::find(const std::string& txid) const {
+  auto it = by_txid_.find(txid);
+  if (it == by_txid_.end()) return std::nullopt;
+  return it->second;
+}
+
+const std::vector<TxLocation>& TxIndex::history(const std::string& addr) const {
+  static const std::vector<TxLocation> kEmpty;
+  auto it = by_addr_.find(addr);
+  return it == by_addr_.end() ? kEmpty : it->second;
+}
+
+std::size_t TxIndex::memoryUsage() const {
+  // node = key + value + next pointer + cached hash; one pointer per bucket
+  std::size_t bytes = by_txid_.bucket_count() * sizeof(void*) +
+                      by_addr_.bucket_count() * sizeof(void*);
+  for (const auto& kv : by_txid_) {
+    bytes += sizeof(kv) + 2 * sizeof(void*);
+    if (kv.first.capacity() > 15) bytes += kv.first.capacity() + 1;  // beyond SSO
+  }
+  for (const auto& kv : by_addr_) {
+    bytes += sizeof(kv) + 2 * sizeof(void*);
+    if (kv.first.capacity() > 15) bytes += kv.first.capacity() + 1;
+    bytes += kv.second.capacity() * sizeof(TxLocation);
+  }
+  return bytes;
+}
+
+}  // namespace sbc
@@ -0,0 +1,46 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "block.hpp"
+
+namespace sbc {
+
+struct TxLocation {
+  std::uint64_t height{};
+  std::uint32_t position{};  // index into Block::transactions
+};
+
+// Optional secondary indexes over committed blocks:
+//   tx id   -> where it was mined
+//   address -> every tx that sent from or paid to it (posting list, chain order)
+class TxIndex {
+ public:
+  void addBlock(const Block& b);
+  // Undo addBlock for the tip block (a reorg dropping it).
+  void removeBlock(const Block& b);
+  void clear();
+
+  std::optional<TxLocation> find(const std::string& txid) const;
+  // Empty if the address never appeared.
+  const std::vector<TxLocation>& history(const std::string& addr) const;
+
+  std::size_t txCount() const noexcept { return by_txid_.size(); }
+  std::size_t addressCount() const noexcept { return by_addr_.size(); }
+  // Approximate heap footprint in bytes (keys, nodes, buckets, posting lists).
+  std::size_t memoryUsage() const;
+
+ private:
+  std::unordered_map<std::string, TxLocation> by_txid_;
+  std::unordered_map<std::string, std::vector<TxLocation>> by_addr_;
+};
+
+}  // namespace sbc
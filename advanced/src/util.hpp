@@ -4,10 +4,14 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 */
 
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace util {
 inline std::string now_iso8601() {
@@ -24,4 +28,42 @@ inline std::string now_iso8601() {
   oss << std::put_time(&tm, "%Y-%m-%dT%H:%M:%SZ");
   return oss.str();
 }
+
+// Runs ok(i) for every i in [begin, end) across hardware threads and returns
+// the lowest i for which ok(i) is false (or end if none). Work is handed out
+// in chunks; chunks above an already-found failure are skipped.
+template <class Pred>
+std::size_t parallel_first_failure(std::size_t begin, std::size_t end, Pred ok) {
+  constexpr std::size_t kChunk = 256;
+  std::size_t n = end > begin ? end - begin : 0;
+  std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<std::size_t>(threads, (n + kChunk - 1) / kChunk);
+  if (threads <= 1) {
+    for (std::size_t i = begin; i < end; ++i) if (!ok(i)) return i;
+    return end;
+  }
+  std::atomic<std::size_t> next{begin};
+  std::atomic<std::size_t> first_bad{end};
+  auto worker = [&] {
+    for (;;) {
+      std::size_t lo = next.fetch_add(kChunk);
+      if (lo >= end || lo >= first_bad.load()) return;
+      std::size_t hi = std::min(end, lo + kChunk);
+      for (std::size_t i = lo; i < hi; ++i) {
+        if (!ok(i)) {
+          std::size_t cur = first_bad.load();
+          while (i < cur && !first_bad.compare_exchange_weak(cur, i)) {
+          }
+          break;
+        }
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (std::size_t t = 1; t < threads; ++t) pool.emplace_back(worker);
+  worker();
+  for (auto& t : pool) t.join();
+  return first_bad.load();
+}
+
 }  // namespace util
@@ -0,0 +1,173 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "wire.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "p2p.hpp"
+#include "storage.hpp"
+
+namespace sbc {
+
+namespace {
+
+void put_u32(char* p, std::uint32_t v) {
+  for (int i = 0; i < 4; ++i) p[i] = (char)(v >> (8 * i));
+}
+
+std::uint32_t get_u32(const char* p) {
+  std::uint32_t v = 0;
+  for (int i = 0; i < 4; ++i) v |= (std::uint32_t)(std::uint8_t)p[i] << (8 * i);
+  return v;
+}
+
+bool fail(std::string* err, const char* what) {
+  if (err) *err = what;
+  return false;
+}
+
+}  // namespace
+
+const char* msg_type_name(MsgType t) {
+  switch (t) {
+    case MsgType::NewBlock: return "NEWBLOCK";
+    case MsgType::CmpctBlock: return "CMPCTBLOCK";
+    case MsgType::BlockTxn: return "BLOCKTXN";
+    case MsgType::GetBlockTxn: return "GETBLOCKTXN";
+    case MsgType::GetBlock: return "GETBLOCK";
+    case MsgType::GetTip: return "GETTIP";
+    case MsgType::Tip: return "TIP";
+    case MsgType::GetHeaders: return "GETHEADERS";
+    case MsgType::Headers: return "HEADERS";
+    case MsgType::GetBlocks: return "GETBLOCKS";
+    case MsgType::Blocks: return "BLOCKS";
+    case MsgType::Inv: return "INV";
+    case MsgType::GetTx: return "GETTX";
+    case MsgType::Tx: return "TX";
+  }
+  return "?";
+}
+
+bool peek_wire_header(std::string_view frame, MsgType* type, std::string* err) {
+  if (frame.size() < kWireHeaderBytes || std::memcmp(frame.data(), kWireMagic, 4) != 0) {
+    return fail(err, "not a wire message");
+  }
+  if ((std::uint8_t)frame[4] != kWireVersion) return fail(err, "unsupported wire version");
+  auto t = (std::uint8_t)frame[5];
+  if (t == 0 || t > kMaxMsgType) return fail(err, "unknown message type");
+  if (get_u32(frame.data() + 8) != frame.size() - kWireHeaderBytes) return fail(err, "bad message length");
+  *type = static_cast<MsgType>(t);
+  return true;
+}
+
+WireWriter::WireWriter(MsgType type, std::string_view from) : type_(type) { codec::put_str(payload_, from); }
+
+WireWriter& WireWriter::u64(std::uint64_t v) {
+  codec::put_varint(payload_, v);
+  return *this;
+}
+
+WireWriter& WireWriter::hex(std::string_view s) {
+  codec::put_hex(payload_, s);
+  return *this;
+}
+
+WireWriter& WireWriter::str(std::string_view s) {
+  codec::put_str(payload_, s);
+  return *this;
+}
+
+WireWriter& WireWriter::block(const Block& b) {
+  codec::put_str(payload_, encode_block_binary(b));
+  return *this;
+}
+
+WireWriter& WireWriter::txs(const std::vector<Tx>& txs) {
+  codec::put_str(payload_, encode_txs_binary(txs));
+  return *this;
+}
+
+WireWriter& WireWriter::bytes(std::string_view raw) {
+  payload_.append(raw.data(), raw.size());
+  return *this;
+}
+
+std::string WireWriter::finish() const {
+  if (payload_.size() > p2p::kMaxMessageBytes - kWireHeaderBytes) throw std::length_error("wire message too large");
+  std::string out(kWireHeaderBytes, '\0');
+  std::memcpy(&out[0], kWireMagic, 4);
+  out[4] = (char)kWireVersion;
+  out[5] = (char)type_;
+  put_u32(&out[8], (std::uint32_t)payload_.size());
+  put_u32(&out[12], storage::crc32(payload_));
+  out.reserve(kWireHeaderBytes + payload_.size());
+  out += payload_;
+  return out;
+}
+
+WireReader::WireReader(std::string_view frame) {
+  std::string err;
+  if (!peek_wire_header(frame, &type_, &err)) throw std::runtime_error(err);
+  r_.in = frame.substr(kWireHeaderBytes);
+  if (storage::crc32(r_.in) != get_u32(frame.data() + 12)) throw std::runtime_error("message checksum mismatch");
+  from_ = str();
+}
+
+void WireReader::check() {
+  if (!r_.ok) throw std::runtime_error(std::string("malformed ") + msg_type_name(type_) + " message");
+}
+
+std::uint64_t WireReader::u64() {
+  std::uint64_t v = r_.varint();
+  check();
+  return v;
+}
+
+std::uint64_t WireReader::count(std::uint64_t max) {
+  std::uint64_t n = u64();
+  if (n > max || n > r_.in.size() - r_.pos) r_.ok = false;  // every element takes a byte or more
+  check();
+  return n;
+}
+
+std::string WireReader::hex() {
+  std::string s = r_.hex();
+  check();
+  return s;
+}
+
+std::string WireReader::str() {
+  std::string s = r_.str();
+  check();
+  return s;
+}
+
+std::string_view WireReader::bytes(std::size_t n) {
+  auto v = r_.bytes(n);
+  check();
+  return v;
+}
+
+Block WireReader::block() {
+  auto raw = r_.bytes(r_.varint());
+  check();
+  Block b;
+  std::string err;
+  if (!decode_block_binary(raw, &b, &err)) throw std::runtime_error(err);
+  return b;
+}
+
+std::vector<Tx> WireReader::txs() {
+  auto raw = r_.bytes(r_.varint());
+  check();
+  std::vector<Tx> out;
+  std::string err;
+  if (!decode_txs_binary(raw, &out, &err)) throw std::runtime_error(err);
+  return out;
+}
+
+}  // namespace sbc
@@ -0,0 +1,103 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "block.hpp"
+#include "codec.hpp"
+
+namespace sbc {
+
+// Peer message types. Values are part of the wire format.
+enum class MsgType : std::uint8_t {
+  NewBlock = 1,  // block
+  CmpctBlock,    // compact block (see CompactBlock::write)
+  BlockTxn,      // hex hash, txs
+  GetBlockTxn,   // hex hash, varint count, varint index...
+  GetBlock,      // hex hash
+  GetTip,        // -
+  Tip,           // varint height, hex hash, varint work
+  GetHeaders,    // varint count, varint n, (varint height, hex hash) x n: locator
+  Headers,       // varint start, varint count, block... (header only)
+  GetBlocks,     // varint start, varint count
+  Blocks,        // varint start, varint count, block...
+  Inv,           // varint count, hex txid...
+  GetTx,         // varint count, hex txid...
+  Tx,            // txs
+};
+constexpr std::uint8_t kMaxMsgType = static_cast<std::uint8_t>(MsgType::Tx);
+
+const char* msg_type_name(MsgType t);  // "NEWBLOCK", "CMPCTBLOCK", ...
+
+// Peer message (wire format version 2), sent as one p2p frame:
+//
+//   u8[4] magic "SBCW", u8 version, u8 type, u16 reserved (0),
+//   u32 payload length, u32 crc32(payload)          little-endian
+//   payload: str from (sender's listen address), then the type's fields
+//
+// Fields use the block codec's primitives (varints, hex as raw bytes);
+// "block" is a varint length plus the codec's binary block encoding, "txs"
+// a varint length plus a codec tx list. Readers decode blocks and txs
+// straight from the received frame without copying it.
+constexpr char kWireMagic[4] = {'S', 'B', 'C', 'W'};
+constexpr std::uint8_t kWireVersion = 2;
+constexpr std::size_t kWireHeaderBytes = 16;
+
+// Validate a frame's header (magic, version, type, length) without touching
+// the payload; true and *type set when it looks like a message we handle.
+bool peek_wire_header(std::string_view frame, MsgType* type, std::string* err = nullptr);
+
+class WireWriter {
+ public:
+  WireWriter(MsgType type, std::string_view from);
+
+  WireWriter& u64(std::uint64_t v);
+  WireWriter& hex(std::string_view s);
+  WireWriter& str(std::string_view s);
+  WireWriter& block(const Block& b);
+  WireWriter& txs(const std::vector<Tx>& txs);
+  WireWriter& bytes(std::string_view raw);  // appended as is
+
+  std::string finish() const;  // header + payload
+
+ private:
+  MsgType type_;
+  std::string payload_;
+};
+
+// Cursor over one received message. The frame must outlive the reader.
+// Fields are read in the order they were written; every accessor throws
+// std::runtime_error on malformed input, as does the constructor for a bad
+// header or checksum.
+class WireReader {
+ public:
+  explicit WireReader(std::string_view frame);
+
+  MsgType type() const noexcept { return type_; }
+  const std::string& from() const noexcept { return from_; }
+
+  std::uint64_t u64();
+  // A list length, rejected above max (so it can size a vector safely).
+  std::uint64_t count(std::uint64_t max);
+  std::string hex();
+  std::string str();
+  std::string_view bytes(std::size_t n);
+  Block block();
+  std::vector<Tx> txs();
+  bool atEnd() const noexcept { return r_.pos == r_.in.size(); }
+
+ private:
+  void check();
+  MsgType type_;
+  std::string from_;
+  codec::Reader r_;
+};
+
+}  // namespace sbc
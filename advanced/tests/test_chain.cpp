@@ -6,8 +6,15 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 #include "gtest/gtest.h"
 #include "blockchain.hpp"
 #include "crypto.hpp"
+#include "merkle.hpp"
+#include "node.hpp"
 #include "tx.hpp"
 
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <vector>
+
 using namespace sbc;
 
 TEST(AdvancedChain, MineAndValidate) {
@@ -32,3 +39,688 @@ TEST(AdvancedChain, MineAndValidate) {
   bc.minePending(addr);
   EXPECT_TRUE(bc.isValid());
 }
+
+TEST(AdvancedChain, ConcurrentIntakeAndPeerBlocks) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Node node{Blockchain(p)};
+  Node peer{Blockchain(p)};
+
+  constexpr int kProducers = 4;
+  constexpr int kTxsEach = 8;
+  std::vector<std::pair<std::string, std::string>> keys;
+  for (int i = 0; i < kProducers; ++i) keys.push_back(crypto::generate_ec_keypair());
+  for (const auto& kp : keys) node.mine(Tx::addr_from_pubkey(kp.second));
+
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kProducers; ++i) {
+    producers.emplace_back([&, i] {
+      for (int n = 1; n <= kTxsEach; ++n) {
+        Tx tx;
+        tx.from_pubkey_pem = keys[i].second;
+        tx.to_addr = "deadbeefcafebabe0123";
+        tx.amount = 1;
+        tx.nonce = n;
+        tx.signature_hex = crypto::ecdsa_sign_p256(keys[i].first, tx.message());
+        node.submitTx(tx);
+      }
+    });
+  }
+  // A "network" thread keeps feeding blocks that do not link; they must be rejected safely.
+  std::thread net([&] {
+    Block junk = peer.mine("feedface");
+    for (int n = 0; n < 50; ++n) node.submitBlock(junk);
+  });
+  for (auto& t : producers) t.join();
+  net.join();
+
+  Block b = node.mine("feedface");
+  EXPECT_EQ(b.transactions.size(), (std::size_t)(kProducers * kTxsEach) + 1);  // + coinbase
+  node.withChain([&](const Blockchain& bc) {
+    EXPECT_TRUE(bc.isValid());
+    EXPECT_EQ(bc.state().state().balance.at("deadbeefcafebabe0123"), kProducers * kTxsEach);
+  });
+}
+
+TEST(AdvancedChain, SnapshotReadersDuringMining) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Node node{Blockchain(p)};
+  auto before = node.snapshot();
+
+  std::atomic<bool> done{false};
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 3; ++r) {
+    readers.emplace_back([&] {
+      std::uint64_t last = 0;
+      while (!done.load()) {
+        auto s = node.snapshot();
+        ASSERT_GE(s->height(), last);
+        last = s->height();
+        // every block in the view links to its predecessor, and the miner's
+        // balance matches exactly the coinbases in this view
+        for (std::size_t i = 1; i < s->blocks.size(); ++i) {
+          ASSERT_EQ(s->blocks[i].prev_hash, s->blocks[i - 1].hash);
+        }
+        ASSERT_EQ(s->balanceOf("miner"), (std::int64_t)(50 * s->height()));
+      }
+    });
+  }
+  for (int i = 0; i < 20; ++i) node.mine("miner");
+  done = true;
+  for (auto& t : readers) t.join();
+
+  EXPECT_EQ(before->height(), 0u);
+  EXPECT_EQ(node.snapshot()->height(), 20u);
+  EXPECT_EQ(node.snapshot()->balanceOf("miner"), 1000);
+}
+
+TEST(AdvancedChain, AccountTableCopiesAreIsolatedAndShareStructure) {
+  CowMap<std::int64_t> m;
+  for (int i = 0; i < 5000; ++i) m["addr" + std::to_string(i)] = i;
+  const CowMap<std::int64_t> snap = m;  // O(1): shares every node
+  for (int i = 0; i < 5000; i += 7) m["addr" + std::to_string(i)] += 1000;
+  m["new"] = 1;
+
+  EXPECT_EQ(snap.size(), 5000u);
+  EXPECT_EQ(m.size(), 5001u);
+  EXPECT_EQ(snap.at("addr7"), 7);
+  EXPECT_EQ(m.at("addr7"), 1007);
+  EXPECT_EQ(snap.count("new"), 0u);
+  std::size_t seen = 0;
+  std::int64_t sum = 0;
+  for (const auto& kv : snap) {
+    ++seen;
+    sum += kv.second;
+  }
+  EXPECT_EQ(seen, 5000u);
+  EXPECT_EQ(sum, 4999 * 5000 / 2);
+  EXPECT_FALSE(snap == m);
+  CowMap<std::int64_t> again = snap;
+  again["addr0"] = 0;  // same value: still equal
+  EXPECT_TRUE(again == snap);
+}
+
+TEST(AdvancedChain, BulkBuiltAccountTableMatchesInserts) {
+  std::vector<std::pair<std::string, std::int64_t>> items;
+  CowMap<std::int64_t> inserted;
+  for (int i = 0; i < 5000; ++i) {
+    items.emplace_back("addr" + std::to_string(i), i);
+    inserted["addr" + std::to_string(i)] = i;
+  }
+  CowMap<std::int64_t> built = CowMap<std::int64_t>::build(items);
+  EXPECT_EQ(built.size(), 5000u);
+  EXPECT_TRUE(built == inserted);
+  std::size_t seen = 0;
+  for (const auto& kv : built) seen += inserted.at(kv.first) == kv.second;
+  EXPECT_EQ(seen, 5000u);
+
+  // a built map takes writes like any other, without disturbing its copies
+  const CowMap<std::int64_t> snap = built;
+  built["addr7"] += 1000;
+  built["new"] = 1;
+  EXPECT_EQ(snap.at("addr7"), 7);
+  EXPECT_EQ(built.at("addr7"), 1007);
+  EXPECT_EQ(built.size(), 5001u);
+  EXPECT_TRUE(CowMap<std::int64_t>::build({}).empty());
+}
+
+TEST(AdvancedChain, PipelinedMiningPicksUpLateTxs) {
+  Blockchain::Params p; p.initial_difficulty = 2; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Node node{Blockchain(p)};
+  auto kp = crypto::generate_ec_keypair();
+  auto addr = Tx::addr_from_pubkey(kp.second);
+  node.mine(addr);
+
+  constexpr int kTxs = 12;
+  std::thread producer([&] {
+    for (int n = 1; n <= kTxs; ++n) {
+      Tx tx;
+      tx.from_pubkey_pem = kp.second;
+      tx.to_addr = "deadbeefcafebabe0123";
+      tx.amount = 1;
+      tx.nonce = n;
+      tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+      node.submitTx(tx);
+    }
+  });
+  auto blocks = node.mineBlocks(6, addr);
+  producer.join();
+  blocks.push_back(node.mine(addr));  // sweep anything that arrived after the last template
+
+  ASSERT_EQ(blocks.size(), 7u);
+  for (std::size_t i = 1; i < blocks.size(); ++i) EXPECT_EQ(blocks[i].prev_hash, blocks[i - 1].hash);
+  auto snap = node.snapshot();
+  EXPECT_EQ(snap->height(), 8u);
+  EXPECT_EQ(snap->balanceOf("deadbeefcafebabe0123"), kTxs);
+  EXPECT_EQ(snap->nonceOf(addr), (std::uint64_t)kTxs);
+  node.withChain([](const Blockchain& bc) {
+    EXPECT_TRUE(bc.isValid());
+    EXPECT_TRUE(bc.pending().empty());
+  });
+}
+
+TEST(AdvancedChain, TemplatesKeepTxsThatMayApplyLater) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Blockchain bc(p);
+  auto kp = crypto::generate_ec_keypair();
+  auto addr = Tx::addr_from_pubkey(kp.second);
+  bc.minePending(addr);
+  auto make = [&](std::uint64_t nonce) {
+    Tx tx;
+    tx.from_pubkey_pem = kp.second;
+    tx.to_addr = "deadbeefcafebabe0123";
+    tx.amount = 1;
+    tx.nonce = nonce;
+    tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+    return tx;
+  };
+
+  // out of order, a gap, an unfunded transfer and a forged signature
+  bc.addTransaction(make(2));
+  bc.addTransaction(make(1));
+  bc.addTransaction(make(4));
+  Tx big = make(5);
+  big.amount = 1000;
+  big.signature_hex = crypto::ecdsa_sign_p256(kp.first, big.message());
+  bc.addTransaction(big);
+  Tx forged = make(3);
+  forged.signature_hex = make(2).signature_hex;
+  bc.addTransaction(forged);
+
+  const Block& b1 = bc.minePending("miner");
+  ASSERT_EQ(b1.transactions.size(), 3u);  // coinbase, nonce 1, nonce 2
+  EXPECT_EQ(b1.transactions[1].nonce, 1u);
+  EXPECT_EQ(b1.transactions[2].nonce, 2u);
+  ASSERT_EQ(bc.pending().size(), 2u);  // nonce 4 and the unfunded one wait; the forgery is gone
+  EXPECT_EQ(bc.pending()[0].nonce, 4u);
+
+  bc.addTransaction(make(3));
+  const Block& b2 = bc.minePending("miner");
+  ASSERT_EQ(b2.transactions.size(), 3u);  // coinbase, nonce 3, nonce 4
+  EXPECT_EQ(bc.state().state().nonce.at(addr), 4u);
+  ASSERT_EQ(bc.pending().size(), 1u);
+  EXPECT_EQ(bc.pending()[0].amount, 1000u);
+
+  // once its nonce is taken by another tx it can never apply, and is evicted
+  bc.addTransaction(make(5));
+  bc.minePending("miner");
+  EXPECT_TRUE(bc.pending().empty());
+}
+
+TEST(AdvancedChain, TemplatesVerifyEachTxOnceAndBoundDeferredTxs) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Blockchain bc(p);
+  auto kp = crypto::generate_ec_keypair();
+  auto addr = Tx::addr_from_pubkey(kp.second);
+  bc.minePending(addr);
+  auto make = [&](std::uint64_t nonce) {
+    Tx tx;
+    tx.from_pubkey_pem = kp.second;
+    tx.to_addr = "deadbeefcafebabe0123";
+    tx.amount = 0;
+    tx.nonce = nonce;
+    tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+    return tx;
+  };
+
+  // nonces 1..20 in reverse order apply in one template, one check each
+  constexpr std::uint64_t kInOrder = 20;
+  for (std::uint64_t n = kInOrder; n >= 1; --n) bc.addTransaction(make(n));
+  // far past a gap: only the lowest kMaxDeferredPerSender stay pending
+  const std::uint64_t kAhead = Blockchain::kMaxDeferredPerSender + 6;
+  for (std::uint64_t n = kInOrder + 2; n < kInOrder + 2 + kAhead; ++n) bc.addTransaction(make(n));
+
+  BlockTemplate t = bc.buildTemplate("miner");
+  ASSERT_EQ(t.txs.size(), 1 + kInOrder);
+  for (std::uint64_t n = 1; n <= kInOrder; ++n) EXPECT_EQ(t.txs[n].nonce, n);
+  ASSERT_EQ(t.deferred.size(), Blockchain::kMaxDeferredPerSender);
+  EXPECT_EQ(t.deferred.front().nonce, kInOrder + 2);
+  ASSERT_EQ(t.rejected.size(), kAhead - Blockchain::kMaxDeferredPerSender);
+  EXPECT_EQ(bc.sigCache()->checks(), kInOrder + kAhead);
+
+  // a second template and the commit re-check nothing
+  bc.buildTemplate("miner");
+  bc.minePending("miner");
+  EXPECT_EQ(bc.sigCache()->checks(), kInOrder + kAhead);
+  EXPECT_EQ(bc.pending().size(), Blockchain::kMaxDeferredPerSender);
+  EXPECT_EQ(bc.state().state().nonce.at(addr), kInOrder);
+
+  // a sender waiting on funds is tried again once a later tx pays it
+  auto kp2 = crypto::generate_ec_keypair();
+  Tx spend;
+  spend.from_pubkey_pem = kp2.second;
+  spend.to_addr = "feed";
+  spend.amount = 5;
+  spend.nonce = 1;
+  spend.signature_hex = crypto::ecdsa_sign_p256(kp2.first, spend.message());
+  Tx fund = make(kInOrder + 1);
+  fund.to_addr = Tx::addr_from_pubkey(kp2.second);
+  fund.amount = 10;
+  fund.signature_hex = crypto::ecdsa_sign_p256(kp.first, fund.message());
+  StateMachine base = bc.state();
+  t = Blockchain::buildTemplate(base, {spend, fund}, "miner", bc.chain().size());
+  ASSERT_EQ(t.txs.size(), 3u);
+  EXPECT_EQ(t.txs[1].hash(), fund.hash());
+  EXPECT_EQ(t.txs[2].hash(), spend.hash());
+}
+
+TEST(AdvancedChain, FindBlockByHash) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Blockchain bc(p);
+  std::vector<std::string> hashes{bc.chain()[0].hash};
+  for (int i = 0; i < 5; ++i) hashes.push_back(bc.minePending("miner").hash);
+
+  auto loaded = Blockchain::fromJson(bc.toJson());
+  for (std::size_t h = 0; h < hashes.size(); ++h) {
+    ASSERT_NE(bc.findBlock(hashes[h]), nullptr);
+    EXPECT_EQ(bc.findBlock(hashes[h])->index, h);
+    EXPECT_EQ(loaded.heightOf(hashes[h]), std::optional<std::uint64_t>(h));
+  }
+  EXPECT_EQ(bc.findBlock(std::string(64, 'f')), nullptr);
+
+  // a block already on the chain is recognised as a duplicate, not re-appended
+  std::string err;
+  EXPECT_FALSE(bc.acceptBlock(bc.chain().back(), &err));
+  EXPECT_EQ(err, "duplicate block");
+}
+
+TEST(AdvancedChain, PeerBlocksMustCarryRequiredDifficulty) {
+  Blockchain::Params p; p.initial_difficulty = 2; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Blockchain bc(p);
+  bc.minePending("miner");
+
+  // a zero-work block meets its own difficulty field, but not the chain's
+  Block b = bc.makeBlock(bc.buildTemplate("peer"));
+  b.difficulty = 0;
+  mine_block(b);
+  std::string err;
+  EXPECT_FALSE(bc.acceptBlock(b, &err));
+  EXPECT_EQ(err, "unexpected difficulty");
+
+  b.difficulty = bc.difficulty();
+  mine_block(b);
+  EXPECT_TRUE(bc.acceptBlock(b, &err)) << err;
+}
+
+TEST(AdvancedChain, SwitchBranchRewindsStateAndRequeuesTxs) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 1000;
+  Blockchain base(p);
+  auto kp = crypto::generate_ec_keypair();
+  auto addr = Tx::addr_from_pubkey(kp.second);
+  base.minePending(addr);
+  base.minePending(addr);
+
+  // the other branch: three blocks on top of height 2
+  Blockchain other = base;
+  std::vector<Block> branch;
+  for (int i = 0; i < 3; ++i) branch.push_back(other.minePending("other"));
+
+  Node node{std::move(base)};
+  std::uint64_t replaced_at = 0;
+  std::vector<std::uint64_t> committed;
+  node.setReorgHook([&](std::uint64_t fork, const StateSnapshot&) { replaced_at = fork; });
+  node.setCommitHook([&](const Block& b) { committed.push_back(b.index); });
+  Tx tx;
+  tx.from_pubkey_pem = kp.second;
+  tx.to_addr = "deadbeefcafebabe0123";
+  tx.amount = 5;
+  tx.nonce = 1;
+  tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+  node.submitTx(tx);
+  node.mine(addr);
+  std::string tip = node.mine(addr).hash;
+  ASSERT_EQ(node.snapshot()->balanceOf("deadbeefcafebabe0123"), 5);
+  committed.clear();
+
+  // one block does not outweigh the two it would replace
+  std::string err;
+  EXPECT_FALSE(node.switchBranch(2, {branch[0]}, &err));
+  EXPECT_EQ(err, "branch does not outweigh our chain");
+  EXPECT_EQ(node.snapshot()->tip().hash, tip);
+  EXPECT_TRUE(committed.empty());
+  EXPECT_FALSE(node.switchBranch(3, branch, &err));  // does not link there
+
+  const std::uint64_t work = node.snapshot()->work;
+  ASSERT_TRUE(node.switchBranch(2, branch, &err)) << err;
+  auto snap = node.snapshot();
+  EXPECT_EQ(snap->tip().hash, branch.back().hash);
+  EXPECT_EQ(snap->work, work + block_work(1));
+  EXPECT_EQ(snap->balanceOf("deadbeefcafebabe0123"), 0);
+  EXPECT_EQ(snap->balanceOf("other"), 150);
+  EXPECT_EQ(replaced_at, 2u);
+  EXPECT_EQ(committed, (std::vector<std::uint64_t>{3, 4, 5}));
+  EXPECT_TRUE(node.validate(Blockchain::ValidateMode::Deep));
+  EXPECT_FALSE(node.findBlock(tip));
+
+  // the dropped transfer is pending again and mined on the new branch
+  auto pending = node.pendingTxs();
+  ASSERT_EQ(pending.size(), 1u);
+  EXPECT_EQ(pending[0].hash(), tx.hash());
+  node.mine(addr);
+  EXPECT_EQ(node.snapshot()->balanceOf("deadbeefcafebabe0123"), 5);
+}
+
+TEST(AdvancedChain, PrunedChainReorgsAboveItsPrunedRange) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 1000;
+  p.prune_keep = 8;
+  Blockchain base(p);
+  auto kp = crypto::generate_ec_keypair();
+  auto addr = Tx::addr_from_pubkey(kp.second);
+  for (int i = 0; i < 40; ++i) base.minePending(addr);
+  // no block log either: the pruned bodies are gone for good
+  ASSERT_GT(base.prunedBelow(), 30u);
+  const std::uint64_t fork = base.chain().size() - 1;
+
+  Blockchain other = base;
+  std::vector<Block> branch;
+  for (int i = 0; i < 3; ++i) branch.push_back(other.minePending("other"));
+
+  Node node{std::move(base)};
+  std::uint64_t reorg_at = 0, state_at = 0;
+  node.setReorgHook([&](std::uint64_t f, const StateSnapshot& s) {
+    reorg_at = f;
+    state_at = s.height;
+  });
+  Tx tx;
+  tx.from_pubkey_pem = kp.second;
+  tx.to_addr = "deadbeefcafebabe0123";
+  tx.amount = 5;
+  tx.nonce = 1;
+  tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+  node.submitTx(tx);
+  node.mine(addr);
+  const std::string tip = node.mine(addr).hash;
+  const auto before = node.snapshot();
+
+  // a branch block that fails puts the old blocks, state and pending set back
+  std::vector<Block> bad = branch;
+  bad[2] = bad[1];
+  std::string err;
+  EXPECT_FALSE(node.switchBranch(fork, bad, &err));
+  EXPECT_EQ(node.snapshot()->tip().hash, tip);
+  EXPECT_EQ(node.snapshot()->work, before->work);
+  EXPECT_EQ(node.snapshot()->balanceOf("deadbeefcafebabe0123"), 5);
+  EXPECT_TRUE(node.pendingTxs().empty());
+  EXPECT_TRUE(node.findBlock(tip));
+  EXPECT_FALSE(node.findBlock(branch[0].hash));
+  EXPECT_EQ(reorg_at, 0u);
+
+  ASSERT_TRUE(node.switchBranch(fork, branch, &err)) << err;
+  auto snap = node.snapshot();
+  EXPECT_EQ(snap->tip().hash, branch.back().hash);
+  EXPECT_TRUE(snap->state->balance == other.state().state().balance);
+  EXPECT_EQ(snap->balanceOf("deadbeefcafebabe0123"), 0);
+  EXPECT_EQ(reorg_at, fork);
+  EXPECT_EQ(state_at, fork);
+  EXPECT_FALSE(node.findBlock(tip));
+  ASSERT_EQ(node.pendingTxs().size(), 1u);
+  node.mine(addr);
+  EXPECT_EQ(node.snapshot()->balanceOf("deadbeefcafebabe0123"), 5);
+  EXPECT_TRUE(node.validate(Blockchain::ValidateMode::Deep));
+}
+
+TEST(AdvancedChain, TxAndAddressIndexes) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  p.tx_index = true;
+  Blockchain bc(p);
+  auto kp = crypto::generate_ec_keypair();
+  auto addr = Tx::addr_from_pubkey(kp.second);
+  bc.minePending(addr);
+
+  Tx tx;
+  tx.from_pubkey_pem = kp.second;
+  tx.to_addr = "deadbeefcafebabe0123";
+  tx.amount = 5;
+  tx.nonce = 1;
+  tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+  bc.addTransaction(tx);
+  bc.minePending(addr);
+
+  ASSERT_NE(bc.txIndex(), nullptr);
+  auto loc = bc.txIndex()->find(tx.hash());
+  ASSERT_TRUE(loc.has_value());
+  EXPECT_EQ(bc.chain()[loc->height].transactions[loc->position].hash(), tx.hash());
+  EXPECT_EQ(bc.txIndex()->history("deadbeefcafebabe0123").size(), 1u);
+  EXPECT_EQ(bc.txIndex()->history(addr).size(), 3u);  // two coinbases + one send
+  EXPECT_GT(bc.txIndex()->memoryUsage(), 0u);
+
+  // rebuilt on load
+  auto loaded = Blockchain::fromJson(bc.toJson());
+  ASSERT_NE(loaded.txIndex(), nullptr);
+  EXPECT_EQ(loaded.txIndex()->find(tx.hash())->height, loc->height);
+
+  // a rewind takes the dropped blocks out of the indexes
+  ASSERT_TRUE(bc.rewind(1));
+  EXPECT_FALSE(bc.txIndex()->find(tx.hash()).has_value());
+  EXPECT_TRUE(bc.txIndex()->history("deadbeefcafebabe0123").empty());
+  EXPECT_EQ(bc.txIndex()->history(addr).size(), 1u);
+
+  Blockchain::Params off = p; off.tx_index = false;
+  EXPECT_EQ(Blockchain(off).txIndex(), nullptr);
+}
+
+TEST(AdvancedChain, IncrementalValidationWatermark) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Blockchain bc(p);
+  for (int i = 0; i < 4; ++i) bc.minePending("miner");
+  EXPECT_EQ(bc.validatedHeight(), 4u);
+
+  // The watermark survives a save/load round trip when the checkpoint matches.
+  auto j = nlohmann::json::parse(bc.toJson());
+  auto loaded = Blockchain::fromJson(j.dump());
+  EXPECT_EQ(loaded.validatedHeight(), 4u);
+  EXPECT_TRUE(loaded.validate());
+
+  // Tamper with a block below an intact checkpoint: its header no longer
+  // rehashes, so the watermark stops just below it.
+  auto edited = j;
+  edited["chain"][2]["nonce"] = edited["chain"][2]["nonce"].get<std::uint64_t>() + 1;
+  auto pinned = Blockchain::fromJson(edited.dump());
+  EXPECT_EQ(pinned.validatedHeight(), 1u);
+  std::size_t first = 0;
+  EXPECT_FALSE(pinned.validate(Blockchain::ValidateMode::Incremental, &first));
+  EXPECT_EQ(first, 2u);
+
+  // Tamper with a block below the watermark and break the checkpoint above it:
+  // the watermark is discarded and incremental validation catches the forgery.
+  j["chain"][2]["nonce"] = j["chain"][2]["nonce"].get<std::uint64_t>() + 1;
+  j["validated"]["hash"] = std::string(64, '0');
+  auto forged = Blockchain::fromJson(j.dump());
+  EXPECT_EQ(forged.validatedHeight(), 0u);
+  std::size_t bad = 0;
+  EXPECT_FALSE(forged.validate(Blockchain::ValidateMode::Incremental, &bad));
+  EXPECT_EQ(bad, 2u);
+  EXPECT_EQ(forged.validatedHeight(), 1u);
+  EXPECT_FALSE(forged.validate(Blockchain::ValidateMode::Deep, &bad));
+  EXPECT_EQ(bad, 2u);
+}
+
+TEST(AdvancedChain, ReplayRebuildsStateOnLoad) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Blockchain bc(p);
+  auto kp = crypto::generate_ec_keypair();
+  auto addr = Tx::addr_from_pubkey(kp.second);
+  bc.minePending(addr);
+  for (int n = 1; n <= 3; ++n) {
+    Tx tx;
+    tx.from_pubkey_pem = kp.second;
+    tx.to_addr = "deadbeefcafebabe0123";
+    tx.amount = 7;
+    tx.nonce = n;
+    tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+    bc.addTransaction(tx);
+    bc.minePending("feedface");
+  }
+
+  int calls = 0;
+  ReindexProgress last;
+  LoadOptions opts;
+  opts.progress = [&](const ReindexProgress& pr) {
+    ++calls;
+    last = pr;
+  };
+  auto loaded = Blockchain::fromJson(bc.toJson(), opts);
+  EXPECT_GT(calls, 0);
+  EXPECT_EQ(last.height, 4u);
+  EXPECT_EQ(last.txs, 7u);  // 4 coinbases + 3 transfers
+  EXPECT_EQ(loaded.state().state().balance, bc.state().state().balance);
+  EXPECT_EQ(loaded.state().state().nonce, bc.state().state().nonce);
+
+  // a forged signature anywhere in history fails the load: swap in a
+  // well-formed signature over another message, then rebuild the Merkle root
+  // and re-mine and relink the blocks so only signature checks can object
+  auto j = nlohmann::json::parse(bc.toJson());
+  j["chain"][3]["transactions"][1]["signature_hex"] = crypto::ecdsa_sign_p256(kp.first, "something else");
+  std::string prev = j["chain"][2]["hash"];
+  for (std::size_t h = 3; h < j["chain"].size(); ++h) {
+    Block b = Block::from_json(j["chain"][h]);
+    std::vector<std::string> txids;
+    for (const auto& tx : b.transactions) txids.push_back(tx.hash());
+    b.merkle_root = merkle::merkle_root(txids);
+    b.prev_hash = prev;
+    mine_block(b);
+    prev = b.hash;
+    j["chain"][h] = b.to_json();
+  }
+  j.erase("validated");
+  try {
+    Blockchain::fromJson(j.dump());
+    ADD_FAILURE() << "forged signature was accepted";
+  } catch (const std::runtime_error& e) {
+    EXPECT_NE(std::string(e.what()).find("invalid signature"), std::string::npos) << e.what();
+  }
+}
+
+TEST(AdvancedChain, AssumeValidSkipsOnlyHistoricalSignatures) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 100;
+  Blockchain bc(p);
+  auto kp = crypto::generate_ec_keypair();
+  auto addr = Tx::addr_from_pubkey(kp.second);
+  bc.minePending(addr);
+  for (int n = 1; n <= 4; ++n) {
+    Tx tx;
+    tx.from_pubkey_pem = kp.second;
+    tx.to_addr = "deadbeefcafebabe0123";
+    tx.amount = 1;
+    tx.nonce = n;
+    tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+    bc.addTransaction(tx);
+    bc.minePending(addr);
+  }
+  // Corrupt the signature in block 2 and re-seal the block so hashes and the
+  // Merkle root are consistent; only an ECDSA check can notice.
+  auto j = nlohmann::json::parse(bc.toJson());
+  auto& jb = j["chain"][2];
+  jb["transactions"][1]["signature_hex"] = crypto::ecdsa_sign_p256(kp.first, "something else");
+  Block b2 = Block::from_json(jb);
+  std::vector<std::string> ids;
+  for (const auto& t : b2.transactions) ids.push_back(t.hash());
+  b2.merkle_root = merkle::merkle_root(ids);
+  mine_block(b2);
+  jb = b2.to_json();
+  for (std::size_t h = 3; h < j["chain"].size(); ++h) {  // re-link the rest
+    Block b = Block::from_json(j["chain"][h]);
+    b.prev_hash = j["chain"][h - 1]["hash"];
+    mine_block(b);
+    j["chain"][h] = b.to_json();
+  }
+  std::string forged = j.dump();
+  EXPECT_THROW(Blockchain::fromJson(forged), std::runtime_error);
+
+  LoadOptions opts;
+  ReindexProgress last;
+  opts.progress = [&](const ReindexProgress& pr) { last = pr; };
+  opts.assume_valid = j["chain"][3]["hash"];
+  auto trusted = Blockchain::fromJson(forged, opts);
+  EXPECT_EQ(last.sigs_skipped, 2u);
+  EXPECT_EQ(trusted.state().state().balance.at("deadbeefcafebabe0123"), 4);
+  EXPECT_TRUE(trusted.isValid());
+
+  // tx hashes / Merkle roots are still checked below the checkpoint
+  auto bad = nlohmann::json::parse(forged);
+  bad["chain"][1]["transactions"][0]["amount"] = 51;
+  opts.progress = {};
+  EXPECT_THROW(Blockchain::fromJson(bad.dump(), opts), std::runtime_error);
+}
+
+TEST(AdvancedChain, StreamingJsonKeepsDomLayout) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.retarget_interval = 100; p.tx_index = true;
+  Blockchain bc(p);
+  auto kp = crypto::generate_ec_keypair();
+  bc.minePending(Tx::addr_from_pubkey(kp.second));
+  Tx tx;
+  tx.from_pubkey_pem = kp.second;
+  tx.to_addr = "deadbeefcafebabe0123";
+  tx.amount = 5;
+  tx.nonce = 1;
+  tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+  bc.addTransaction(tx);
+  bc.minePending("feedface");
+
+  // the streamed writer produces exactly what dump(2) of the same document does
+  std::string out = bc.toJson();
+  EXPECT_EQ(nlohmann::json::parse(out).dump(2), out);
+
+  std::istringstream in(out);
+  auto loaded = Blockchain::fromJson(in);
+  EXPECT_EQ(loaded.chain().size(), 3u);
+  EXPECT_EQ(loaded.chain()[2].transactions[1].signature_hex, tx.signature_hex);
+  EXPECT_NE(loaded.txIndex(), nullptr);
+  EXPECT_EQ(loaded.state().state().balance, bc.state().state().balance);
+
+  auto j = nlohmann::json::parse(out);
+  j["chain"][1].erase("hash");
+  EXPECT_THROW(Blockchain::fromJson(j.dump()), std::runtime_error);
+  j = nlohmann::json::parse(out);
+  j["chain"][1]["nonce"] = "7";
+  EXPECT_THROW(Blockchain::fromJson(j.dump()), std::runtime_error);
+  EXPECT_THROW(Blockchain::fromJson(out.substr(0, out.size() / 2)), std::exception);
+}
+
+TEST(AdvancedChain, PruningKeepsHeadersAndRecentBodies) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.retarget_interval = 1000; p.prune_keep = 4;
+  Blockchain bc(p);
+  for (int i = 0; i < 10; ++i) bc.minePending("miner");
+  auto before = bc.snapshot();  // taken before the first prune
+  for (int i = 0; i < 30; ++i) bc.minePending("miner");
+
+  const auto& chain = bc.chain();
+  ASSERT_EQ(chain.size(), 41u);
+  EXPECT_GE(bc.prunedBelow(), 41u - 4 - 16);
+  for (std::uint64_t h = 1; h < chain.size(); ++h) {
+    EXPECT_EQ(chain[h].pruned, h < bc.prunedBelow()) << h;
+    EXPECT_EQ(chain[h].transactions.empty(), chain[h].pruned) << h;
+  }
+  EXPECT_FALSE(before->blocks[5].pruned);  // readers keep the bodies they saw
+  EXPECT_TRUE(bc.isValid());
+  EXPECT_EQ(bc.state().state().balance.at("miner"), 40 * 50);
+
+  // a pruned chain can only be replayed from a state snapshot
+  EXPECT_THROW(Blockchain::fromJson(bc.toJson()), std::runtime_error);
+  LoadOptions opts;
+  auto at = std::make_shared<StateSnapshot>(before->stateAtTip());
+  opts.state_snapshot = at;
+  EXPECT_THROW(Blockchain::fromJson(bc.toJson(), opts), std::runtime_error);  // too old
+  opts.state_snapshot = std::make_shared<StateSnapshot>(bc.snapshot()->stateAtTip());
+  auto loaded = Blockchain::fromJson(bc.toJson(), opts);
+  EXPECT_EQ(loaded.state().state().balance, bc.state().state().balance);
+  EXPECT_EQ(loaded.chain().back().hash, bc.chain().back().hash);
+
+  // nor rewound past the pruned range; a failed rewind leaves the chain as it was
+  std::string err;
+  EXPECT_FALSE(bc.rewind(5, &err));
+  EXPECT_EQ(chain.size(), 41u);
+  EXPECT_EQ(bc.findBlock(chain[40].hash), &chain[40]);
+  EXPECT_EQ(bc.state().state().balance.at("miner"), 40 * 50);
+
+  Block stripped = chain[40].header_only();
+  EXPECT_FALSE(bc.acceptBlock(stripped));
+
+  // above it, the state rolls back without a replay
+  const std::string dropped = chain[40].hash;
+  ASSERT_TRUE(bc.rewind(38, &err)) << err;
+  EXPECT_EQ(chain.size(), 39u);
+  EXPECT_FALSE(bc.findBlock(dropped));
+  EXPECT_EQ(bc.state().state().balance.at("miner"), 38 * 50);
+  EXPECT_THROW(Blockchain([] { Blockchain::Params q; q.prune_keep = 1; q.tx_index = true; return q; }()),
+               std::invalid_argument);
+}
@@ -0,0 +1,73 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "gtest/gtest.h"
+#include "blockchain.hpp"
+#include "codec.hpp"
+#include "crypto.hpp"
+
+using namespace sbc;
+
+static Block sample_block(int txs) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.retarget_interval = 100;
+  Blockchain bc(p);
+  auto kp = crypto::generate_ec_keypair();
+  bc.minePending(Tx::addr_from_pubkey(kp.second));
+  for (int n = 1; n <= txs; ++n) {
+    Tx tx;
+    tx.from_pubkey_pem = kp.second;
+    tx.to_addr = "deadbeefcafebabe0123";
+    tx.amount = 1;
+    tx.nonce = n;
+    tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+    bc.addTransaction(tx);
+  }
+  return bc.minePending("Miner-Not-Hex");
+}
+
+static void expect_same(const Block& a, const Block& b) {
+  EXPECT_EQ(a.to_json(), b.to_json());
+  EXPECT_EQ(calculate_block_hash(a), a.hash);
+  EXPECT_EQ(calculate_block_hash(b), b.hash);
+}
+
+TEST(BlockCodec, RoundTripsAndShrinksBlocks) {
+  Block b = sample_block(8);
+  std::string bin = encode_block_binary(b);
+  std::string json = b.to_json().dump();
+  EXPECT_LT(bin.size() * 3, json.size());  // hex and repeated PEMs were most of it
+
+  Block out;
+  std::string err;
+  ASSERT_TRUE(decode_block_binary(bin, &out, &err)) << err;
+  expect_same(b, out);
+
+  if (codec_has_compression()) {
+    CodecOptions z; z.compress = true;
+    std::string cz = encode_block_binary(b, z);
+    EXPECT_LE(cz.size(), bin.size());
+    ASSERT_TRUE(decode_block_binary(cz, &out, &err)) << err;
+    expect_same(b, out);
+  }
+}
+
+TEST(BlockCodec, RejectsDamageAndReadsLegacyJsonRecords) {
+  Block b = sample_block(2);
+  std::string bin = encode_block_binary(b);
+  Block out;
+  std::string err;
+  for (std::size_t cut : {std::size_t(0), std::size_t(2), bin.size() / 2, bin.size() - 1}) {
+    EXPECT_FALSE(decode_block_binary(bin.substr(0, cut), &out, &err)) << cut;
+  }
+  std::string future = bin;
+  future[1] = 9;
+  EXPECT_FALSE(decode_block_binary(future, &out, &err));
+  EXPECT_NE(err.find("version"), std::string::npos);
+
+  ASSERT_TRUE(decode_block_record(b.to_json().dump(), &out, &err)) << err;
+  expect_same(b, out);
+  ASSERT_TRUE(decode_block_record(encode_block_record(b), &out, &err)) << err;
+  expect_same(b, out);
+}
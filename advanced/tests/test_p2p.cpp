@@ -0,0 +1,636 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "gtest/gtest.h"
+#include "blockchain.hpp"
+#include "cluster.hpp"
+#include "dispatch.hpp"
+#include "node.hpp"
+#include "p2p.hpp"
+#include "relay.hpp"
+#include "sync.hpp"
+
+#if !defined(_WIN32)  // raw POSIX sockets on the client side
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int connect_to(int port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+template <class Pred>
+static bool wait_for(Pred pred) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!pred()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+TEST(Listener, ServesManyIdlePeersWithPartialLines) {
+  std::mutex mu;
+  std::multiset<std::string> got;
+  p2p::Listener l("127.0.0.1", 0, [&](std::string m) {
+    std::lock_guard<std::mutex> lk(mu);
+    got.insert(std::move(m));
+  });
+  std::string err;
+  ASSERT_TRUE(l.start(&err)) << err;
+  ASSERT_NE(l.port(), 0);
+
+  // many peers connect and stay open; a stalled one must not block the rest
+  const int kPeers = 200;
+  std::vector<int> fds;
+  for (int i = 0; i < kPeers; ++i) {
+    int fd = connect_to(l.port());
+    ASSERT_GE(fd, 0);
+    fds.push_back(fd);
+  }
+  ASSERT_TRUE(::send(fds[0], "{\"stalled\":", 11, 0) == 11);
+  for (int i = 1; i < kPeers; ++i) {
+    std::string m = "{\"peer\":" + std::to_string(i) + "}";
+    // split each line across two writes, second one carrying the newline
+    std::string a = m.substr(0, 4), b = m.substr(4) + "\n";
+    ASSERT_EQ(::send(fds[i], a.data(), a.size(), 0), (ssize_t)a.size());
+    ASSERT_EQ(::send(fds[i], b.data(), b.size(), 0), (ssize_t)b.size());
+  }
+  ASSERT_TRUE(wait_for([&] { return l.stats().messages == kPeers - 1; }));
+  EXPECT_EQ(l.stats().open, (std::size_t)kPeers);
+  {
+    std::lock_guard<std::mutex> lk(mu);
+    EXPECT_EQ(got.count("{\"peer\":7}"), 1u);
+  }
+
+  // two lines in one write, and an unterminated final line flushed at EOF
+  ASSERT_EQ(::send(fds[0], "1}\nx\ny", 6, 0), 6);
+  ::close(fds[0]);
+  ASSERT_TRUE(wait_for([&] { return l.stats().messages == kPeers + 2; }));
+  {
+    std::lock_guard<std::mutex> lk(mu);
+    EXPECT_EQ(got.count("{\"stalled\":1}"), 1u);
+    EXPECT_EQ(got.count("y"), 1u);
+  }
+  ASSERT_TRUE(wait_for([&] { return l.stats().open == (std::size_t)kPeers - 1; }));
+
+  // stop() returns promptly with peers still connected
+  auto t0 = std::chrono::steady_clock::now();
+  l.stop();
+  EXPECT_LT(std::chrono::steady_clock::now() - t0, std::chrono::seconds(2));
+  EXPECT_EQ(l.stats().open, 0u);
+  for (int i = 1; i < kPeers; ++i) ::close(fds[i]);
+}
+
+TEST(Listener, FloodingPeerDoesNotStarveOthers) {
+  std::atomic<int> quiet{0};
+  std::atomic<std::uint64_t> flooded{0};
+  p2p::Listener l("127.0.0.1", 0, [&](std::string m) {
+    if (m == "quiet") ++quiet;
+    else flooded += m.size();
+  });
+  ASSERT_TRUE(l.start());
+
+  // one peer writes frames as fast as the loop reads them
+  int flood_fd = connect_to(l.port());
+  ASSERT_GE(flood_fd, 0);
+  std::atomic<bool> flooding{true};
+  std::thread flooder([&] {
+    const std::string frame = p2p::frame_message(std::string(1u << 20, 'f'));
+    while (flooding) {
+      if (::send(flood_fd, frame.data(), frame.size(), MSG_NOSIGNAL) < 0) break;
+    }
+  });
+  ASSERT_TRUE(wait_for([&] { return flooded > (8u << 20); }));
+
+  int fd = connect_to(l.port());
+  ASSERT_GE(fd, 0);
+  const std::string m = p2p::frame_message("quiet");
+  ASSERT_EQ(::send(fd, m.data(), m.size(), 0), (ssize_t)m.size());
+  EXPECT_TRUE(wait_for([&] { return quiet == 1; }));
+  EXPECT_EQ(l.stats().dropped, 0u);
+
+  flooding = false;
+  ::shutdown(flood_fd, SHUT_RDWR);
+  flooder.join();
+  ::close(flood_fd);
+  ::close(fd);
+  l.stop();
+}
+
+TEST(Listener, ReportsBindFailure) {
+  p2p::Listener a("127.0.0.1", 0, nullptr);
+  ASSERT_TRUE(a.start());
+  p2p::Listener b("127.0.0.1", a.port(), nullptr);
+  std::string err;
+  // SO_REUSEADDR does not allow two listeners on one port
+  EXPECT_FALSE(b.start(&err));
+  EXPECT_NE(err.find("bind"), std::string::npos);
+  a.stop();
+}
+
+TEST(PeerPool, FramesMessagesOverOnePersistentConnection) {
+  std::mutex mu;
+  std::vector<std::string> got;
+  p2p::Listener l("127.0.0.1", 0, [&](std::string m) {
+    std::lock_guard<std::mutex> lk(mu);
+    got.push_back(std::move(m));
+  });
+  ASSERT_TRUE(l.start());
+  p2p::PeerPool pool({"127.0.0.1:" + std::to_string(l.port())});
+  for (int i = 0; i < 100; ++i) pool.broadcast("msg " + std::to_string(i));
+  pool.broadcast("multi\nline");  // framing does not care about newlines
+  ASSERT_TRUE(pool.flush(std::chrono::seconds(5)));
+  ASSERT_TRUE(wait_for([&] { return l.stats().messages == 101; }));
+  auto st = pool.stats();
+  ASSERT_EQ(st.size(), 1u);
+  EXPECT_EQ(st[0].sent, 101u);
+  EXPECT_EQ(st[0].connects, 1u);
+  EXPECT_TRUE(st[0].connected);
+  EXPECT_EQ(l.stats().accepted, 1u);
+  std::lock_guard<std::mutex> lk(mu);
+  EXPECT_EQ(got.front(), "msg 0");  // one connection keeps order
+  EXPECT_EQ(got.back(), "multi\nline");
+}
+
+TEST(PeerPool, QueuesWhilePeerIsDownAndReconnects) {
+  std::atomic<int> got{0};
+  auto on_msg = [&](std::string) { ++got; };
+  int port;
+  {
+    p2p::Listener probe("127.0.0.1", 0, nullptr);  // find a free port
+    ASSERT_TRUE(probe.start());
+    port = probe.port();
+  }
+  p2p::PeerPoolOptions opts;
+  opts.min_backoff = std::chrono::milliseconds(10);
+  opts.max_backoff = std::chrono::milliseconds(50);
+  p2p::PeerPool pool({"127.0.0.1:" + std::to_string(port)}, opts);
+  pool.broadcast("early");
+  EXPECT_FALSE(pool.flush(std::chrono::milliseconds(100)));  // nobody listening yet
+  EXPECT_EQ(pool.stats()[0].queued, 1u);
+
+  {
+    p2p::Listener l("127.0.0.1", port, on_msg);
+    ASSERT_TRUE(l.start());
+    ASSERT_TRUE(pool.flush(std::chrono::seconds(5)));
+    ASSERT_TRUE(wait_for([&] { return got == 1; }));
+  }  // peer restarts: the idle pooled socket is now dead
+
+  p2p::Listener l2("127.0.0.1", port, on_msg);
+  ASSERT_TRUE(l2.start());
+  pool.broadcast("late");
+  ASSERT_TRUE(pool.flush(std::chrono::seconds(5)));
+  ASSERT_TRUE(wait_for([&] { return got == 2; }));
+  EXPECT_EQ(pool.stats()[0].connects, 2u);
+}
+
+// A peer that completes the handshake but never reads: the kernel buffers
+// a little, then writes to it stall.
+static int stalled_peer(int* port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  ::bind(fd, (sockaddr*)&addr, sizeof(addr));
+  ::listen(fd, 4);
+  socklen_t len = sizeof(addr);
+  ::getsockname(fd, (sockaddr*)&addr, &len);
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+TEST(PeerPool, ResendsFromTheFrameAFailedWriteCutOff) {
+  int port;
+  int raw = stalled_peer(&port);
+  ::close(raw);  // nobody listening yet: both messages queue and go out as one write
+  p2p::PeerPoolOptions opts;
+  opts.min_backoff = std::chrono::milliseconds(10);
+  opts.max_backoff = std::chrono::milliseconds(20);
+  p2p::PeerPool pool({"127.0.0.1:" + std::to_string(port)}, opts);
+  const std::string small = "small", big(8u << 20, 'x');
+  pool.broadcast(small);
+  pool.broadcast(big);
+  ASSERT_FALSE(pool.flush(std::chrono::milliseconds(50)));
+
+  // a peer that reads the first frame and a bit of the second, then resets
+  {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons((std::uint16_t)port);
+    ASSERT_EQ(::bind(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+    ::listen(fd, 4);
+    int c = ::accept(fd, nullptr, nullptr);
+    ASSERT_GE(c, 0);
+    std::string buf(p2p::frame_message(small).size() + 100, '\0');
+    for (std::size_t got = 0; got < buf.size();) {
+      auto r = ::recv(c, &buf[got], buf.size() - got, 0);
+      ASSERT_GT(r, 0);
+      got += (std::size_t)r;
+    }
+    ::close(c);  // unread data pending: the sender's write fails
+    ::close(fd);
+  }
+  ASSERT_TRUE(wait_for([&] { return pool.stats()[0].sent == 1; }));
+
+  // the next connection carries the big frame only, not the small one again
+  std::mutex mu;
+  std::vector<std::size_t> sizes;
+  p2p::Listener l("127.0.0.1", port, [&](std::string m) {
+    std::lock_guard<std::mutex> lk(mu);
+    sizes.push_back(m.size());
+  });
+  ASSERT_TRUE(l.start());
+  ASSERT_TRUE(pool.flush(std::chrono::seconds(5)));
+  ASSERT_TRUE(wait_for([&] {
+    std::lock_guard<std::mutex> lk(mu);
+    return !sizes.empty();
+  }));
+  pool.stop();
+  l.stop();
+  std::lock_guard<std::mutex> lk(mu);
+  EXPECT_EQ(sizes, std::vector<std::size_t>{big.size()});
+  EXPECT_EQ(pool.stats()[0].sent, 2u);
+}
+
+TEST(PeerPool, FansOutToEveryPeerAndCountsFailures) {
+  std::atomic<int> got{0};
+  std::vector<std::unique_ptr<p2p::Listener>> ls;
+  std::vector<std::string> peers;
+  for (int i = 0; i < 8; ++i) {
+    ls.push_back(std::make_unique<p2p::Listener>("127.0.0.1", 0, [&](std::string m) {
+      if (m == "{\"type\":\"PING\"}") ++got;
+    }));
+    ASSERT_TRUE(ls.back()->start());
+    peers.push_back("127.0.0.1:" + std::to_string(ls.back()->port()));
+  }
+  int closed_port;
+  { p2p::Listener probe("127.0.0.1", 0, nullptr); ASSERT_TRUE(probe.start()); closed_port = probe.port(); }
+  peers.push_back("127.0.0.1:" + std::to_string(closed_port));  // refused
+
+  p2p::PeerPoolOptions opts;
+  opts.min_backoff = std::chrono::milliseconds(10);
+  p2p::PeerPool pool(peers, opts);
+  EXPECT_FALSE(pool.addPeer("not-a-peer"));
+  pool.broadcast("{\"type\":\"PING\"}");
+  EXPECT_TRUE(wait_for([&] { return got == 8; }));
+  ASSERT_TRUE(wait_for([&] {
+    auto st = pool.stats();
+    std::size_t sent = 0;
+    for (const auto& ps : st) sent += ps.sent;
+    return sent == 8 && st.back().failures >= 1;
+  }));
+  auto st = pool.stats();
+  ASSERT_EQ(st.size(), 9u);
+  for (std::size_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(st[i].sent, 1u) << st[i].peer;
+    EXPECT_EQ(st[i].failures, 0u) << st[i].peer;
+    EXPECT_EQ(st[i].timeouts, 0u) << st[i].peer;
+  }
+  EXPECT_EQ(st[8].sent, 0u);
+  EXPECT_EQ(st[8].timeouts, 0u);
+  EXPECT_EQ(st[8].queued, 1u);  // kept for when it comes up
+  pool.stop();
+}
+
+TEST(PeerPool, StalledPeerTimesOutWithoutDelayingOthers) {
+  std::atomic<int> got{0};
+  p2p::Listener healthy("127.0.0.1", 0, [&](std::string) { ++got; });
+  ASSERT_TRUE(healthy.start());
+  int stalled_port;
+  int stalled_fd = stalled_peer(&stalled_port);
+
+  p2p::PeerPoolOptions opts;
+  opts.send_timeout = std::chrono::milliseconds(100);
+  opts.min_backoff = std::chrono::milliseconds(10);
+  p2p::PeerPool pool({"127.0.0.1:" + std::to_string(stalled_port),
+                      "127.0.0.1:" + std::to_string(healthy.port())},
+                     opts);
+  std::string big(4u << 20, 'x');  // far more than the stalled socket buffers
+  for (int i = 0; i < 4; ++i) pool.broadcast(big);
+  ASSERT_TRUE(wait_for([&] { return got == 4; }));
+  ASSERT_TRUE(wait_for([&] { return pool.stats()[0].timeouts >= 1; }));
+  auto st = pool.stats();
+  EXPECT_EQ(st[1].sent, 4u);
+  EXPECT_EQ(st[1].timeouts, 0u);
+  EXPECT_GT(st[1].max_latency.count(), 0);
+  pool.stop();
+  ::close(stalled_fd);
+}
+
+TEST(MessageDispatcher, QueuesWithoutBlockingAndAppliesDropPolicies) {
+  std::mutex gate;
+  std::unique_lock<std::mutex> hold(gate);  // handlers wait here until released
+  std::mutex seen_mu;
+  std::vector<int> blocks;
+  std::atomic<int> txs{0};
+  sbc::DispatcherOptions opts;
+  opts.workers = 2;
+  opts.block.capacity = 3;  // DropOldest, serial
+  opts.tx.capacity = 2;     // DropNewest
+  sbc::MessageDispatcher d([&](sbc::WireReader& m) {
+    std::lock_guard<std::mutex> g(gate);
+    if (m.type() == sbc::MsgType::Tx) ++txs;
+    std::lock_guard<std::mutex> lk(seen_mu);
+    if (m.type() == sbc::MsgType::NewBlock) blocks.push_back((int)m.u64());
+  }, opts);
+
+  auto block = [](int n) { return sbc::WireWriter(sbc::MsgType::NewBlock, "p").u64(n).finish(); };
+  auto tx = sbc::WireWriter(sbc::MsgType::Tx, "p").finish();
+  auto corrupt = sbc::WireWriter(sbc::MsgType::GetTip, "p").finish();
+  corrupt.back() ^= 1;  // header intact, checksum wrong
+  auto t0 = std::chrono::steady_clock::now();
+  EXPECT_TRUE(d.post(block(0)));  // taken by a worker, which blocks on the gate
+  ASSERT_TRUE(wait_for([&] { return d.stats()[sbc::Lane::Block].depth == 0; }));
+  for (int n = 1; n <= 5; ++n) EXPECT_TRUE(d.post(block(n)));  // 1 and 2 are evicted
+  EXPECT_TRUE(d.post(tx));  // the second worker takes one
+  ASSERT_TRUE(wait_for([&] { return d.stats()[sbc::Lane::Tx].depth == 0; }));
+  EXPECT_TRUE(d.post(tx));
+  EXPECT_TRUE(d.post(tx));
+  EXPECT_FALSE(d.post(tx));  // lane full: refused
+  EXPECT_FALSE(d.post("{\"type\":\"TX\"}"));  // not a wire message
+  EXPECT_TRUE(d.post(corrupt));  // queued; rejected by the worker
+  EXPECT_LT(std::chrono::steady_clock::now() - t0, std::chrono::seconds(2));  // posting never waited
+
+  auto st = d.stats();
+  EXPECT_EQ(st[sbc::Lane::Block].depth, 3u);
+  EXPECT_EQ(st[sbc::Lane::Block].dropped, 2u);
+  EXPECT_EQ(st[sbc::Lane::Tx].depth, 2u);
+  EXPECT_EQ(st[sbc::Lane::Tx].max_depth, 2u);
+  EXPECT_EQ(st[sbc::Lane::Tx].dropped, 1u);
+  EXPECT_EQ(st.malformed, 1u);
+
+  hold.unlock();
+  ASSERT_TRUE(d.drain(std::chrono::seconds(10)));
+  EXPECT_EQ(blocks, (std::vector<int>{0, 3, 4, 5}));  // serial lane kept arrival order
+  EXPECT_EQ(txs.load(), 3);
+  EXPECT_EQ(d.stats()[sbc::Lane::Block].processed, 4u);
+  EXPECT_EQ(d.stats().malformed, 2u);
+  d.stop();
+  EXPECT_FALSE(d.post(tx));
+}
+
+// A full peer on loopback: listener, dispatcher, outbound pool, relay and sync.
+struct LoopbackNode {
+  sbc::Node node;
+  p2p::PeerPool pool{{}};
+  sbc::BlockRelay relay{node, [this](const std::string& p, const std::string& m) { pool.sendTo(p, m); }};
+  sbc::ChainSync sync;
+  sbc::MessageDispatcher dispatcher{[this](sbc::WireReader& m) {
+    if (!relay.handle(m)) sync.handle(m);
+  }};
+  p2p::Listener listener{"127.0.0.1", 0, [this](std::string m) { dispatcher.post(std::move(m)); }};
+  std::string addr;
+
+  LoopbackNode(sbc::Blockchain bc, sbc::SyncOptions opts)
+      : node(std::move(bc)), sync(node, [this](const std::string& p, const std::string& m) { pool.sendTo(p, m); }, opts) {
+    EXPECT_TRUE(listener.start());
+    addr = "127.0.0.1:" + std::to_string(listener.port());
+    relay.setSelfAddress(addr);
+    sync.setSelfAddress(addr);
+    relay.setGapHandler([this](const std::string& p) { sync.peerAhead(p); });
+  }
+  ~LoopbackNode() {
+    listener.stop();
+    dispatcher.stop();
+    sync.stop();
+    pool.stop();
+  }
+};
+
+TEST(ChainSync, NewNodeCatchesUpFromSeveralPeers) {
+  sbc::Blockchain::Params p; p.initial_difficulty = 1; p.retarget_interval = 1000;
+  sbc::Blockchain genesis(p);
+  std::string genesis_json = genesis.toJson();
+  for (int i = 0; i < 60; ++i) genesis.minePending("miner");
+  std::string full_json = genesis.toJson();
+
+  sbc::SyncOptions opts;
+  opts.headers_per_request = 16;  // several header batches
+  opts.blocks_per_request = 4;    // many ranges to spread
+  opts.tip_poll = std::chrono::milliseconds(200);
+  LoopbackNode a(sbc::Blockchain::fromJson(full_json), opts);
+  LoopbackNode b(sbc::Blockchain::fromJson(full_json), opts);
+  LoopbackNode c(sbc::Blockchain::fromJson(genesis_json), opts);
+  // peering is configured on both sides
+  for (auto* n : {&a, &b}) {
+    ASSERT_TRUE(n->pool.addPeer(c.addr));
+    ASSERT_TRUE(c.pool.addPeer(n->addr));
+    n->sync.start({c.addr});
+  }
+  c.sync.start({a.addr, b.addr});
+
+  const std::string tip = genesis.chain().back().hash;
+  ASSERT_TRUE(wait_for([&] { return c.node.snapshot()->tip().hash == tip; }));
+  auto st = c.sync.stats();
+  EXPECT_EQ(st.headers, 60u);
+  EXPECT_EQ(st.blocks_applied, 60u);
+  EXPECT_EQ(st.bad_peers, 0u);
+  // bodies came from both peers
+  EXPECT_GT(a.sync.stats().served_blocks, 0u);
+  EXPECT_GT(b.sync.stats().served_blocks, 0u);
+  EXPECT_EQ(a.sync.stats().served_blocks + b.sync.stats().served_blocks, 60u);
+
+  // a block announced past d's tip + 1 makes d sync from the announcer
+  a.node.mine("miner");
+  sbc::Block b2 = a.node.mine("miner");
+  LoopbackNode d(sbc::Blockchain::fromJson(full_json), opts);
+  ASSERT_TRUE(d.pool.addPeer(a.addr));
+  ASSERT_TRUE(a.pool.addPeer(d.addr));
+  a.sync.start({d.addr});
+  d.sync.start({a.addr});
+  std::string ann = a.relay.announce(b2);
+  sbc::WireReader msg(ann);
+  d.relay.handle(msg);
+  ASSERT_TRUE(wait_for([&] { return d.node.snapshot()->tip().hash == b2.hash; }));
+}
+
+// Peer two loopback nodes both ways.
+static void link(LoopbackNode& a, LoopbackNode& b) {
+  ASSERT_TRUE(a.pool.addPeer(b.addr));
+  ASSERT_TRUE(b.pool.addPeer(a.addr));
+  a.sync.start({b.addr});
+  b.sync.start({a.addr});
+}
+
+TEST(ChainSync, SwitchesToTheBranchWithMoreWork) {
+  sbc::Blockchain::Params p; p.initial_difficulty = 1; p.retarget_interval = 1000;
+  sbc::Blockchain shared(p);
+  for (int i = 0; i < 12; ++i) shared.minePending("miner");
+  sbc::Blockchain light = shared, heavy = shared;
+  // deep enough that the locator's sparse entries reach below the fork
+  for (int i = 0; i < 14; ++i) light.minePending("light");
+  for (int i = 0; i < 16; ++i) heavy.minePending("heavy");
+
+  sbc::SyncOptions opts;
+  opts.headers_per_request = 4;  // the branch arrives over several batches
+  opts.blocks_per_request = 3;
+  opts.tip_poll = std::chrono::milliseconds(200);
+  LoopbackNode a(sbc::Blockchain::fromJson(light.toJson()), opts);
+  LoopbackNode b(sbc::Blockchain::fromJson(heavy.toJson()), opts);
+  std::uint64_t replaced_at = 0;
+  a.node.setReorgHook([&](std::uint64_t fork, const sbc::StateSnapshot&) { replaced_at = fork; });
+  link(a, b);
+
+  const std::string tip = heavy.chain().back().hash;
+  ASSERT_TRUE(wait_for([&] { return a.node.snapshot()->tip().hash == tip; }));
+  auto st = a.sync.stats();
+  EXPECT_EQ(st.reorgs, 1u);
+  EXPECT_EQ(st.blocks_applied, 16u);
+  EXPECT_EQ(st.bad_peers, 0u);
+  EXPECT_EQ(replaced_at, 12u);
+  EXPECT_EQ(a.node.snapshot()->balanceOf("light"), 0);
+  EXPECT_EQ(b.sync.stats().blocks_applied, 0u);  // the lighter branch is not taken
+
+  // two branches of equal work settle on the lower tip hash
+  sbc::Blockchain x = heavy, y = heavy;
+  x.minePending("x");
+  y.minePending("y");
+  LoopbackNode c(sbc::Blockchain::fromJson(x.toJson()), opts);
+  LoopbackNode d(sbc::Blockchain::fromJson(y.toJson()), opts);
+  link(c, d);
+  const std::string low = std::min(x.chain().back().hash, y.chain().back().hash);
+  ASSERT_TRUE(wait_for([&] {
+    return c.node.snapshot()->tip().hash == low && d.node.snapshot()->tip().hash == low;
+  }));
+  EXPECT_EQ(c.sync.stats().reorgs + d.sync.stats().reorgs, 1u);
+}
+
+TEST(ChainSync, AnswersOnlyConfiguredPeers) {
+  sbc::Blockchain::Params p; p.initial_difficulty = 1;
+  sbc::Blockchain bc(p);
+  for (int i = 0; i < 8; ++i) bc.minePending("miner");
+  LoopbackNode a(sbc::Blockchain::fromJson(bc.toJson()), sbc::SyncOptions{});
+  a.sync.start({});
+  std::atomic<int> got{0};
+  p2p::Listener victim("127.0.0.1", 0, [&](std::string) { ++got; });
+  ASSERT_TRUE(victim.start());
+  const std::string victim_addr = "127.0.0.1:" + std::to_string(victim.port());
+
+  // requests naming someone else as sender: no replies, no tips tracked
+  auto deliver = [](auto& handler, const std::string& m) {
+    sbc::WireReader r(m);
+    handler.handle(r);
+  };
+  for (int i = 0; i < 200; ++i) {
+    std::string from = i % 2 ? victim_addr : "127.0.0.1:" + std::to_string(20000 + i);
+    deliver(a.sync, sbc::WireWriter(sbc::MsgType::GetTip, from).finish());
+    deliver(a.sync, sbc::WireWriter(sbc::MsgType::GetBlocks, from).u64(1).u64(64).finish());
+    deliver(a.sync, sbc::WireWriter(sbc::MsgType::Tip, from).u64(100).hex(std::string(64, 'f')).u64(1u << 30).finish());
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(got, 0);
+  EXPECT_EQ(a.sync.stats().served_blocks, 0u);
+  EXPECT_EQ(a.sync.stats().requests, 0u);
+  EXPECT_TRUE(a.pool.stats().empty());
+}
+
+TEST(PeerPool, SendsOnlyToConfiguredPeersUpToTheCap) {
+  sbc::Blockchain::Params p; p.initial_difficulty = 1;
+  sbc::Blockchain bc(p);
+  bc.minePending("miner");
+  LoopbackNode a(sbc::Blockchain::fromJson(bc.toJson()), sbc::SyncOptions{});
+  std::atomic<int> got{0};
+  p2p::Listener victim("127.0.0.1", 0, [&](std::string) { ++got; });
+  ASSERT_TRUE(victim.start());
+  const std::string victim_addr = "127.0.0.1:" + std::to_string(victim.port());
+
+  // a request naming someone else as sender: no reply, no new peer
+  const std::string req = sbc::WireWriter(sbc::MsgType::GetBlock, victim_addr).hex(bc.chain().back().hash).finish();
+  sbc::WireReader r(req);
+  a.relay.handle(r);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(got, 0);
+  EXPECT_TRUE(a.pool.stats().empty());
+
+  // the pool only grows by configuration, up to max_peers
+  p2p::PeerPoolOptions po;
+  po.max_peers = 2;
+  p2p::PeerPool pool({victim_addr}, po);
+  EXPECT_FALSE(pool.sendTo("127.0.0.1:1", "x"));
+  EXPECT_TRUE(pool.sendTo(victim_addr, "x"));
+  EXPECT_TRUE(pool.addPeer("127.0.0.1:2"));
+  EXPECT_FALSE(pool.addPeer("127.0.0.1:3"));
+  EXPECT_EQ(pool.stats().size(), 2u);
+  ASSERT_TRUE(wait_for([&] { return got == 1; }));
+  pool.stop();
+}
+
+TEST(Cluster, PropagatesBlocksAndTxsAcrossALine) {
+  sbc::ClusterOptions opts;
+  opts.nodes = 4;
+  opts.topology = sbc::Topology::Line;
+  opts.funded_txs_per_node = 50;
+  sbc::Cluster cluster(opts);
+  EXPECT_EQ(cluster.links().size(), 3u);
+
+  for (std::size_t i = 0; i < cluster.size(); ++i) cluster.submitTx(i);
+  for (std::size_t i = 0; i < cluster.size(); ++i) {
+    ASSERT_TRUE(wait_for([&] { return cluster.node(i).pendingTxs().size() == 4; }));
+  }
+  sbc::Block b = cluster.mine(0);
+  EXPECT_EQ(b.transactions.size(), 5u);  // coinbase + one tx per node
+  ASSERT_TRUE(cluster.waitConverged(std::chrono::seconds(10)));
+  cluster.mine(3);  // from the far end
+  ASSERT_TRUE(cluster.waitConverged(std::chrono::seconds(10)));
+
+  auto m = cluster.metrics();
+  EXPECT_TRUE(m.converged);
+  EXPECT_EQ(m.blocks_mined, 2u);
+  EXPECT_EQ(m.blocks_orphaned, 0u);
+  EXPECT_EQ(m.block_propagation.samples, 6u);  // each block reached the 3 other nodes
+  EXPECT_EQ(m.block_full.samples, 2u);
+  EXPECT_EQ(m.txs_submitted, 4u);
+  EXPECT_EQ(m.txs_included, 4u);
+  EXPECT_GT(m.bytes_sent, 0u);
+
+  sbc::ClusterLoad load;
+  load.blocks = 3;
+  load.txs_per_block = 2;
+  load.block_interval = std::chrono::milliseconds(100);
+  auto after = sbc::run_load(cluster, load);
+  EXPECT_TRUE(after.converged);
+  EXPECT_EQ(after.blocks_mined, 5u);
+}
+
+TEST(Cluster, BuildsTopologies) {
+  EXPECT_EQ(sbc::make_topology(sbc::Topology::Ring, 5).size(), 5u);
+  EXPECT_EQ(sbc::make_topology(sbc::Topology::Star, 5).size(), 4u);
+  EXPECT_EQ(sbc::make_topology(sbc::Topology::Mesh, 5).size(), 10u);
+  auto r = sbc::make_topology(sbc::Topology::Random, 10, 4, 7);
+  EXPECT_EQ(r.size(), 20u);  // ring + chords up to degree 4
+  EXPECT_EQ(r, sbc::make_topology(sbc::Topology::Random, 10, 4, 7));  // seeded
+  sbc::Topology t;
+  EXPECT_TRUE(sbc::parse_topology("mesh", &t));
+  EXPECT_EQ(t, sbc::Topology::Mesh);
+  EXPECT_FALSE(sbc::parse_topology("torus", &t));
+}
+
+#endif  // !_WIN32
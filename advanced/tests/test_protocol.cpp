@@ -0,0 +1,280 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "gtest/gtest.h"
+#include "blockchain.hpp"
+#include "bloom.hpp"
+#include "crypto.hpp"
+#include "gossip.hpp"
+#include "node.hpp"
+#include "protocol.hpp"
+#include "relay.hpp"
+#include "wire.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace sbc;
+
+static std::vector<Tx> signed_txs(const std::pair<std::string, std::string>& kp, int count) {
+  std::vector<Tx> out;
+  for (int n = 1; n <= count; ++n) {
+    Tx tx;
+    tx.from_pubkey_pem = kp.second;
+    tx.to_addr = "deadbeefcafebabe0123";
+    tx.amount = 1;
+    tx.nonce = n;
+    tx.signature_hex = crypto::ecdsa_sign_p256(kp.first, tx.message());
+    out.push_back(tx);
+  }
+  return out;
+}
+
+template <class Handler>
+static bool deliver(Handler& h, const std::string& frame) {
+  WireReader r(frame);
+  return h.handle(r);
+}
+
+TEST(WireMessage, RoundTripsFieldsAndRejectsCorruptFrames) {
+  auto kp = crypto::generate_ec_keypair();
+  auto txs = signed_txs(kp, 3);
+  Block b;
+  b.index = 7;
+  b.timestamp = "2025-01-01T00:00:00Z";
+  b.prev_hash = std::string(64, 'a');
+  b.hash = std::string(64, 'b');
+  b.transactions = txs;
+  std::string frame = WireWriter(MsgType::Blocks, "127.0.0.1:9001").u64(7).hex(b.hash).block(b).txs(txs).finish();
+
+  MsgType type;
+  ASSERT_TRUE(peek_wire_header(frame, &type));
+  EXPECT_EQ(type, MsgType::Blocks);
+  WireReader r(frame);
+  EXPECT_EQ(r.from(), "127.0.0.1:9001");
+  EXPECT_EQ(r.u64(), 7u);
+  EXPECT_EQ(r.hex(), b.hash);
+  EXPECT_EQ(r.block().to_json(), b.to_json());
+  auto got = r.txs();
+  ASSERT_EQ(got.size(), 3u);
+  EXPECT_EQ(got[2].to_json(), txs[2].to_json());
+  EXPECT_TRUE(r.atEnd());
+  EXPECT_THROW(r.u64(), std::runtime_error);  // read past the end
+
+  std::string bad = frame;
+  bad[kWireHeaderBytes + 20] ^= 1;
+  EXPECT_TRUE(peek_wire_header(bad, &type));  // header alone looks fine...
+  EXPECT_THROW(WireReader{bad}, std::runtime_error);  // ...the checksum does not
+  std::string err;
+  EXPECT_FALSE(peek_wire_header(frame.substr(0, frame.size() - 1), &type, &err));
+  EXPECT_FALSE(peek_wire_header("{\"type\":\"NEWBLOCK\"}", &type, &err));
+  bad = frame;
+  bad[4] = 9;  // version
+  EXPECT_FALSE(peek_wire_header(bad, &type, &err));
+  EXPECT_EQ(err, "unsupported wire version");
+}
+
+TEST(CompactBlock, ReconstructsFromMempoolAndListsMissing) {
+  Blockchain::Params p; p.initial_difficulty = 1;
+  Blockchain bc(p);
+  auto kp = crypto::generate_ec_keypair();
+  bc.minePending(Tx::addr_from_pubkey(kp.second));
+  auto txs = signed_txs(kp, 5);
+  for (const auto& tx : txs) bc.addTransaction(tx);
+  Block b = bc.minePending("miner");
+  ASSERT_EQ(b.transactions.size(), 6u);
+
+  WireWriter w(MsgType::CmpctBlock, "a");
+  make_compact_block(b).write(w);
+  std::string wire = w.finish();
+  WireReader r(wire);
+  CompactBlock cb = CompactBlock::read(r);
+  EXPECT_TRUE(r.atEnd());
+  EXPECT_EQ(cb.short_ids.size(), 5u);
+  ASSERT_EQ(cb.prefilled.size(), 1u);  // coinbase
+  EXPECT_LT(wire.size() * 2, WireWriter(MsgType::NewBlock, "a").block(b).finish().size());  // 6 bytes per tx
+
+  // receiver has txs 0, 2, 4 plus something unrelated
+  std::vector<Tx> mempool = {txs[4], txs[0], txs[2], signed_txs(crypto::generate_ec_keypair(), 1)[0]};
+  Block out;
+  std::vector<std::size_t> missing;
+  EXPECT_FALSE(reconstruct_block(cb, mempool, &out, &missing));
+  EXPECT_EQ(missing, (std::vector<std::size_t>{2, 4}));  // block positions of txs[1], txs[3]
+  out.transactions[2] = txs[1];
+  out.transactions[4] = txs[3];
+  EXPECT_TRUE(block_merkle_matches(out));
+  EXPECT_EQ(out.to_json(), b.to_json());
+
+  mempool.push_back(txs[1]);
+  mempool.push_back(txs[3]);
+  EXPECT_TRUE(reconstruct_block(cb, mempool, &out, &missing));
+  EXPECT_EQ(out.to_json(), b.to_json());
+}
+
+TEST(BlockRelay, RebuildsBlockWithOneRoundTripForMissingTxs) {
+  Blockchain::Params p; p.initial_difficulty = 1; p.retarget_interval = 100;
+  Node a{Blockchain(p)};
+  auto kp = crypto::generate_ec_keypair();
+  a.mine(Tx::addr_from_pubkey(kp.second));
+  std::string chain_json;  // b starts from the same chain
+  a.withChain([&](const Blockchain& bc) { chain_json = bc.toJson(); });
+  Node b{Blockchain::fromJson(chain_json)};
+
+  // in-process "network": deliver each message straight to the addressee
+  std::map<std::string, BlockRelay*> net;
+  std::uint64_t bytes = 0;
+  auto send = [&](const std::string& peer, const std::string& msg) {
+    bytes += msg.size();
+    deliver(*net.at(peer), msg);
+  };
+  BlockRelay ra(a, send), rb(b, send);
+  ra.setSelfAddress("a");
+  rb.setSelfAddress("b");
+  net = {{"a", &ra}, {"b", &rb}};
+
+  auto txs = signed_txs(kp, 6);
+  for (const auto& tx : txs) a.submitTx(tx);
+  for (int i = 0; i < 4; ++i) b.submitTx(txs[i]);  // b missed the last two
+  Block mined = a.mine("miner");
+  ASSERT_EQ(mined.transactions.size(), 7u);
+
+  std::string ann = ra.announce(mined);
+  bytes += ann.size();
+  deliver(rb, ann);
+  EXPECT_EQ(b.snapshot()->tip().hash, mined.hash);
+  EXPECT_TRUE(b.pendingTxs().empty());
+  auto st = rb.stats();
+  EXPECT_EQ(st.compact_received, 1u);
+  EXPECT_EQ(st.round_trips, 1u);
+  EXPECT_EQ(st.txs_requested, 2u);
+  EXPECT_EQ(st.accepted, 1u);
+  EXPECT_EQ(st.full_fallbacks, 0u);
+  EXPECT_LT(bytes, WireWriter(MsgType::NewBlock, "a").block(mined).finish().size());
+
+  // a second announcement of a known block is ignored
+  deliver(rb, ann);
+  EXPECT_EQ(rb.stats().compact_received, 1u);
+}
+
+TEST(RollingBloom, RemembersRecentKeysWithinBoundedMemory) {
+  RollingBloom f(1000, 0.0001);
+  std::size_t bits = f.bits();
+  for (int i = 0; i < 1000; ++i) EXPECT_FALSE(f.testAndInsert("tx" + std::to_string(i)));
+  for (int i = 0; i < 1000; ++i) EXPECT_TRUE(f.contains("tx" + std::to_string(i)));
+  int fp = 0;
+  for (int i = 0; i < 10000; ++i) fp += f.contains("other" + std::to_string(i));
+  EXPECT_LT(fp, 10);
+
+  // one more generation: the first keys are still remembered, two later they age out
+  for (int i = 1000; i < 2000; ++i) f.insert("tx" + std::to_string(i));
+  EXPECT_TRUE(f.contains("tx0"));
+  for (int i = 2000; i < 3001; ++i) f.insert("tx" + std::to_string(i));
+  int kept = 0;
+  for (int i = 0; i < 1000; ++i) kept += f.contains("tx" + std::to_string(i));
+  EXPECT_LT(kept, 10);
+  EXPECT_EQ(f.bits(), bits);
+}
+
+TEST(TxGossip, EachTxCrossesEveryLinkOnceAndReachesAllMempools) {
+  Blockchain::Params p; p.initial_difficulty = 1;
+  Blockchain bc(p);
+  std::string chain_json = bc.toJson();
+  const std::vector<std::string> names = {"a", "b", "c", "d"};
+  std::vector<std::unique_ptr<Node>> nodes;
+  std::vector<std::unique_ptr<TxGossip>> gossip;
+  std::map<std::string, TxGossip*> net;
+  std::map<std::string, int> bodies;  // TX messages per addressee
+  auto send = [&](const std::string& peer, const std::string& msg) {
+    WireReader r(msg);
+    if (r.type() == MsgType::Tx) ++bodies[peer];
+    net.at(peer)->handle(r);
+  };
+  for (const auto& n : names) {  // full mesh
+    std::vector<std::string> others;
+    for (const auto& o : names) if (o != n) others.push_back(o);
+    nodes.push_back(std::make_unique<Node>(Blockchain::fromJson(chain_json)));
+    gossip.push_back(std::make_unique<TxGossip>(*nodes.back(), send, others));
+    gossip.back()->setSelfAddress(n);
+    net[n] = gossip.back().get();
+  }
+
+  auto kp = crypto::generate_ec_keypair();
+  auto txs = signed_txs(kp, 3);
+  gossip[0]->submit(txs[0]);
+  gossip[2]->submit(txs[1]);
+  for (std::size_t i = 0; i < nodes.size(); ++i) EXPECT_EQ(nodes[i]->pendingTxs().size(), 2u) << names[i];
+  for (const auto& n : names) EXPECT_EQ(bodies[n], n == "a" || n == "c" ? 1 : 2) << n;
+
+  // a local tx the filter already knows still reaches the node, but is not re-announced
+  gossip[2]->submit(txs[1]);
+  EXPECT_EQ(nodes[2]->pendingTxs().size(), 3u);
+  EXPECT_EQ(gossip[2]->stats().local, 2u);
+  for (const auto& n : names) EXPECT_EQ(bodies[n], n == "a" || n == "c" ? 1 : 2) << n;
+  std::uint64_t announced = 0;
+  for (const auto& g : gossip) {
+    auto st = g->stats();
+    EXPECT_EQ(st.duplicates, 0u);
+    announced += st.announced;
+  }
+  EXPECT_LE(announced, 2u * 12u);  // at most once per tx per direction of each link
+
+  // late announcements of known txs are not fetched; bad signatures are dropped
+  auto requested = gossip[1]->stats().requested;
+  deliver(*gossip[1], WireWriter(MsgType::Inv, "a").u64(1).hex(txs[0].hash()).finish());
+  EXPECT_EQ(gossip[1]->stats().requested, requested);
+  Tx forged = txs[2];
+  forged.amount = 1000;
+  deliver(*gossip[1], WireWriter(MsgType::Tx, "a").txs({forged}).finish());
+  EXPECT_EQ(gossip[1]->stats().invalid, 1u);
+  EXPECT_EQ(nodes[1]->pendingTxs().size(), 2u);
+
+  // senders that are not peers get nothing back and are not tracked
+  deliver(*gossip[1], WireWriter(MsgType::Inv, "mallory").u64(1).hex(txs[2].hash()).finish());
+  deliver(*gossip[1], WireWriter(MsgType::GetTx, "mallory").u64(1).hex(txs[0].hash()).finish());
+  EXPECT_EQ(gossip[1]->stats().requested, requested);
+  EXPECT_EQ(bodies.count("mallory"), 0u);
+}
+
+TEST(TxGossip, RefetchesFromTheNextAnnouncerAfterATimeout) {
+  Blockchain::Params p; p.initial_difficulty = 1;
+  Node node{Blockchain(p)};
+  std::mutex mu;
+  std::vector<std::pair<std::string, std::string>> asked;  // (peer, tx id) per GETTX entry
+  TxGossip g(node, [&](const std::string& peer, const std::string& msg) {
+    WireReader r(msg);
+    if (r.type() != MsgType::GetTx) return;
+    std::lock_guard<std::mutex> lk(mu);
+    for (std::uint64_t n = r.u64(); n > 0; --n) asked.emplace_back(peer, r.hex());
+  }, {"p1", "p2", "p3"});
+  g.setSelfAddress("me");
+  auto taken = [&] {
+    std::lock_guard<std::mutex> lk(mu);
+    return std::exchange(asked, {});
+  };
+  using Asked = std::vector<std::pair<std::string, std::string>>;
+
+  auto txs = signed_txs(crypto::generate_ec_keypair(), 2);
+  const std::string a = txs[0].hash(), b = txs[1].hash();
+  deliver(g, WireWriter(MsgType::Inv, "p1").u64(2).hex(a).hex(b).finish());
+  deliver(g, WireWriter(MsgType::Inv, "p2").u64(1).hex(a).finish());
+  deliver(g, WireWriter(MsgType::Inv, "p1").u64(1).hex(a).finish());  // already asked
+  EXPECT_EQ(taken(), (Asked{{"p1", a}, {"p1", b}}));
+
+  // p1 never answers: a goes to the next announcer; b had none and is forgotten
+  std::this_thread::sleep_for(TxGossip::kRequestTimeout + TxGossip::kRequestTimeout / 2);
+  EXPECT_EQ(taken(), (Asked{{"p2", a}}));
+  EXPECT_EQ(g.stats().refetched, 1u);
+  deliver(g, WireWriter(MsgType::Inv, "p3").u64(1).hex(b).finish());
+  EXPECT_EQ(taken(), (Asked{{"p3", b}}));
+
+  deliver(g, WireWriter(MsgType::Tx, "p2").txs({txs[0]}).finish());
+  EXPECT_EQ(g.stats().admitted, 1u);
+  EXPECT_EQ(node.pendingTxs().size(), 1u);
+}
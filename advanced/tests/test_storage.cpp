@@ -0,0 +1,429 @@
+/*
+SPDX-License-Identifier: MIT
+Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
+*/
+
+#include "gtest/gtest.h"
+#include "blockchain.hpp"
+#include "statefile.hpp"
+#include "storage.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace sbc;
+namespace fs = std::filesystem;
+
+static std::string fresh_dir(const std::string& name) {
+  auto d = fs::temp_directory_path() / ("sbc_" + name + "_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+  fs::remove_all(d);
+  return d.string();
+}
+
+TEST(BlockLog, AppendReadAcrossSegmentsAndReopen) {
+  auto dir = fresh_dir("log");
+  std::string err;
+  {
+    storage::BlockLog log;
+    ASSERT_TRUE(log.open(dir, &err, /*segment_bytes=*/256)) << err;
+    for (int i = 0; i < 40; ++i) ASSERT_TRUE(log.append("record-" + std::to_string(i), &err)) << err;
+    ASSERT_TRUE(log.sync(&err));
+  }
+  EXPECT_TRUE(fs::exists(fs::path(dir) / "blocks_00001.dat"));
+  storage::BlockLog log;
+  ASSERT_TRUE(log.open(dir, &err, 256)) << err;
+  ASSERT_EQ(log.size(), 40u);
+  std::string rec;
+  for (int i = 0; i < 40; ++i) {
+    ASSERT_TRUE(log.read(i, &rec, &err)) << err;
+    EXPECT_EQ(rec, "record-" + std::to_string(i));
+  }
+
+  // truncating drops later segments too; appends continue at the new tail
+  ASSERT_TRUE(log.truncate(7, &err)) << err;
+  ASSERT_TRUE(log.append("replaced-7", &err)) << err;
+  log.close();
+  EXPECT_FALSE(fs::exists(fs::path(dir) / "blocks_00001.dat"));
+  ASSERT_TRUE(log.open(dir, &err, 256)) << err;
+  ASSERT_EQ(log.size(), 8u);
+  ASSERT_TRUE(log.read(6, &rec, &err)) << err;
+  EXPECT_EQ(rec, "record-6");
+  ASSERT_TRUE(log.read(7, &rec, &err)) << err;
+  EXPECT_EQ(rec, "replaced-7");
+  fs::remove_all(dir);
+}
+
+TEST(BlockLog, ReplaceAllSwapsInTheNewLogWhole) {
+  auto dir = fresh_dir("replace");
+  std::string err;
+  storage::BlockLog log;
+  ASSERT_TRUE(log.open(dir, &err, /*segment_bytes=*/256)) << err;
+  for (int i = 0; i < 40; ++i) ASSERT_TRUE(log.append("record-" + std::to_string(i), &err)) << err;
+  ASSERT_TRUE(log.sync(&err));
+  ASSERT_TRUE(fs::exists(fs::path(dir) / "blocks_00002.dat"));
+
+  // a shorter log: the old segments past its tail go, appends follow it
+  std::vector<std::string> next;
+  for (int i = 0; i < 12; ++i) next.push_back("other-" + std::to_string(i));
+  ASSERT_TRUE(log.replaceAll(next, &err)) << err;
+  ASSERT_TRUE(log.append("other-12", &err)) << err;
+  ASSERT_TRUE(log.sync(&err));
+  EXPECT_FALSE(fs::exists(fs::path(dir) / "blocks_00002.dat"));
+  EXPECT_FALSE(fs::exists(fs::path(dir) / "blocks.idx.next"));
+  log.close();
+
+  // a rewrite a crash interrupted before its commit point leaves the log as it was
+  { std::ofstream(fs::path(dir) / "blocks_00000.dat.compact") << "partial"; }
+  { std::ofstream(fs::path(dir) / "blocks.idx.tmp") << "partial"; }
+  ASSERT_TRUE(log.open(dir, &err, 256)) << err;
+  EXPECT_FALSE(fs::exists(fs::path(dir) / "blocks_00000.dat.compact"));
+  ASSERT_EQ(log.size(), 13u);
+  std::string rec;
+  for (int i = 0; i < 13; ++i) {
+    ASSERT_TRUE(log.read(i, &rec, &err)) << err;
+    EXPECT_EQ(rec, "other-" + std::to_string(i));
+  }
+  log.close();
+  fs::remove_all(dir);
+}
+
+TEST(BlockLog, RecoversTornTail) {
+  auto dir = fresh_dir("torn");
+  std::string err;
+  {
+    storage::BlockLog log;
+    ASSERT_TRUE(log.open(dir, &err)) << err;
+    for (int i = 0; i < 5; ++i) ASSERT_TRUE(log.append(std::string(100, 'a' + i), &err));
+  }
+  auto seg = fs::path(dir) / "blocks_00000.dat";
+  auto idx = fs::path(dir) / "blocks.idx";
+  // crash mid-record: half of record 4 is on disk, and its index entry is torn
+  fs::resize_file(seg, fs::file_size(seg) - 50);
+  fs::resize_file(idx, fs::file_size(idx) - 3);
+  {
+    storage::BlockLog log;
+    ASSERT_TRUE(log.open(dir, &err)) << err;
+    EXPECT_EQ(log.size(), 4u);
+    ASSERT_TRUE(log.append("after-crash", &err));
+  }
+  // crash after a record hit disk but before its index entry did
+  fs::resize_file(idx, fs::file_size(idx) - 16);
+  storage::BlockLog log;
+  ASSERT_TRUE(log.open(dir, &err)) << err;
+  ASSERT_EQ(log.size(), 5u);
+  std::string rec;
+  ASSERT_TRUE(log.read(4, &rec, &err));
+  EXPECT_EQ(rec, "after-crash");
+  ASSERT_TRUE(log.read(3, &rec, &err));
+  EXPECT_EQ(rec, std::string(100, 'd'));
+  fs::remove_all(dir);
+}
+
+TEST(BlockLog, ChainRoundTrip) {
+  auto dir = fresh_dir("chain");
+  Blockchain::Params p; p.initial_difficulty = 1; p.target_block_time_sec = 1; p.retarget_interval = 2;
+  Blockchain bc(p);
+  storage::BlockLog log;
+  std::string err;
+  ASSERT_TRUE(log.open(dir, &err)) << err;
+  ASSERT_TRUE(log.append(encode_block_record(bc.chain()[0]), &err));
+  for (int i = 0; i < 6; ++i) ASSERT_TRUE(log.append(encode_block_record(bc.minePending("miner")), &err));
+
+  auto loaded = Blockchain::fromBlockLog(log, p);
+  EXPECT_EQ(loaded.chain().size(), 7u);
+  EXPECT_EQ(loaded.chain().back().hash, bc.chain().back().hash);
+  EXPECT_EQ(loaded.difficulty(), bc.difficulty());
+  EXPECT_EQ(loaded.state().state().balance, bc.state().state().balance);
+  EXPECT_TRUE(loaded.isValid());
+  EXPECT_EQ(loaded.validatedHeight(), 0u);  // no checkpoint yet
+
+  // only headers are held; bodies are read back from the log on demand
+  EXPECT_TRUE(loaded.chain()[3].pruned);
+  auto full = loaded.snapshot()->body(3);
+  ASSERT_TRUE(full);
+  EXPECT_EQ(full->transactions.size(), bc.chain()[3].transactions.size());
+  EXPECT_EQ(nlohmann::json::parse(loaded.toJson())["chain"], nlohmann::json::parse(bc.toJson())["chain"]);
+  EXPECT_TRUE(loaded.validate(Blockchain::ValidateMode::Deep));
+
+  // a persisted watermark is restored once the headers below it rehash
+  auto cp_path = (fs::path(dir) / "validated").string();
+  ASSERT_TRUE(save_validated_checkpoint(cp_path, 6, bc.chain()[6].hash, &err)) << err;
+  LoadOptions opts;
+  ValidatedCheckpoint cp;
+  ASSERT_TRUE(load_validated_checkpoint(cp_path, &cp.height, &cp.hash, &err)) << err;
+  opts.validated = cp;
+  EXPECT_EQ(Blockchain::fromBlockLog(log, p, opts).validatedHeight(), 6u);
+
+  // ...and stops below a block edited under it
+  auto forged_dir = fresh_dir("chain_forged");
+  storage::BlockLog forged;
+  ASSERT_TRUE(forged.open(forged_dir, &err)) << err;
+  for (std::size_t h = 0; h < bc.chain().size(); ++h) {
+    Block b = bc.chain()[h];
+    if (h == 2) ++b.nonce;
+    ASSERT_TRUE(forged.append(encode_block_record(b), &err));
+  }
+  auto f = Blockchain::fromBlockLog(forged, p, opts);
+  EXPECT_EQ(f.validatedHeight(), 1u);
+  EXPECT_FALSE(f.validate());
+  fs::remove_all(forged_dir);
+
+  // a log truncated underneath makes body reads fail instead of faulting
+  ASSERT_TRUE(log.truncate(0, &err)) << err;
+  EXPECT_FALSE(loaded.body(3));
+  fs::remove_all(dir);
+}
+
+TEST(BlockLog, MappedViewsFollowGrowingSegment) {
+  auto dir = fresh_dir("mapped");
+  std::string err;
+  storage::BlockLog log;
+  ASSERT_TRUE(log.open(dir, &err)) << err;
+  ASSERT_TRUE(log.append("first", &err));
+  std::string_view v;
+  ASSERT_TRUE(log.view(0, &v, &err)) << err;
+  EXPECT_EQ(v, "first");
+  // appending past the mapped length forces a remap of the active segment
+  ASSERT_TRUE(log.append(std::string(10000, 'x'), &err));
+  ASSERT_TRUE(log.view(1, &v, &err)) << err;
+  EXPECT_EQ(v.size(), 10000u);
+  ASSERT_TRUE(log.view(0, &v, &err));
+  EXPECT_EQ(v, "first");
+  log.close();
+  fs::remove_all(dir);
+}
+
+TEST(MappedFile, LoadsChainJsonInPlace) {
+  auto dir = fresh_dir("mapjson");
+  fs::create_directories(dir);
+  auto path = (fs::path(dir) / "chain.json").string();
+  Blockchain::Params p; p.initial_difficulty = 1;
+  Blockchain bc(p);
+  for (int i = 0; i < 3; ++i) bc.minePending("miner");
+  std::string err;
+  ASSERT_TRUE(storage::save_file_atomically(path, bc.toJson(), &err)) << err;
+
+  storage::MappedFile f;
+  ASSERT_TRUE(f.open(path, &err)) << err;
+  auto loaded = Blockchain::fromJson(f.data());
+  EXPECT_EQ(loaded.chain().back().hash, bc.chain().back().hash);
+  f.close();
+  EXPECT_FALSE(f.open((fs::path(dir) / "missing").string(), &err));
+  fs::remove_all(dir);
+}
+
+TEST(AsyncLogWriter, GroupCommitsAndFlushBarrier) {
+  auto dir = fresh_dir("async");
+  std::string err;
+  storage::BlockLog log;
+  ASSERT_TRUE(log.open(dir, &err, /*segment_bytes=*/512)) << err;
+  {
+    storage::AsyncLogWriter w(&log, std::chrono::milliseconds(20));
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t) {
+      producers.emplace_back([&w, t] {
+        for (int i = 0; i < 50; ++i) w.enqueue("t" + std::to_string(t) + "-" + std::to_string(i));
+      });
+    }
+    for (auto& th : producers) th.join();
+    ASSERT_TRUE(w.flush(&err)) << err;
+    EXPECT_EQ(log.size(), 200u);
+    auto st = w.stats();
+    EXPECT_EQ(st.records, 200u);
+    EXPECT_GE(st.syncs, 1u);
+    EXPECT_LE(st.syncs, st.batches);
+    w.enqueue("last");  // drained by the destructor
+  }
+  storage::BlockLog reopened;
+  ASSERT_TRUE(reopened.open(dir, &err, 512)) << err;
+  ASSERT_EQ(reopened.size(), 201u);
+  std::string rec;
+  ASSERT_TRUE(reopened.read(200, &rec, &err));
+  EXPECT_EQ(rec, "last");
+  EXPECT_TRUE(fs::exists(fs::path(dir) / "blocks_00001.dat"));
+  reopened.close();
+  fs::remove_all(dir);
+}
+
+TEST(Storage, SaveReplacesFileAtomically) {
+  auto dir = fresh_dir("save");
+  fs::create_directories(dir);
+  auto path = (fs::path(dir) / "chain.json").string();
+  std::string err, got;
+  ASSERT_TRUE(storage::save_file_atomically(path, std::string(4096, 'a'), &err)) << err;
+  ASSERT_TRUE(storage::save_file_atomically(path, "{}", &err)) << err;
+  ASSERT_TRUE(storage::load_file_to_string(path, &got, &err));
+  EXPECT_EQ(got, "{}");
+  EXPECT_FALSE(fs::exists(path + ".tmp"));
+  EXPECT_FALSE(storage::save_file_atomically((fs::path(dir) / "no" / "such.json").string(), "{}", &err));
+  fs::remove_all(dir);
+}
+
+TEST(AsyncLogWriter, FailedTaskKeepsLaterRecordsAndFailedAppendStops) {
+  auto dir = fresh_dir("async_fail");
+  std::string err;
+  storage::BlockLog log;
+  ASSERT_TRUE(log.open(dir, &err)) << err;
+  std::mutex mu;
+  std::vector<std::pair<std::string, bool>> reported;  // (error, fatal)
+  storage::AsyncLogWriter w(&log, std::chrono::milliseconds(0), [&](const std::string& e, bool fatal) {
+    std::lock_guard<std::mutex> lk(mu);
+    reported.emplace_back(e, fatal);
+  });
+
+  // a failed task is reported; the records queued behind it still land in order
+  w.enqueue("h0");
+  w.enqueueTask([](storage::BlockLog&, std::string* e) { *e = "snapshot failed"; return false; });
+  w.enqueue("h1");
+  w.enqueue("h2");
+  EXPECT_FALSE(w.flush(&err));
+  EXPECT_EQ(err, "snapshot failed");
+  EXPECT_TRUE(w.enqueue("h3"));
+  ASSERT_TRUE(w.flush(&err)) << err;
+  ASSERT_EQ(log.size(), 4u);
+  std::string rec;
+  for (int h = 0; h < 4; ++h) {
+    ASSERT_TRUE(log.read(h, &rec, &err)) << err;
+    EXPECT_EQ(rec, "h" + std::to_string(h));
+  }
+
+  // a failed append stops the writer for good
+  w.enqueueTask([](storage::BlockLog& l, std::string*) { l.close(); return true; });
+  w.enqueue("h4");
+  EXPECT_FALSE(w.flush(&err));
+  EXPECT_TRUE(w.failed());
+  EXPECT_FALSE(w.enqueue("h5"));
+  EXPECT_FALSE(w.flush(&err));
+  {
+    std::lock_guard<std::mutex> lk(mu);
+    ASSERT_EQ(reported.size(), 2u);
+    EXPECT_FALSE(reported[0].second);
+    EXPECT_TRUE(reported[1].second);
+  }
+  storage::BlockLog reopened;
+  ASSERT_TRUE(reopened.open(dir, &err)) << err;
+  EXPECT_EQ(reopened.size(), 4u);
+  fs::remove_all(dir);
+}
+
+TEST(BlockLog, PrunedLogCompactsAndRestartsFromSnapshot) {
+  auto dir = fresh_dir("prune");
+  Blockchain::Params p; p.initial_difficulty = 1; p.retarget_interval = 1000; p.prune_keep = 3;
+  Blockchain bc(p);
+  std::string err;
+  storage::BlockLog log;
+  ASSERT_TRUE(log.open(dir, &err, /*segment_bytes=*/1024)) << err;
+  ASSERT_TRUE(log.append(encode_block_record(bc.chain()[0]), &err));
+  for (int i = 0; i < 30; ++i) ASSERT_TRUE(log.append(encode_block_record(bc.minePending("m")), &err));
+  auto full_size = fs::file_size(fs::path(dir) / "blocks_00000.dat");
+
+  // snapshot the tip, then compact through the writer (ordered after the records)
+  StateSnapshot snap = bc.snapshot()->stateAtTip();
+  auto snap_path = (fs::path(dir) / "state.snapshot").string();
+  {
+    storage::AsyncLogWriter w(&log);
+    w.enqueueTask([&](storage::BlockLog& l, std::string* e) {
+      return save_state_snapshot(snap_path, snap, e) &&
+             l.compact(snap.height + 1 - p.prune_keep,
+                       [](std::string_view in, std::string* out) { return prune_block_record(in, out); }, e);
+    });
+    ASSERT_TRUE(w.flush(&err)) << err;
+    EXPECT_EQ(w.stats().tasks, 1u);
+  }
+  EXPECT_LT(fs::file_size(fs::path(dir) / "blocks_00000.dat"), full_size);
+  EXPECT_FALSE(fs::exists(fs::path(dir) / "blocks.idx.next"));
+  log.close();
+
+  // an uncommitted compaction left behind by a crash is discarded on open
+  { std::ofstream(fs::path(dir) / "blocks_00001.dat.compact") << "partial"; }
+  storage::BlockLog reopened;
+  ASSERT_TRUE(reopened.open(dir, &err, 1024)) << err;
+  EXPECT_FALSE(fs::exists(fs::path(dir) / "blocks_00001.dat.compact"));
+  ASSERT_EQ(reopened.size(), 31u);
+
+  EXPECT_THROW(Blockchain::fromBlockLog(reopened, p), std::runtime_error);
+  StateSnapshot loaded_snap;
+  ASSERT_TRUE(load_state_snapshot(snap_path, &loaded_snap, &err)) << err;
+  LoadOptions opts;
+  opts.state_snapshot = std::make_shared<StateSnapshot>(loaded_snap);
+  auto restarted = Blockchain::fromBlockLog(reopened, p, opts);
+  EXPECT_EQ(restarted.chain().back().hash, bc.chain().back().hash);
+  EXPECT_EQ(restarted.state().state().balance, bc.state().state().balance);
+  EXPECT_TRUE(restarted.chain()[5].pruned);
+  EXPECT_TRUE(restarted.isValid());
+  reopened.close();
+  fs::remove_all(dir);
+}
+
+TEST(StateFile, BinarySnapshotRoundTripAndChecksum) {
+  auto dir = fresh_dir("statefile");
+  fs::create_directories(dir);
+  auto path = (fs::path(dir) / "state.snapshot").string();
+  auto accounts = std::make_shared<AccountState>();
+  const std::string long_addr(100, 'z');  // any string a tx pays to, not just a 40-char address
+  accounts->balance = {{"miner", 150}, {"alice", 7}, {"bob", -1}, {long_addr, 5}, {std::string("n\0ul", 4), 1}};
+  accounts->nonce = {{"alice", 3}};
+  StateSnapshot snap{42, std::string(64, 'a'), accounts};
+  std::string err;
+  ASSERT_TRUE(save_state_snapshot(path, snap, &err)) << err;
+  EXPECT_EQ(fs::file_size(path), 72u + 5 * (4 + 16) + (5 + 5 + 3 + 100 + 4));
+
+  StateSnapshot loaded;
+  ASSERT_TRUE(load_state_snapshot(path, &loaded, &err)) << err;
+  EXPECT_EQ(loaded.height, 42u);
+  EXPECT_EQ(loaded.block_hash, snap.block_hash);
+  EXPECT_EQ(loaded.accounts->balance, accounts->balance);
+  EXPECT_EQ(loaded.accounts->nonce, accounts->nonce);
+
+  // flip one byte of an entry: the checksum catches it
+  {
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(72 + 12);
+    f.put('\x7f');
+  }
+  EXPECT_FALSE(load_state_snapshot(path, &loaded, &err));
+  EXPECT_NE(err.find("checksum"), std::string::npos);
+
+  // version 1 files (fixed 40-byte addresses) still load
+  {
+    std::string v1(72 + 56, '\0');
+    std::memcpy(&v1[0], "SBCSTATE", 8);
+    v1[8] = 1;
+    v1[12] = 56;
+    v1[16] = 7;
+    v1[56] = 1;
+    std::memcpy(&v1[72], "alice", 5);
+    v1[72 + 40] = 9;  // balance
+    v1[72 + 48] = 2;  // nonce
+    const std::uint32_t crc = storage::crc32(std::string_view(v1).substr(72));
+    for (int i = 0; i < 4; ++i) v1[64 + i] = (char)((crc >> (8 * i)) & 0xff);
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << v1;
+  }
+  ASSERT_TRUE(load_state_snapshot(path, &loaded, &err)) << err;
+  EXPECT_EQ(loaded.height, 7u);
+  EXPECT_EQ(loaded.accounts->balance.at("alice"), 9);
+  EXPECT_EQ(loaded.accounts->nonce.at("alice"), 2u);
+  fs::remove_all(dir);
+}
+
+TEST(StateFile, TipSnapshotSkipsReplay) {
+  Blockchain::Params p; p.initial_difficulty = 1;
+  Blockchain bc(p);
+  for (int i = 0; i < 4; ++i) bc.minePending("miner");
+  LoadOptions opts;
+  opts.state_snapshot = std::make_shared<StateSnapshot>(bc.snapshot()->stateAtTip());
+  int batches = 0;
+  opts.progress = [&](const ReindexProgress&) { ++batches; };
+  auto loaded = Blockchain::fromJson(bc.toJson(), opts);
+  EXPECT_EQ(batches, 0);
+  EXPECT_EQ(loaded.state().state().balance, bc.state().state().balance);
+
+  // a snapshot for some other chain is rejected rather than trusted
+  opts.state_snapshot = std::make_shared<StateSnapshot>(
+      StateSnapshot{2, std::string(64, 'f'), opts.state_snapshot->accounts});
+  EXPECT_THROW(Blockchain::fromJson(bc.toJson(), opts), std::runtime_error);
+}
@@ -8,6 +8,8 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 #include "crypto.hpp"
 #include "util.hpp"
 
+#include <optional>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <utility>
@@ -53,14 +55,10 @@ const Block& Blockchain::minePending() {
   return chain_.back();
 }
 
-bool Blockchain::validateLink(std::size_t i) const {
-  if (i == 0 || i >= chain_.size()) return true;
-  const Block& prev = chain_[i - 1];
+bool Blockchain::validateBlock(std::size_t i) const {
   const Block& cur = chain_[i];
-  if (cur.prev_hash != prev.hash) return false;
   // Recompute hash and check difficulty
-  Block tmp = cur;
-  std::string recomputed = calculate_hash(tmp);
+  std::string recomputed = calculate_hash(cur);
   if (recomputed != cur.hash) return false;
   // Difficulty check: leading zeros
   for (int k = 0; k < difficulty_; ++k) {
@@ -69,30 +67,175 @@ bool Blockchain::validateLink(std::size_t i) const {
   return true;
 }
 
-bool Blockchain::isValid() const {
-  for (std::size_t i = 1; i < chain_.size(); ++i) {
-    if (!validateLink(i)) return false;
+bool Blockchain::validateLink(std::size_t i) const {
+  if (i == 0 || i >= chain_.size()) return true;
+  return chain_[i].prev_hash == chain_[i - 1].hash;
+}
+
+bool Blockchain::isValid(std::size_t* first_bad) const {
+  const std::size_t n = chain_.size();
+  std::size_t bad = util::parallel_first_failure(
+      1, n, [this](std::size_t i) { return validateBlock(i); });
+  for (std::size_t i = 1; i < bad; ++i) {
+    if (!validateLink(i)) {
+      bad = i;
+      break;
+    }
   }
-  return true;
+  if (bad == n) return true;
+  if (first_bad) *first_bad = bad;
+  return false;
+}
+
+// ---- JSON persistence -------------------------------------------------------
+//
+// Same layout as nlohmann::json::dump(indent) of {"chain": [...], "difficulty"},
+// but written block by block and read back with a SAX handler, so memory use
+// beyond the chain itself does not grow with its length.
+
+// Copy a dump fragment to out, inserting pad after every newline.
+static void write_reindented(std::ostream& out, const std::string& dump, const std::string& pad) {
+  std::size_t from = 0;
+  for (std::size_t nl; (nl = dump.find('\n', from)) != std::string::npos; from = nl + 1) {
+    out.write(dump.data() + from, nl + 1 - from);
+    out << pad;
+  }
+  out.write(dump.data() + from, dump.size() - from);
+}
+
+void Blockchain::writeJson(std::ostream& out, int indent) const {
+  const bool pretty = indent >= 0;
+  const std::string nl = pretty ? "\n" : "";
+  const std::string colon = pretty ? ": " : ":";
+  const std::string pad1 = pretty ? std::string(indent, ' ') : "";
+  const std::string pad2 = pad1 + pad1;
+  out << "{" << nl << pad1 << "\"chain\"" << colon << "[";
+  for (std::size_t i = 0; i < chain_.size(); ++i) {
+    out << (i ? "," : "") << nl << pad2;
+    write_reindented(out, chain_[i].to_json().dump(indent), pad2);
+  }
+  if (!chain_.empty()) out << nl << pad1;
+  out << "]," << nl << pad1 << "\"difficulty\"" << colon << difficulty_ << nl << "}";
 }
 
 std::string Blockchain::toJsonString(int indent) const {
-  nlohmann::json j;
-  j["difficulty"] = difficulty_;
-  j["chain"] = nlohmann::json::array();
-  for (const auto& b : chain_) {
-    j["chain"].push_back(b.to_json());
+  std::ostringstream out;
+  writeJson(out, indent);
+  return out.str();
+}
+
+namespace {
+
+// SAX handler for the toJsonString() layout: fills each Block field by field
+// and appends it to the chain when its object closes.
+class ChainJsonReader final : public json::json_sax_t {
+ public:
+  ChainJsonReader(std::vector<Block>* chain, std::optional<int>* difficulty)
+      : chain_(chain), difficulty_(difficulty) {}
+
+  bool null() override { return fail("unexpected null"); }
+  bool boolean(bool) override { return fail("unexpected boolean"); }
+  bool number_integer(number_integer_t v) override {
+    if (v >= 0) return number_unsigned((number_unsigned_t)v);
+    if (at(Ctx::Root) && key_ == "difficulty") { *difficulty_ = (int)v; return true; }
+    return fail("expected unsigned integer");
+  }
+  bool number_unsigned(number_unsigned_t v) override {
+    if (at(Ctx::Root) && key_ == "difficulty") *difficulty_ = (int)v;
+    else if (at(Ctx::Block) && key_ == "index") { block_.index = v; seen_ |= kIndex; }
+    else if (at(Ctx::Block) && key_ == "nonce") { block_.nonce = v; seen_ |= kNonce; }
+    else return fail("expected string");
+    return true;
   }
-  return j.dump(indent);
+  bool number_float(number_float_t, const string_t&) override { return fail("unexpected float"); }
+  bool string(string_t& v) override {
+    if (at(Ctx::Txs)) block_.transactions.push_back(std::move(v));
+    else if (at(Ctx::Block) && key_ == "timestamp") { block_.timestamp = std::move(v); seen_ |= kTimestamp; }
+    else if (at(Ctx::Block) && key_ == "prev_hash") { block_.prev_hash = std::move(v); seen_ |= kPrevHash; }
+    else if (at(Ctx::Block) && key_ == "hash") { block_.hash = std::move(v); seen_ |= kHash; }
+    else return fail("unexpected string");
+    return true;
+  }
+  bool binary(binary_t&) override { return fail("unexpected binary"); }
+
+  bool key(string_t& k) override {
+    key_ = k;
+    return true;
+  }
+  bool start_object(std::size_t) override {
+    if (stack_.empty()) stack_.push_back(Ctx::Root);
+    else if (at(Ctx::Chain)) { stack_.push_back(Ctx::Block); block_ = Block{}; seen_ = 0; }
+    else stack_.push_back(Ctx::Skip);
+    return true;
+  }
+  bool end_object() override {
+    if (at(Ctx::Block)) {
+      if ((seen_ & kRequired) != kRequired) fail("block missing required fields");
+      chain_->push_back(std::move(block_));
+    }
+    stack_.pop_back();
+    return true;
+  }
+  bool start_array(std::size_t) override {
+    if (at(Ctx::Root) && key_ == "chain") stack_.push_back(Ctx::Chain);
+    else if (at(Ctx::Block) && key_ == "transactions") { stack_.push_back(Ctx::Txs); seen_ |= kTxs; }
+    else stack_.push_back(Ctx::Skip);
+    return true;
+  }
+  bool end_array() override {
+    stack_.pop_back();
+    return true;
+  }
+  bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) override {
+    throw std::runtime_error(ex.what());
+  }
+
+ private:
+  enum class Ctx { Root, Chain, Block, Txs, Skip };
+  enum : unsigned { kIndex = 1, kTimestamp = 2, kPrevHash = 4, kHash = 8, kNonce = 16, kTxs = 32,
+                    kRequired = 63 };
+
+  bool at(Ctx c) const { return !stack_.empty() && stack_.back() == c; }
+  // Type errors matter only for the fields we read; anything else is ignored.
+  bool fail(const std::string& what) const {
+    bool ours = at(Ctx::Chain) || at(Ctx::Txs) || (at(Ctx::Root) && key_ == "difficulty") ||
+                (at(Ctx::Block) && (key_ == "index" || key_ == "timestamp" || key_ == "prev_hash" ||
+                                    key_ == "hash" || key_ == "nonce" || key_ == "transactions"));
+    if (!ours) return true;
+    throw std::runtime_error("chain json: " + what + " (at \"" + key_ + "\")");
+  }
+
+  std::vector<Block>* chain_;
+  std::optional<int>* difficulty_;
+  std::vector<Ctx> stack_;
+  std::string key_;
+  Block block_;
+  unsigned seen_ = 0;
+};
+
+template <class Input>
+Blockchain load_json(Input&& in, std::vector<Block>* chain) {
+  std::optional<int> difficulty;
+  ChainJsonReader reader(chain, &difficulty);
+  json::sax_parse(std::forward<Input>(in), &reader);
+  if (!difficulty) throw std::runtime_error("chain json: missing difficulty");
+  if (chain->empty()) throw std::runtime_error("chain json: no blocks");
+  return Blockchain{*difficulty};
 }
 
+}  // namespace
+
 Blockchain Blockchain::fromJsonString(std::string_view data) {
-  auto j = nlohmann::json::parse(data.begin(), data.end());
-  Blockchain bc{j.at("difficulty").get<int>()};
-  bc.chain_.clear();
-  for (const auto& jb : j.at("chain")) {
-    bc.chain_.push_back(Block::from_json(jb));
-  }
+  std::vector<Block> chain;
+  Blockchain bc = load_json(data, &chain);
+  bc.chain_ = std::move(chain);
+  return bc;
+}
+
+Blockchain Blockchain::fromJsonStream(std::istream& in) {
+  std::vector<Block> chain;
+  Blockchain bc = load_json(in, &chain);
+  bc.chain_ = std::move(chain);
   return bc;
 }
 
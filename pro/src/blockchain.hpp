@@ -5,6 +5,7 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 
 #pragma once
 #include <cstdint>
+#include <iosfwd>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -26,21 +27,26 @@ class Blockchain {
   // Mine a block from current mempool
   const Block& minePending();
 
-  // Validate the whole chain
-  bool isValid() const;
+  // Validate the whole chain. Block hashes and PoW are checked in parallel,
+  // then prev-hash linkage in one pass; *first_bad gets the lowest bad index.
+  bool isValid(std::size_t* first_bad = nullptr) const;
 
   // Access
   const std::vector<Block>& chain() const noexcept { return chain_; }
   int difficulty() const noexcept { return difficulty_; }
   void setDifficulty(int d) noexcept { difficulty_ = d; }
 
-  // Persistence
+  // Persistence. writeJson streams one block at a time (same text as
+  // toJsonString); the readers parse with SAX and never build a DOM.
+  void writeJson(std::ostream& out, int indent = 2) const;
   std::string toJsonString(int indent = 2) const;
   static Blockchain fromJsonString(std::string_view data);
+  static Blockchain fromJsonStream(std::istream& in);
 
  private:
   static Block makeGenesis();
-  bool validateLink(std::size_t i) const;  // link i-1 -> i
+  bool validateBlock(std::size_t i) const;  // hash + difficulty of block i
+  bool validateLink(std::size_t i) const;   // link i-1 -> i
 
  private:
   std::vector<Block> chain_;
@@ -49,8 +49,12 @@ int main(int argc, char** argv) {
         std::cerr << "Failed to open file.\n";
         return 1;
       }
-      std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
-      bc = Blockchain::fromJsonString(content);
+      try {
+        bc = Blockchain::fromJsonStream(in);
+      } catch (const std::exception& e) {
+        std::cerr << "Failed to load chain: " << e.what() << "\n";
+        return 1;
+      }
       std::cout << "Loaded chain with " << bc.chain().size() << " blocks.\n";
     } else {
       std::cerr << "Unknown or incomplete argument: " << arg << "\n";
@@ -88,7 +92,9 @@ int main(int argc, char** argv) {
         break;
       }
       case 4: {
-        std::cout << (bc.isValid() ? "Chain is VALID" : "Chain is INVALID") << "\n";
+        std::size_t bad = 0;
+        if (bc.isValid(&bad)) std::cout << "Chain is VALID\n";
+        else std::cout << "Chain is INVALID (first bad block #" << bad << ")\n";
         break;
       }
       case 5: {
@@ -96,7 +102,7 @@ int main(int argc, char** argv) {
         std::string path;
         std::getline(std::cin, path);
         std::ofstream out(path);
-        out << bc.toJsonString(2);
+        bc.writeJson(out, 2);
         std::cout << "Saved.\n";
         break;
       }
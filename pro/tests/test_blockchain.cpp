@@ -6,8 +6,16 @@ Copyright (c) 2025 Morteza Taleblou (https://taleblou.ir/)
 #include "gtest/gtest.h"
 #include "blockchain.hpp"
 
+#include <sstream>
+
 using namespace sbc;
 
+namespace sbc {
+// Forward decls from block.cpp
+std::string calculate_hash(const Block& b);
+void mine_block(Block& b, int difficulty);
+}  // namespace sbc
+
 TEST(Blockchain, BasicFlow) {
   Blockchain bc(2);
   bc.addTransaction("A pays B 10");
@@ -21,3 +29,48 @@ TEST(Blockchain, BasicFlow) {
   chain[1].transactions[0] = "A pays B 1000";
   EXPECT_FALSE(bc.isValid());
 }
+
+TEST(Blockchain, ReportsFirstBadBlock) {
+  Blockchain bc(1);
+  for (int i = 0; i < 600; ++i) {  // spans several validation chunks
+    bc.addTransaction("tx " + std::to_string(i));
+    bc.minePending();
+  }
+  std::size_t bad = 0;
+  EXPECT_TRUE(bc.isValid(&bad));
+
+  auto& chain = const_cast<std::vector<Block>&>(bc.chain());
+  chain[420].transactions[0] = "forged";
+  chain[530].transactions[0] = "forged";
+  EXPECT_FALSE(bc.isValid(&bad));
+  EXPECT_EQ(bad, 420u);
+
+  // a broken link with an otherwise valid header is caught by the linkage pass
+  chain[130].prev_hash = chain[128].hash;
+  mine_block(chain[130], 1);
+  EXPECT_FALSE(bc.isValid(&bad));
+  EXPECT_EQ(bad, 130u);
+}
+
+TEST(Blockchain, StreamingJsonRoundTrip) {
+  Blockchain bc(1);
+  bc.addTransaction("A pays B \"10\"\nmemo");
+  bc.minePending();
+  bc.minePending();
+  for (int indent : {2, 4, -1}) {
+    std::string out = bc.toJsonString(indent);
+    EXPECT_EQ(json::parse(out).dump(indent), out);  // same text as the DOM dump
+    std::istringstream in(out);
+    auto loaded = Blockchain::fromJsonStream(in);
+    ASSERT_EQ(loaded.chain().size(), 3u);
+    EXPECT_EQ(loaded.chain()[1].transactions, bc.chain()[1].transactions);
+    EXPECT_EQ(loaded.difficulty(), 1);
+    EXPECT_TRUE(loaded.isValid());
+  }
+  auto j = json::parse(bc.toJsonString());
+  j["chain"][1]["index"] = "1";
+  EXPECT_THROW(Blockchain::fromJsonString(j.dump()), std::runtime_error);
+  j = json::parse(bc.toJsonString());
+  j["chain"][1].erase("prev_hash");
+  EXPECT_THROW(Blockchain::fromJsonString(j.dump()), std::runtime_error);
+}